@@ -0,0 +1,271 @@
+// sph_erosion_bench: isolated, repeatable timings of the simulation passes and of the instance buffer construction
+//
+// every benchmark starts from the same state: the terrain (fixed noise seed), particles spawned from a fixed rng seed,
+// then 'warmup' full simulation steps so the particles are spread over the terrain instead of sitting in the spawn box
+// each repetition restores that state, runs one pass and times only the pass
+//
+// usage: sph_erosion_bench [--particles 2000,8000,32000] [--sizes 16,32] [--reps 10] [--warmup 30] [--seed 1]
+//                          [--filter name] [--out results.json]
+//
+// the numa_* benchmarks run density + force on a particle array copied by the main thread ('serial_touch', what a plain
+// resize does) and on one first touched by the threads that own its blocks ('first_touch', numa_placement.h), and report
+// the fraction of each thread's pages that are on its own node; the rest of its own particles are read across sockets
+// (the neighbours of a particle are anywhere in the array, so their reads stay partly remote either way)
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include <data_structures.h>
+#include <render_data.h>
+#include <voxel_mesh.h>
+#include <culling.h>
+#include <thread_config.h>
+#include <numa_placement.h>
+#include <parallel.h>
+
+
+struct bench_options {
+    std::vector<int> particle_counts = { 2000, 8000, 32000 };
+    std::vector<int> field_sizes = { 16, 32 };
+    int reps = 10;
+    int warmup = 30;
+    unsigned int seed = 1;
+    std::string filter;
+    std::string out;
+};
+
+struct bench_result {
+    std::string name;
+    int particles;
+    int field_size;
+    int voxels;
+    std::vector<double> ms;
+    double local_pages = -1.0; // numa_* benchmarks only
+};
+
+// the simulation state a benchmark starts from
+struct bench_scene {
+    voxel_field V;
+    neighbourhood_grid G;
+    std::vector<particle> p;
+    std::vector<int> recycle_list;
+
+    bench_scene(int particles, unsigned int seed, int warmup)
+        : V(voxel_x_num, voxel_y_num, voxel_z_num), G(voxel_x_num, voxel_y_num, voxel_z_num), p(particles) {
+        set_up_voxel_field(V, voxel_density);
+        simulation_rng.seed(seed);
+        set_up_SPH_particles(p);
+        current_particle_num = particles;
+        for (int i = 0; i < warmup; i++) {
+            step();
+        }
+        // the passes after the grid build expect a grid that matches the positions
+        build_neighbour_grid(p, particles, G);
+    }
+
+    void step() {
+        calculate_SPH_movement(p, 0.0167f, V, G, recycle_list);
+        calculate_voxel_erosion(p, 0.0167f, V, G, recycle_list);
+        recycle_particle(p, recycle_list);
+    }
+};
+
+
+static std::vector<int> parse_list(const std::string& s) {
+    std::vector<int> values;
+    std::stringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+static double percentile(std::vector<double> v, double q) {
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, size_t(q * (v.size() - 1) + 0.5))];
+}
+
+static void write_json(std::ostream& out, const bench_options& options, const std::vector<bench_result>& results) {
+    out << "{\n";
+    out << "  \"config\": {\"threads\": " << global_thread_config.max_threads() << ", \"reps\": " << options.reps << ", \"warmup\": " << options.warmup
+        << ", \"seed\": " << options.seed << ", \"voxel_size\": " << voxel_size_scale << "},\n";
+    out << "  \"results\": [\n";
+    for (size_t n = 0; n < results.size(); n++) {
+        const bench_result& r = results[n];
+        double mean = 0.0;
+        for (double t : r.ms) {
+            mean += t;
+        }
+        mean /= r.ms.size();
+        out << "    {\"name\": \"" << r.name << "\", \"particles\": " << r.particles << ", \"field_size\": " << r.field_size
+            << ", \"voxels\": " << r.voxels << ", \"min_ms\": " << *std::min_element(r.ms.begin(), r.ms.end())
+            << ", \"median_ms\": " << percentile(r.ms, 0.5) << ", \"mean_ms\": " << mean
+            << ", \"max_ms\": " << *std::max_element(r.ms.begin(), r.ms.end());
+        if (r.local_pages >= 0.0) {
+            out << ", \"local_pages\": " << r.local_pages;
+        }
+        out << "}" << (n + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+
+int main(int argc, char** argv) {
+    bench_options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i], value = argv[i + 1];
+        if (arg == "--particles") {
+            options.particle_counts = parse_list(value);
+        } else if (arg == "--sizes") {
+            options.field_sizes = parse_list(value);
+        } else if (arg == "--reps") {
+            options.reps = std::max(std::stoi(value), 1);
+        } else if (arg == "--warmup") {
+            options.warmup = std::stoi(value);
+        } else if (arg == "--seed") {
+            options.seed = unsigned(std::stoul(value));
+        } else if (arg == "--filter") {
+            options.filter = value;
+        } else if (arg == "--out") {
+            options.out = value;
+        } else {
+            std::cerr << "unknown argument " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    // the threads the application runs with: one per physical core, pinned (needed for the numa_* benchmarks to mean anything)
+    cpu_topology topology = detect_cpu_topology();
+    apply_thread_config(auto_thread_config(topology, ""), topology);
+    std::cerr << global_thread_config.max_threads() << " threads" << (global_thread_config.pin ? " pinned" : "") << ", "
+              << numa_node_count() << " NUMA node(s)" << std::endl;
+
+    std::vector<bench_result> results;
+    for (int size : options.field_sizes) {
+        set_field_size(GLfloat(size));
+        for (int particles : options.particle_counts) {
+            std::cerr << "scene: field " << size << " (" << voxel_x_num << "x" << voxel_y_num << "x" << voxel_z_num << " voxels), "
+                      << particles << " particles" << std::endl;
+            const bench_scene initial(particles, options.seed, options.warmup);
+            bench_scene scene = initial;
+
+            // 'pass' runs on 'scene', which is reset to the initial state before every repetition
+            auto run = [&](const std::string& name, const std::function<void()>& pass, double local_pages = -1.0) {
+                if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+                    return;
+                }
+                bench_result r{ name, particles, size, voxel_x_num * voxel_y_num * voxel_z_num, {}, local_pages };
+                for (int rep = 0; rep < options.reps; rep++) {
+                    scene = initial;
+                    current_particle_num = particles;
+                    auto start = std::chrono::steady_clock::now();
+                    pass();
+                    auto end = std::chrono::steady_clock::now();
+                    r.ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+                }
+                std::cerr << "  " << name << ": " << percentile(r.ms, 0.5) << " ms";
+                if (local_pages >= 0.0) {
+                    std::cerr << ", " << local_pages * 100.0 << "% of the pages local";
+                }
+                std::cerr << std::endl;
+                results.push_back(r);
+            };
+
+            run("grid_build", [&] { build_neighbour_grid(scene.p, particles, scene.G); });
+            run("neighbour_query", [&] {
+                long long total = parallel_reduce(0, particles, 0LL, [&](int i) {
+                    std::vector<int> cell = scene.G.world_to_grid(scene.p[i].currPos);
+                    return static_cast<long long>(scene.G.get_neighbourhood(cell[0], cell[1], cell[2]).size());
+                }, [](long long a, long long b) { return a + b; }, 256);
+                if (total < 0) {
+                    std::cerr << total; // keep the queries from being optimized away
+                }
+            });
+            run("density", [&] { calculate_density(scene.p, particles, scene.G); });
+            run("force", [&] { calculate_force(scene.p, particles, scene.G); });
+            run("integrate_dda", [&] { integrate_particles(scene.p, particles, 0.0167f, scene.V, scene.recycle_list); });
+            run("diffusion", [&] { diffuse_particle_mass(scene.p, particles, 0.0167f, scene.G); });
+            run("erosion", [&] { calculate_voxel_erosion(scene.p, 0.0167f, scene.V, scene.G, scene.recycle_list); });
+            run("particle_instances", [&] {
+                static particle_instance_data instances;
+                build_particle_instance_data(scene.p, particles, cull_grid(scene.V.x_size, scene.V.y_size, scene.V.z_size), instances);
+            });
+            run("voxel_instances", [&] {
+                static std::vector<GLfloat> data;
+                build_voxel_instance_data(scene.V, data);
+            });
+            run("voxel_table_rebuild", [&] {
+                voxel_instance_table table;
+                table.update(scene.V);
+            });
+            run("terrain_mesh_build", [&] {
+                terrain_mesh mesh;
+                mesh.update(scene.V);
+            });
+            {
+                voxel_field V = initial.V;
+                voxel_instance_table table;
+                table.update(V);
+                std::cerr << "  voxel instances: " << table.count() << " of " << table.solid() << " existing voxels have an exposed face, "
+                          << table.count() * 6 * sizeof(GLfloat) / 1024 << " KB instead of " << table.solid() * 6 * sizeof(GLfloat) / 1024 << " KB per full upload" << std::endl;
+                terrain_mesh mesh;
+                mesh.update(V);
+                long long quads = 0, faces = 0;
+                for (const auto& chunk : mesh.meshes()) {
+                    quads += chunk->quad_count();
+                    faces += chunk->face_count;
+                }
+                std::cerr << "  terrain mesh: " << quads << " quads for " << faces << " voxel faces in " << mesh.chunk_count() << " chunks" << std::endl;
+            }
+            {
+                // the view of the start up camera of the app
+                render_snapshot frame;
+                build_particle_instance_data(scene.p, particles, cull_grid(scene.V.x_size, scene.V.y_size, scene.V.z_size), frame.particles);
+                voxel_instance_table table;
+                table.update(scene.V);
+                table.copy_to(frame.voxels);
+                glm::vec3 eye(5.934f, 6.572f, -1.650f), front(0.031f, -0.773f, 0.634f);
+                view_frustum frustum = make_view_frustum(glm::perspective(glm::radians(45.0f), 1080.0f / 720.0f, 0.5f, 10000.0f),
+                                                         glm::lookAt(eye, eye + front, glm::vec3(0.0f, 1.0f, 0.0f)), eye, 0.0f);
+                frame_culling culling;
+                run("cull_frame", [&] { cull_frame(frame, frustum, culling); });
+                const cull_stats& stats = culling.stats;
+                std::cerr << "  culling: " << stats.visible_cells << " of " << stats.cells << " cells, " << stats.visible_voxels << " of " << stats.voxels
+                          << " voxel instances, " << stats.visible_particles << " of " << stats.particles << " particles in view" << std::endl;
+            }
+            run("full_step", [&] { scene.step(); });
+
+            {
+                const int threads = global_thread_config.threads(PHASE_DENSITY);
+                std::vector<particle> serial_touch(initial.p);
+                std::vector<particle> first_touch;
+                first_touch.reserve(initial.p.size());
+                numa_first_touch(first_touch.data(), initial.p.size(), sizeof(particle), threads);
+                first_touch.assign(initial.p.begin(), initial.p.end());
+                for (auto* variant : { &serial_touch, &first_touch }) {
+                    numa_locality locality = numa_page_locality(variant->data(), variant->size(), sizeof(particle), threads);
+                    run(variant == &serial_touch ? "numa_serial_touch_density_force" : "numa_first_touch_density_force", [&] {
+                        calculate_density(*variant, particles, scene.G);
+                        calculate_force(*variant, particles, scene.G);
+                    }, locality.local_fraction());
+                }
+            }
+        }
+    }
+
+    if (options.out.empty()) {
+        write_json(std::cout, options, results);
+    } else {
+        std::ofstream out(options.out);
+        write_json(out, options, results);
+        std::cerr << "results written to " << options.out << std::endl;
+    }
+    return 0;
+}
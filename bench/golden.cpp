@@ -0,0 +1,601 @@
+// sph_erosion_golden: headless performance regression runner over the golden scenes (scene.h)
+//
+// every scene is simulated for its fixed number of steps; the runner records simulated steps per second, the mean time
+// of each simulation phase and a checksum of the final state (particles and voxels)
+// against a baseline file it fails (exit code 1) when:
+//   - the checksum differs (behaviour drift, the physics changed)
+//   - steps/s dropped by more than --tolerance (fraction)
+//   - a phase that takes at least --phase-min-ms got slower by more than --phase-tolerance (fraction)
+//
+// usage: sph_erosion_golden [--scenes default,dam_break] [--seed 1] [--out results.json]
+//                           [--baseline golden.txt [--tolerance 0.1] [--phase-tolerance 0.25] [--phase-min-ms 0.05]]
+//                           [--write-baseline golden.txt] [--perf-counters 1] [--threads 0] [--thread-config thread_config.txt]
+//        sph_erosion_golden --scaling 1,2,4|max [--scenes ...] [--out scaling.json] [--write-thread-config thread_config.txt]
+//
+// --threads 0 (default) picks the threads from the cpu topology (thread_config.h), with the per-phase counts of
+// --thread-config if given, --threads N runs N unpinned threads everywhere
+// --scaling runs every scene at each thread count ('max': powers of two up to the logical cpus, and the physical core count)
+// and reports the speedup and parallel efficiency of the whole step and of every phase relative to the smallest count;
+// the threads are pinned to physical cores as long as there are enough of them
+// --write-thread-config then writes the fewest threads that are within 3% of the fastest, per phase, for the auto mode
+// --perf-counters 1 also reports IPC, LLC misses and branch misses per particle of each phase (Linux, perf_event_open)
+// built with MEMORY_TRACKING=1 it also reports the bytes, peak bytes and allocations per step of each memory tag
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+#include <data_structures.h>
+#include <scene.h>
+#include <profiler.h>
+#include <perf_counters.h>
+#include <memory_tracker.h>
+#include <thread_config.h>
+#include <task_graph.h>
+
+
+// the phases of a simulation step
+static const profile_phase step_phases[] = {
+    PHASE_GRID_BUILD, PHASE_DENSITY, PHASE_FORCE, PHASE_INTEGRATE, PHASE_DIFFUSION, PHASE_EROSION, PHASE_RECYCLE, PHASE_STEP,
+    PHASE_CRITICAL_PATH,
+};
+
+struct golden_result {
+    std::string scene;
+    int steps = 0;
+    double steps_per_second = 0.0;
+    uint64_t checksum = 0;
+    std::map<std::string, double> phase_ms; // mean per step
+    std::map<std::string, double> phase_imbalance; // busiest thread / mean thread, mean per step, parallel phases only
+    std::map<std::string, perf_phase_stats> phase_counters; // mean per step, only with --perf-counters
+    memory_tag_stats memory[MEMORY_TAG_COUNT + 1];          // at the end of the run, the last one is the total
+    double allocations_per_step[MEMORY_TAG_COUNT + 1] = {};
+};
+
+struct golden_options {
+    std::vector<std::string> scenes;
+    unsigned int seed = 1;
+    std::string out;
+    std::string baseline;
+    std::string write_baseline;
+    double tolerance = 0.1;
+    double phase_tolerance = 0.25;
+    double phase_min_ms = 0.05;
+    bool perf_counters = false;
+    int threads = 0;
+    std::string thread_config_path;
+    std::vector<int> scaling;
+    std::string write_thread_config;
+};
+
+// a thread count is only picked over a smaller one when it is faster by more than this
+static const double thread_count_margin = 0.03;
+
+
+// FNV-1a over the bytes of the state that the physics produces
+class state_hash {
+public:
+    void add(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t n = 0; n < size; n++) {
+            hash = (hash ^ bytes[n]) * 1099511628211ull;
+        }
+    }
+    uint64_t value() const { return hash; }
+private:
+    uint64_t hash = 14695981039346656037ull;
+};
+
+static uint64_t state_checksum(const std::vector<particle>& p, int particle_num, voxel_field& V) {
+    state_hash h;
+    for (int i = 0; i < particle_num; i++) {
+        h.add(&p[i].currPos, sizeof(p[i].currPos));
+        h.add(&p[i].velocity, sizeof(p[i].velocity));
+        h.add(&p[i].mass, sizeof(p[i].mass));
+    }
+    for (int i = 0; i < V.x_size; i++) {
+        for (int j = 0; j < V.y_size; j++) {
+            for (int k = 0; k < V.z_size; k++) {
+                const voxel& v = V.get_voxel(i, j, k);
+                float density = v.exist ? v.density : 0.0f;
+                h.add(&v.exist, sizeof(v.exist));
+                h.add(&density, sizeof(density));
+            }
+        }
+    }
+    return h.value();
+}
+
+static golden_result run_scene(const scene_desc& scene, unsigned int seed) {
+    global_memory_tracker.reset_peaks();
+    set_scene_size(scene);
+    voxel_field V(voxel_x_num, voxel_y_num, voxel_z_num);
+    neighbourhood_grid G(voxel_x_num, voxel_y_num, voxel_z_num);
+    std::vector<particle> p;
+    std::vector<int> recycle_list;
+    set_up_scene(scene, seed, V, p);
+    std::cerr << "scene " << scene.name << ": " << scene.particles << " particles, field " << scene.field_size << ", "
+              << scene.steps << " steps" << std::endl;
+
+    golden_result r;
+    r.scene = scene.name;
+    r.steps = scene.steps;
+    double phase_sum[PHASE_COUNT] = {};
+    double imbalance_sum[PHASE_COUNT] = {};
+    global_profiler.end_frame(); // drop whatever was recorded while setting up
+    global_memory_tracker.end_frame();
+    if (global_perf_counters.active()) {
+        global_perf_counters.disable();
+        global_perf_counters.enable();
+    }
+
+    // the step graph of the app without the render and recording tasks, so the critical path is the chain of the passes
+    task_graph step_graph(0);
+    const float dt = 0.0167f;
+    bool grid_current = false;
+    add_step_tasks(step_graph, p, dt, V, G, recycle_list, grid_current);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 0; step < scene.steps; step++) {
+        {
+            profile_scope scope(PHASE_STEP);
+            step_graph.run();
+        }
+        global_profiler.add(PHASE_CRITICAL_PATH, uint64_t(step_graph.timings().critical_path));
+        global_profiler.end_frame();
+        global_perf_counters.end_frame();
+        global_memory_tracker.end_frame();
+        for (profile_phase phase : step_phases) {
+            phase_sum[phase] += global_profiler.last(phase);
+            imbalance_sum[phase] += global_profiler.last_imbalance(phase);
+        }
+        for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+            r.allocations_per_step[tag] += global_memory_tracker.stats(tag).frame_allocations;
+        }
+        r.allocations_per_step[MEMORY_TAG_COUNT] += global_memory_tracker.total().frame_allocations;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    r.steps_per_second = scene.steps / seconds;
+    for (profile_phase phase : step_phases) {
+        r.phase_ms[profile_phase_key(phase)] = phase_sum[phase] / scene.steps;
+        if (imbalance_sum[phase] > 0.0) {
+            r.phase_imbalance[profile_phase_key(phase)] = imbalance_sum[phase] / scene.steps;
+        }
+    }
+    r.checksum = state_checksum(p, current_particle_num, V);
+    for (int tag = 0; tag <= MEMORY_TAG_COUNT; tag++) {
+        r.memory[tag] = tag < MEMORY_TAG_COUNT ? global_memory_tracker.stats(tag) : global_memory_tracker.total();
+        r.allocations_per_step[tag] /= scene.steps;
+    }
+    if (memory_tracker::enabled) {
+        std::cerr << "  memory                     MB   peak MB  allocations/step" << std::endl;
+        for (int tag = 0; tag <= MEMORY_TAG_COUNT; tag++) {
+            const memory_tag_stats& m = r.memory[tag];
+            std::cerr << "  " << std::left << std::setw(22) << (tag < MEMORY_TAG_COUNT ? memory_tag_names[tag] : "total") << std::right
+                      << std::fixed << std::setprecision(2) << std::setw(8) << m.bytes / 1048576.0 << std::setw(10) << m.peak_bytes / 1048576.0
+                      << std::setprecision(0) << std::setw(18) << r.allocations_per_step[tag] << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+    }
+    std::cerr << "  " << r.steps_per_second << " steps/s, checksum " << std::hex << r.checksum << std::dec << std::endl;
+    std::cerr << "  imbalance (busiest thread / mean thread):";
+    for (auto& phase : r.phase_imbalance) {
+        std::cerr << " " << phase.first << " " << std::fixed << std::setprecision(2) << phase.second << std::defaultfloat << std::setprecision(6);
+    }
+    std::cerr << std::endl;
+    if (global_perf_counters.active()) {
+        std::cerr << "  phase             IPC   cycles/particle  LLC misses/particle  branch misses/particle" << std::endl;
+        for (profile_phase phase : step_phases) {
+            if (phase == PHASE_STEP || phase == PHASE_CRITICAL_PATH) {
+                continue; // has no counters of its own
+            }
+            perf_phase_stats c = global_perf_counters.stats(phase);
+            r.phase_counters[profile_phase_key(phase)] = c;
+            double per_particle = 1.0 / scene.particles;
+            std::cerr << "  " << std::left << std::setw(16) << profile_phase_key(phase) << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(5) << c.ipc() << std::setw(17) << c.value[PERF_CYCLES] * per_particle
+                      << std::setw(21) << c.value[PERF_LLC_MISSES] * per_particle
+                      << std::setw(24) << c.value[PERF_BRANCH_MISSES] * per_particle << std::defaultfloat << std::setprecision(6)
+                      << (c.multiplexed ? "  (multiplexed, scaled)" : "") << std::endl;
+        }
+    }
+    return r;
+}
+
+
+// baseline file: one line per scene
+// <scene> <steps> <steps per second> <checksum> <phase>=<ms> ...
+static void write_baseline(const std::string& path, const std::vector<golden_result>& results) {
+    std::ofstream out(path);
+    out << "# sph_erosion_golden baseline, " << global_thread_config.max_threads() << " threads\n";
+    out << "# scene steps steps_per_second checksum phase=mean_ms...\n";
+    for (const golden_result& r : results) {
+        out << r.scene << " " << r.steps << " " << r.steps_per_second << " " << std::hex << r.checksum << std::dec;
+        for (auto& phase : r.phase_ms) {
+            out << " " << phase.first << "=" << phase.second;
+        }
+        out << "\n";
+    }
+    std::cerr << "baseline written to " << path << std::endl;
+}
+
+static bool read_baseline(const std::string& path, std::map<std::string, golden_result>& baseline) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        golden_result r;
+        fields >> r.scene >> r.steps >> r.steps_per_second >> std::hex >> r.checksum >> std::dec;
+        std::string phase;
+        while (fields >> phase) {
+            size_t eq = phase.find('=');
+            if (eq != std::string::npos) {
+                r.phase_ms[phase.substr(0, eq)] = std::stod(phase.substr(eq + 1));
+            }
+        }
+        baseline[r.scene] = r;
+    }
+    return true;
+}
+
+// prints every regression, returns how many there are
+static int compare_with_baseline(const golden_options& options, const golden_result& r, const golden_result& base) {
+    int regressions = 0;
+    if (r.steps != base.steps) {
+        std::cout << r.scene << ": baseline has " << base.steps << " steps, this run " << r.steps << ", not compared" << std::endl;
+        return 0;
+    }
+    if (r.checksum != base.checksum) {
+        std::cout << r.scene << ": BEHAVIOUR DRIFT, checksum " << std::hex << r.checksum << " != baseline " << base.checksum << std::dec << std::endl;
+        regressions++;
+    }
+    double change = r.steps_per_second / base.steps_per_second - 1.0;
+    if (change < -options.tolerance) {
+        std::cout << r.scene << ": REGRESSION, " << r.steps_per_second << " steps/s vs baseline " << base.steps_per_second
+                  << " (" << change * 100.0 << "%)" << std::endl;
+        regressions++;
+    }
+    else {
+        std::cout << r.scene << ": " << r.steps_per_second << " steps/s vs baseline " << base.steps_per_second << " ("
+                  << (change >= 0.0 ? "+" : "") << change * 100.0 << "%)" << std::endl;
+    }
+    for (auto& phase : r.phase_ms) {
+        auto b = base.phase_ms.find(phase.first);
+        if (b == base.phase_ms.end() || b->second < options.phase_min_ms) {
+            continue;
+        }
+        if (phase.second > b->second * (1.0 + options.phase_tolerance)) {
+            std::cout << r.scene << ": REGRESSION in " << phase.first << ", " << phase.second << " ms vs baseline " << b->second
+                      << " ms" << std::endl;
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+static int particles_of(const std::string& scene) {
+    const scene_desc* s = find_scene(scene);
+    return s != nullptr ? s->particles : 1;
+}
+
+static void write_json(std::ostream& out, const std::vector<golden_result>& results) {
+    out << "{\n  \"threads\": " << global_thread_config.max_threads() << ",\n  \"pinned\": " << (global_thread_config.pin ? "true" : "false")
+        << ",\n  \"scenes\": [\n";
+    for (size_t n = 0; n < results.size(); n++) {
+        const golden_result& r = results[n];
+        out << "    {\"scene\": \"" << r.scene << "\", \"steps\": " << r.steps << ", \"steps_per_second\": " << r.steps_per_second
+            << ", \"checksum\": \"" << std::hex << r.checksum << std::dec << "\", \"phase_ms\": {";
+        bool first = true;
+        for (auto& phase : r.phase_ms) {
+            out << (first ? "" : ", ") << "\"" << phase.first << "\": " << phase.second;
+            first = false;
+        }
+        out << "}, \"phase_imbalance\": {";
+        first = true;
+        for (auto& phase : r.phase_imbalance) {
+            out << (first ? "" : ", ") << "\"" << phase.first << "\": " << phase.second;
+            first = false;
+        }
+        out << "}";
+        if (memory_tracker::enabled) {
+            out << ", \"memory\": {";
+            for (int tag = 0; tag <= MEMORY_TAG_COUNT; tag++) {
+                const memory_tag_stats& m = r.memory[tag];
+                out << (tag == 0 ? "" : ", ") << "\"" << (tag < MEMORY_TAG_COUNT ? memory_tag_names[tag] : "total") << "\": {\"bytes\": "
+                    << m.bytes << ", \"peak_bytes\": " << m.peak_bytes << ", \"allocations_per_step\": " << r.allocations_per_step[tag] << "}";
+            }
+            out << "}";
+        }
+        if (!r.phase_counters.empty()) {
+            out << ", \"phase_counters_per_particle\": {";
+            first = true;
+            for (auto& phase : r.phase_counters) {
+                double per_particle = 1.0 / particles_of(r.scene);
+                out << (first ? "" : ", ") << "\"" << phase.first << "\": {\"ipc\": " << phase.second.ipc()
+                    << ", \"multiplexed\": " << (phase.second.multiplexed ? "true" : "false");
+                for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+                    if (phase.second.available[c]) {
+                        out << ", \"" << perf_counter_names[c] << "\": " << phase.second.value[c] * per_particle;
+                    }
+                }
+                out << "}";
+                first = false;
+            }
+            out << "}";
+        }
+        out << "}" << (n + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+
+// ----------------------------------------------------------------------scaling------------------------------------------------------
+
+// the results of one scene at each thread count of the scaling run
+struct scaling_result {
+    std::string scene;
+    std::vector<int> threads;
+    std::vector<golden_result> runs;
+
+    double speedup(size_t run) const { return runs[run].steps_per_second / runs[0].steps_per_second; }
+    double phase_speedup(size_t run, const std::string& phase) const {
+        double ms = runs[run].phase_ms.at(phase);
+        return ms > 0.0 ? runs[0].phase_ms.at(phase) / ms : 0.0;
+    }
+    // relative to perfect scaling from the smallest thread count
+    double efficiency(double speedup, size_t run) const { return speedup * threads[0] / threads[run]; }
+};
+
+static std::vector<int> max_scaling_threads(const cpu_topology& topology) {
+    std::vector<int> threads;
+    for (int t = 1; t < topology.logical_cpus; t *= 2) {
+        threads.push_back(t);
+    }
+    threads.push_back(topology.logical_cpus);
+    threads.push_back(topology.physical_cores);
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+    return threads;
+}
+
+static scaling_result run_scaling(const scene_desc& scene, const golden_options& options, const cpu_topology& topology) {
+    scaling_result s;
+    s.scene = scene.name;
+    s.threads = options.scaling;
+    for (int threads : options.scaling) {
+        thread_config config = fixed_thread_config(threads);
+        config.pin = threads <= int(topology.core_cpus.size());
+        apply_thread_config(config, topology);
+        std::cerr << threads << " threads" << (config.pin ? " pinned" : "") << ", ";
+        s.runs.push_back(run_scene(scene, options.seed));
+    }
+
+    std::cout << "scaling " << scene.name << " (" << scene.particles << " particles)" << std::endl;
+    std::cout << "  threads  steps/s  speedup  efficiency" << std::endl;
+    for (size_t n = 0; n < s.runs.size(); n++) {
+        double speedup = s.speedup(n);
+        std::cout << std::fixed << std::setprecision(2) << "  " << std::setw(7) << s.threads[n] << std::setw(9) << s.runs[n].steps_per_second
+                  << std::setw(8) << speedup << "x" << std::setw(11) << s.efficiency(speedup, n) * 100.0 << "%" << std::endl;
+    }
+    std::cout << "  phase ms (speedup, efficiency)" << std::endl;
+    for (profile_phase phase : step_phases) {
+        std::string key = profile_phase_key(phase);
+        std::cout << "  " << std::left << std::setw(14) << key << std::right;
+        for (size_t n = 0; n < s.runs.size(); n++) {
+            double speedup = s.phase_speedup(n, key);
+            std::cout << std::setw(9) << s.runs[n].phase_ms.at(key) << " (" << std::setw(5) << speedup << "x "
+                      << std::setw(4) << std::setprecision(0) << s.efficiency(speedup, n) * 100.0 << "%)" << std::setprecision(2);
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+    for (const golden_result& r : s.runs) {
+        if (r.checksum != s.runs[0].checksum) {
+            std::cout << "  checksums differ between thread counts, the simulation is not deterministic" << std::endl;
+            break;
+        }
+    }
+    return s;
+}
+
+static void write_scaling_json(std::ostream& out, const std::vector<scaling_result>& results, const cpu_topology& topology) {
+    out << "{\n  \"logical_cpus\": " << topology.logical_cpus << ",\n  \"physical_cores\": " << topology.physical_cores
+        << ",\n  \"packages\": " << topology.packages << ",\n  \"scaling\": [\n";
+    for (size_t n = 0; n < results.size(); n++) {
+        const scaling_result& s = results[n];
+        out << "    {\"scene\": \"" << s.scene << "\", \"runs\": [\n";
+        for (size_t run = 0; run < s.runs.size(); run++) {
+            const golden_result& r = s.runs[run];
+            double speedup = s.speedup(run);
+            out << "      {\"threads\": " << s.threads[run] << ", \"steps_per_second\": " << r.steps_per_second << ", \"speedup\": " << speedup
+                << ", \"efficiency\": " << s.efficiency(speedup, run) << ", \"checksum\": \"" << std::hex << r.checksum << std::dec << "\", \"phases\": {";
+            bool first = true;
+            for (auto& phase : r.phase_ms) {
+                double phase_speedup = s.phase_speedup(run, phase.first);
+                out << (first ? "" : ", ") << "\"" << phase.first << "\": {\"ms\": " << phase.second << ", \"speedup\": " << phase_speedup
+                    << ", \"efficiency\": " << s.efficiency(phase_speedup, run) << "}";
+                first = false;
+            }
+            out << "}}" << (run + 1 < s.runs.size() ? "," : "") << "\n";
+        }
+        out << "    ]}" << (n + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// the fewest threads whose time, relative to the smallest count and summed over the scenes, is within the margin of the best
+static int best_thread_count(const std::vector<scaling_result>& results, const std::string& phase) {
+    const std::vector<int>& threads = results[0].threads;
+    std::vector<double> cost(threads.size(), 0.0);
+    for (const scaling_result& s : results) {
+        for (size_t n = 0; n < threads.size(); n++) {
+            double speedup = s.phase_speedup(n, phase);
+            cost[n] += speedup > 0.0 ? 1.0 / speedup : 1.0;
+        }
+    }
+    double best = *std::min_element(cost.begin(), cost.end());
+    for (size_t n = 0; n < threads.size(); n++) {
+        if (cost[n] <= best * (1.0 + thread_count_margin)) {
+            return threads[n];
+        }
+    }
+    return threads.back();
+}
+
+static void write_scaling_thread_config(const std::string& path, const std::vector<scaling_result>& results, const cpu_topology& topology) {
+    thread_config config;
+    config.default_threads = best_thread_count(results, profile_phase_key(PHASE_STEP));
+    for (profile_phase phase : threaded_phases) {
+        config.phase_threads[phase] = best_thread_count(results, profile_phase_key(phase));
+    }
+    config.pin = config.max_threads() <= int(topology.core_cpus.size());
+    if (!config.save(path)) {
+        std::cerr << "cannot write " << path << std::endl;
+        return;
+    }
+    std::cout << "thread config written to " << path << ": default " << config.default_threads;
+    for (profile_phase phase : threaded_phases) {
+        std::cout << ", " << profile_phase_key(phase) << " " << config.phase_threads[phase];
+    }
+    std::cout << (config.pin ? ", pinned" : "") << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+    golden_options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i], value = argv[i + 1];
+        if (arg == "--scenes") {
+            std::stringstream in(value);
+            std::string name;
+            while (std::getline(in, name, ',')) {
+                options.scenes.push_back(name);
+            }
+        } else if (arg == "--seed") {
+            options.seed = unsigned(std::stoul(value));
+        } else if (arg == "--out") {
+            options.out = value;
+        } else if (arg == "--baseline") {
+            options.baseline = value;
+        } else if (arg == "--write-baseline") {
+            options.write_baseline = value;
+        } else if (arg == "--tolerance") {
+            options.tolerance = std::stod(value);
+        } else if (arg == "--phase-tolerance") {
+            options.phase_tolerance = std::stod(value);
+        } else if (arg == "--phase-min-ms") {
+            options.phase_min_ms = std::stod(value);
+        } else if (arg == "--perf-counters") {
+            options.perf_counters = value != "0";
+        } else if (arg == "--threads") {
+            options.threads = std::stoi(value);
+        } else if (arg == "--thread-config") {
+            options.thread_config_path = value;
+        } else if (arg == "--scaling") {
+            if (value == "max") {
+                options.scaling = max_scaling_threads(detect_cpu_topology());
+                continue;
+            }
+            std::stringstream in(value);
+            std::string threads;
+            while (std::getline(in, threads, ',')) {
+                options.scaling.push_back(std::max(std::stoi(threads), 1));
+            }
+            std::sort(options.scaling.begin(), options.scaling.end());
+        } else if (arg == "--write-thread-config") {
+            options.write_thread_config = value;
+        } else {
+            std::cerr << "unknown argument " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<const scene_desc*> scenes;
+    if (options.scenes.empty()) {
+        for (const scene_desc& scene : golden_scenes) {
+            scenes.push_back(&scene);
+        }
+    }
+    for (const std::string& name : options.scenes) {
+        const scene_desc* scene = find_scene(name);
+        if (scene == nullptr) {
+            std::cerr << "unknown scene " << name << ", the scenes are:";
+            for (const scene_desc& s : golden_scenes) {
+                std::cerr << " " << s.name;
+            }
+            std::cerr << std::endl;
+            return 2;
+        }
+        scenes.push_back(scene);
+    }
+
+    std::map<std::string, golden_result> baseline;
+    if (!options.baseline.empty() && !read_baseline(options.baseline, baseline)) {
+        std::cerr << "cannot read baseline " << options.baseline << std::endl;
+        return 2;
+    }
+
+    if (options.perf_counters && !global_perf_counters.enable()) {
+        std::cerr << "running without hardware counters: " << global_perf_counters.status() << std::endl;
+    }
+
+    cpu_topology topology = detect_cpu_topology();
+    std::cerr << topology.logical_cpus << " logical cpus, " << topology.physical_cores << " physical cores, " << topology.packages
+              << " package(s)" << std::endl;
+    if (!options.scaling.empty()) {
+        std::vector<scaling_result> results;
+        for (const scene_desc* scene : scenes) {
+            results.push_back(run_scaling(*scene, options, topology));
+        }
+        if (!options.out.empty()) {
+            std::ofstream out(options.out);
+            write_scaling_json(out, results, topology);
+        }
+        if (!options.write_thread_config.empty()) {
+            write_scaling_thread_config(options.write_thread_config, results, topology);
+        }
+        return 0;
+    }
+    apply_thread_config(options.threads > 0 ? fixed_thread_config(options.threads) : auto_thread_config(topology, options.thread_config_path), topology);
+    std::cerr << global_thread_config.max_threads() << " threads" << (global_thread_config.pin ? " pinned" : "") << std::endl;
+
+    std::vector<golden_result> results;
+    for (const scene_desc* scene : scenes) {
+        results.push_back(run_scene(*scene, options.seed));
+    }
+
+    if (!options.out.empty()) {
+        std::ofstream out(options.out);
+        write_json(out, results);
+    }
+    if (!options.write_baseline.empty()) {
+        write_baseline(options.write_baseline, results);
+    }
+
+    int regressions = 0;
+    if (!options.baseline.empty()) {
+        for (const golden_result& r : results) {
+            auto base = baseline.find(r.scene);
+            if (base == baseline.end()) {
+                std::cout << r.scene << ": not in the baseline" << std::endl;
+                continue;
+            }
+            regressions += compare_with_baseline(options, r, base->second);
+        }
+        std::cout << (regressions == 0 ? "no regressions" : std::to_string(regressions) + " regression(s)") << std::endl;
+    }
+    return regressions == 0 ? 0 : 1;
+}
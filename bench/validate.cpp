@@ -0,0 +1,434 @@
+// sph_erosion_validate: differential check of the optimised SPH passes against the brute force reference (physics.h)
+//
+// a scene is simulated with the production step; before every step, each variant below and the reference start from
+// the same state and run density -> force -> integration, and their densities, pressures, neighbour counts,
+// accelerations, deltaCs, velocities and positions are compared within tolerances
+// the first value out of tolerance is reported and the exit code is 1, so the check can gate an optimisation
+//
+// usage: sph_erosion_validate [--particles 500,2000] [--sizes 8,16] [--steps 200] [--seed 1] [--variant name]
+//                             [--tolerance-scale 1]
+//        sph_erosion_validate --mesh 300 [--seed 1]
+//
+// --mesh checks the CPU side of the voxel rendering instead, on a small field edited at random for that many rounds:
+// the quads of the terrain meshes (voxel_mesh.h) cover exactly the exposed voxel faces, each wound along its normal,
+// and after every round the chunks meshed again, the voxel instance table (render_data.h) and the instances copied
+// through changes_since are the same as the ones built from scratch
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+#include <random>
+#include <cstring>
+
+#include <data_structures.h>
+#include <physics.h>
+#include <terrain_generator.h>
+#include <voxel_mesh.h>
+#include <render_data.h>
+
+
+// an implementation of the density and force passes, add new versions (SIMD, neighbour lists, symmetric pairs...) here
+struct sph_variant {
+    const char* name;
+    void (*density)(std::vector<particle>& p, int particle_num, neighbourhood_grid& G);
+    void (*force)(std::vector<particle>& p, int particle_num, neighbourhood_grid& G);
+};
+
+static const sph_variant sph_variants[] = {
+    { "grid", calculate_density, calculate_force },
+};
+
+// a value matches the reference when |value - reference| <= absolute + relative * |reference|
+struct tolerance {
+    const char* quantity;
+    double absolute;
+    double relative;
+};
+
+// summation order differs from the reference (cell by cell instead of by index), so only rounding is allowed;
+// the neighbour count has to be exact, a missing neighbour is always a bug
+static const tolerance density_tolerance = { "density", 1e-3, 1e-4 };
+static const tolerance pressure_tolerance = { "pressure", 0.5, 1e-4 }; // stiffness * (density - rest density) cancels
+static const tolerance neighbour_tolerance = { "neighbour count", 0.0, 0.0 };
+static const tolerance acceleration_tolerance = { "acceleration", 1e-2, 1e-3 };
+static const tolerance delta_cs_tolerance = { "deltaCs", 1e-2, 0.0 };
+static const tolerance velocity_tolerance = { "velocity", 1e-3, 1e-4 };
+static const tolerance position_tolerance = { "position", 1e-4, 0.0 };
+
+struct divergence {
+    bool found = false;
+    int particle = -1;
+    int component = 0;
+    const tolerance* quantity = nullptr;
+    double reference = 0.0;
+    double value = 0.0;
+};
+
+// compares the particles and remembers the worst error (in units of the tolerance) of each quantity
+class comparator {
+public:
+    explicit comparator(double _scale) : scale(_scale) {}
+
+    void compare(const tolerance& t, int particle, int component, double reference, double value) {
+        bool reference_nan = std::isnan(reference), value_nan = std::isnan(value);
+        double error;
+        if (reference_nan || value_nan) {
+            // normalize() of a zero vector is NaN in both versions, that is fine
+            error = reference_nan == value_nan ? 0.0 : INFINITY;
+        }
+        else {
+            double allowed = scale * (t.absolute + t.relative * std::abs(reference));
+            double difference = std::abs(value - reference);
+            error = difference == 0.0 ? 0.0 : (allowed > 0.0 ? difference / allowed : INFINITY);
+        }
+        double& worst = worst_error[t.quantity];
+        worst = std::max(worst, error);
+        if (error > 1.0 && !first.found) {
+            first = { true, particle, component, &t, reference, value };
+        }
+    }
+
+    void compare(const tolerance& t, int particle, const glm::vec3& reference, const glm::vec3& value) {
+        for (int c = 0; c < 3; c++) {
+            compare(t, particle, c, reference[c], value[c]);
+        }
+    }
+
+    divergence first;
+    std::vector<std::pair<std::string, double>> worst() const {
+        return { worst_error.begin(), worst_error.end() };
+    }
+private:
+    double scale;
+    std::map<std::string, double> worst_error;
+};
+
+struct validate_options {
+    std::vector<int> particle_counts = { 500, 2000 };
+    std::vector<int> field_sizes = { 8, 16 };
+    int steps = 200;
+    unsigned int seed = 1;
+    std::string variant;
+    double tolerance_scale = 1.0;
+    int mesh_rounds = 0; // --mesh, 0 = the SPH check
+};
+
+
+static std::vector<int> parse_list(const std::string& s) {
+    std::vector<int> values;
+    std::stringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+static void report(const divergence& d, const char* variant, const char* stage, int step, const std::vector<particle>& state, double scale) {
+    const char* axis = "xyz";
+    std::cout << std::setprecision(9) << "DIVERGED: variant '" << variant << "', step " << step << ", " << stage << " stage, particle " << d.particle
+              << ", " << d.quantity->quantity;
+    if (d.quantity != &density_tolerance && d.quantity != &pressure_tolerance && d.quantity != &neighbour_tolerance) {
+        std::cout << "." << axis[d.component];
+    }
+    std::cout << ": reference " << d.reference << ", variant " << d.value << " (allowed " << scale * (d.quantity->absolute + d.quantity->relative * std::abs(d.reference))
+              << ")" << std::endl;
+    const glm::vec3& pos = state[d.particle].currPos;
+    std::cout << "  particle position before the step: " << pos.x << " " << pos.y << " " << pos.z << std::endl;
+}
+
+// runs one scene, returns false at the first divergence
+static bool validate_scene(const validate_options& options, int particles, int size) {
+    set_field_size(GLfloat(size));
+    voxel_field V(voxel_x_num, voxel_y_num, voxel_z_num);
+    neighbourhood_grid G(voxel_x_num, voxel_y_num, voxel_z_num);
+    std::vector<particle> p(particles);
+    std::vector<int> recycle_list;
+    set_up_voxel_field(V, voxel_density);
+    simulation_rng.seed(options.seed);
+    set_up_SPH_particles(p);
+    current_particle_num = particles;
+
+    std::cout << "scene: field " << size << " (" << voxel_x_num << "x" << voxel_y_num << "x" << voxel_z_num << " voxels), "
+              << particles << " particles, " << options.steps << " steps" << std::endl;
+
+    const float dt = 0.0167f;
+    std::vector<std::pair<std::string, double>> worst;
+    for (int step = 0; step < options.steps; step++) {
+        std::vector<particle> reference = p;
+        std::vector<int> reference_recycle;
+        reference_density(reference, particles);
+        std::vector<particle> reference_after_density = reference;
+        reference_force(reference, particles);
+        std::vector<particle> reference_after_force = reference;
+        integrate_particles(reference, particles, dt, V, reference_recycle);
+
+        for (const sph_variant& variant : sph_variants) {
+            if (!options.variant.empty() && options.variant != variant.name) {
+                continue;
+            }
+            std::vector<particle> q = p;
+            std::vector<int> variant_recycle;
+            comparator check(options.tolerance_scale);
+
+            build_neighbour_grid(q, particles, G);
+            variant.density(q, particles, G);
+            for (int i = 0; i < particles; i++) {
+                check.compare(density_tolerance, i, 0, reference_after_density[i].pamameters[0], q[i].pamameters[0]);
+                check.compare(pressure_tolerance, i, 0, reference_after_density[i].pamameters[1], q[i].pamameters[1]);
+                check.compare(neighbour_tolerance, i, 0, reference_after_density[i].pamameters[2], q[i].pamameters[2]);
+            }
+            if (check.first.found) {
+                report(check.first, variant.name, "density", step, p, options.tolerance_scale);
+                return false;
+            }
+
+            variant.force(q, particles, G);
+            for (int i = 0; i < particles; i++) {
+                check.compare(acceleration_tolerance, i, reference_after_force[i].acceleration, q[i].acceleration);
+                check.compare(delta_cs_tolerance, i, reference_after_force[i].deltaCs, q[i].deltaCs);
+            }
+            if (check.first.found) {
+                report(check.first, variant.name, "force", step, p, options.tolerance_scale);
+                return false;
+            }
+
+            integrate_particles(q, particles, dt, V, variant_recycle);
+            for (int i = 0; i < particles; i++) {
+                check.compare(velocity_tolerance, i, reference[i].velocity, q[i].velocity);
+                check.compare(position_tolerance, i, reference[i].currPos, q[i].currPos);
+            }
+            if (check.first.found) {
+                report(check.first, variant.name, "integration", step, p, options.tolerance_scale);
+                return false;
+            }
+
+            for (auto& w : check.worst()) {
+                auto it = std::find_if(worst.begin(), worst.end(), [&w](const auto& e) { return e.first == w.first; });
+                if (it == worst.end()) {
+                    worst.push_back(w);
+                }
+                else {
+                    it->second = std::max(it->second, w.second);
+                }
+            }
+        }
+
+        // move on with the production step (erosion and recycling included), so later steps see eroded terrain
+        calculate_SPH_movement(p, dt, V, G, recycle_list);
+        calculate_voxel_erosion(p, dt, V, G, recycle_list);
+        recycle_particle(p, recycle_list);
+    }
+
+    std::cout << "  ok, worst error in units of the tolerance:";
+    for (auto& w : worst) {
+        std::cout << " " << w.first << " " << w.second << ";";
+    }
+    std::cout << std::endl;
+    return true;
+}
+
+
+// ----------------------------------------------------------------------voxel meshes and instances------------------------------------------------------
+
+static bool drawn(voxel_field& V, int x, int y, int z) {
+    const voxel& v = V.get_voxel(x, y, z);
+    return v.exist && !v.debug;
+}
+
+// the faces between a drawn voxel and one that is not drawn (or the edge of the field), one by one
+static long long count_exposed_faces(voxel_field& V) {
+    static const int neighbours[6][3] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+    long long faces = 0;
+    for (int i = 0; i < V.x_size; i++) {
+        for (int j = 0; j < V.y_size; j++) {
+            for (int k = 0; k < V.z_size; k++) {
+                if (!drawn(V, i, j, k)) {
+                    continue;
+                }
+                for (const int* n : neighbours) {
+                    faces += drawn(V, i + n[0], j + n[1], k + n[2]) ? 0 : 1;
+                }
+            }
+        }
+    }
+    return faces;
+}
+
+// the quads of all chunks cover the exposed faces and face out of the voxels, false with a message otherwise
+static bool check_mesh_faces(voxel_field& V, const terrain_mesh& mesh) {
+    long long expected = count_exposed_faces(V);
+    double area = 0.0;
+    long long face_count = 0;
+    for (int c = 0; c < mesh.chunk_count(); c++) {
+        const chunk_mesh& chunk = *mesh.meshes()[c];
+        face_count += chunk.face_count;
+        for (int q = 0; q < chunk.quad_count(); q++) {
+            const GLuint* index = &chunk.indices[size_t(q) * 6];
+            for (int t = 0; t < 2; t++) {
+                const mesh_vertex& a = chunk.vertices[index[t * 3]];
+                const mesh_vertex& b = chunk.vertices[index[t * 3 + 1]];
+                const mesh_vertex& d = chunk.vertices[index[t * 3 + 2]];
+                glm::dvec3 pa(a.position[0], a.position[1], a.position[2]);
+                glm::dvec3 pb(b.position[0], b.position[1], b.position[2]);
+                glm::dvec3 pd(d.position[0], d.position[1], d.position[2]);
+                glm::dvec3 normal(a.normal[0], a.normal[1], a.normal[2]);
+                glm::dvec3 cross = glm::cross(pb - pa, pd - pa);
+                if (glm::dot(cross, normal) <= 0.0) {
+                    std::cout << "MESH: chunk " << c << ", quad " << q << " is not wound counter clockwise around its normal" << std::endl;
+                    return false;
+                }
+                area += glm::length(cross) / 2.0;
+            }
+        }
+    }
+    double faces = area / (double(voxel_size_scale) * voxel_size_scale);
+    if (std::abs(faces - double(expected)) > 1e-3 * std::max(double(expected), 1.0) || face_count != expected) {
+        std::cout << "MESH: the quads cover " << faces << " faces (" << face_count << " counted), the field has " << expected
+                  << " exposed faces" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool same_chunk(const chunk_mesh& a, const chunk_mesh& b) {
+    return a.face_count == b.face_count && a.indices == b.indices && a.vertices.size() == b.vertices.size()
+        && std::memcmp(a.vertices.data(), b.vertices.data(), sizeof(mesh_vertex) * a.vertices.size()) == 0;
+}
+
+// the instances as a set, the slots of an updated table are in another order than those of a fresh one
+static std::vector<std::vector<GLfloat>> sorted_instances(const std::vector<GLfloat>& data, int count) {
+    std::vector<std::vector<GLfloat>> instances(count);
+    for (int i = 0; i < count; i++) {
+        instances[i].assign(data.begin() + size_t(i) * 6, data.begin() + size_t(i) * 6 + 6);
+    }
+    std::sort(instances.begin(), instances.end());
+    return instances;
+}
+
+// random edits near the terrain surface, every round the updated meshes and instances against fresh ones
+static bool validate_voxel_meshes(const validate_options& options) {
+    voxel_field V(40, 30, 37);
+    terrain_config terrain;
+    terrain.max_height = 20;
+    set_up_voxel_field(V, voxel_density, terrain);
+    std::cout << "meshes: " << V.x_size << "x" << V.y_size << "x" << V.z_size << " voxels, " << options.mesh_rounds << " rounds of edits" << std::endl;
+
+    terrain_mesh mesh;
+    mesh.update(V);
+    voxel_instance_table table;
+    table.update(V);
+    // one copy follows every version, the other only every few rounds, so changes_since merges several versions
+    voxel_instance_data every_round, every_few_rounds;
+    table.copy_to(every_round);
+    table.copy_to(every_few_rounds);
+    if (!check_mesh_faces(V, mesh)) {
+        return false;
+    }
+
+    std::mt19937 rng(options.seed);
+    std::uniform_int_distribution<int> edits(1, 40), x(0, V.x_size - 1), y(0, V.y_size - 1), z(0, V.z_size - 1);
+    std::uniform_real_distribution<float> density(0.0f, voxel_maximum_density);
+    for (int round = 0; round < options.mesh_rounds; round++) {
+        int edit_count = edits(rng);
+        for (int e = 0; e < edit_count; e++) {
+            int i = x(rng), j = y(rng), k = z(rng);
+            if (rng() % 2 == 0) {
+                V.clear_voxel(i, j, k);
+            } else {
+                voxel v;
+                v.exist = true;
+                v.density = density(rng);
+                v.is_new = rng() % 4 == 0;
+                v.update_color();
+                V.set_voxel(i, j, k, v);
+            }
+        }
+
+        mesh.update(V);
+        terrain_mesh fresh_mesh;
+        fresh_mesh.update(V);
+        for (int c = 0; c < mesh.chunk_count(); c++) {
+            if (!same_chunk(*mesh.meshes()[c], *fresh_mesh.meshes()[c])) {
+                std::cout << "MESH: round " << round << ", chunk " << c << " differs from a fresh mesh" << std::endl;
+                return false;
+            }
+        }
+        if (!check_mesh_faces(V, mesh)) {
+            std::cout << "  in round " << round << std::endl;
+            return false;
+        }
+
+        table.update(V);
+        voxel_instance_table fresh_table;
+        fresh_table.update(V);
+        if (table.count() != fresh_table.count() || table.solid() != fresh_table.solid()
+            || sorted_instances(table.data(), table.count()) != sorted_instances(fresh_table.data(), fresh_table.count())) {
+            std::cout << "INSTANCES: round " << round << ", the updated table has " << table.count() << " instances of " << table.solid()
+                      << " voxels, a fresh one " << fresh_table.count() << " of " << fresh_table.solid() << std::endl;
+            return false;
+        }
+        table.copy_to(every_round);
+        if (round % 7 == 6) {
+            table.copy_to(every_few_rounds);
+        }
+        for (const voxel_instance_data* copy : { &every_round, &every_few_rounds }) {
+            if (copy->version == table.version() && (copy->count != table.count() || copy->data != table.data())) {
+                std::cout << "INSTANCES: round " << round << ", the copy of version " << copy->version << " differs from the table" << std::endl;
+                return false;
+            }
+        }
+    }
+    std::cout << "  ok, " << mesh.chunk_count() << " chunks, " << count_exposed_faces(V) << " exposed faces, " << table.count() << " instances" << std::endl;
+    return true;
+}
+
+
+int main(int argc, char** argv) {
+    validate_options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i], value = argv[i + 1];
+        if (arg == "--particles") {
+            options.particle_counts = parse_list(value);
+        } else if (arg == "--sizes") {
+            options.field_sizes = parse_list(value);
+        } else if (arg == "--steps") {
+            options.steps = std::stoi(value);
+        } else if (arg == "--seed") {
+            options.seed = unsigned(std::stoul(value));
+        } else if (arg == "--variant") {
+            options.variant = value;
+        } else if (arg == "--tolerance-scale") {
+            options.tolerance_scale = std::stod(value);
+        } else if (arg == "--mesh") {
+            options.mesh_rounds = std::stoi(value);
+        } else {
+            std::cerr << "unknown argument " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    if (options.mesh_rounds > 0) {
+        if (!validate_voxel_meshes(options)) {
+            return 1;
+        }
+        std::cout << "the updated meshes and instances match fresh ones" << std::endl;
+        return 0;
+    }
+
+    for (int size : options.field_sizes) {
+        for (int particles : options.particle_counts) {
+            if (!validate_scene(options, particles, size)) {
+                return 1;
+            }
+        }
+    }
+    std::cout << "all variants match the reference" << std::endl;
+    return 0;
+}
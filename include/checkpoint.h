@@ -0,0 +1,198 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include <data_structures.h>
+#include <mapped_file.h>
+
+
+// ----------------------------------------------------------------------checkpoint part------------------------------------------------------
+// binary checkpoint/restart of the whole simulation state:
+// particle array, voxel densities + flags, current_particle_num, rng state, simulated time and step count
+//
+// file layout (little endian):
+//   checkpoint_header
+//   particle array            (particle_count * particle_stride bytes, raw struct copy)
+//   voxel densities           (x * y * z floats, x-major like voxel_field::field[x][y][z])
+//   voxel flags               (x * y * z bytes, see checkpoint_voxel_flag)
+//   rng state                 (std::mt19937 text state, rng_state_size bytes)
+
+const uint32_t checkpoint_magic = 0x54504B43; // "CKPT"
+const uint32_t checkpoint_version = 1;
+
+// the color is not stored, it is recomputed by voxel::update_color() on load
+enum checkpoint_voxel_flag : uint8_t {
+    VOXEL_FLAG_EXIST = 1 << 0,
+    VOXEL_FLAG_NOT_DESTROYABLE = 1 << 1,
+    VOXEL_FLAG_IS_NEW = 1 << 2,
+};
+
+struct checkpoint_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t particle_stride; // sizeof(particle) of the writer, must match the reader
+    uint32_t particle_count;
+    int32_t  current_particle_num;
+    int32_t  voxel_x_size, voxel_y_size, voxel_z_size;
+    uint32_t rng_state_size;
+    uint64_t simulation_step;
+    double   simulation_time;
+    uint64_t particles_offset;
+    uint64_t voxel_density_offset;
+    uint64_t voxel_flags_offset;
+    uint64_t rng_state_offset;
+    uint64_t file_size;
+};
+
+// a copy of the simulation state, taken on the main thread and serialized later on the writer thread
+struct simulation_snapshot {
+    std::vector<particle> particles;
+    std::vector<float>    voxel_density;
+    std::vector<uint8_t>  voxel_flags;
+    int x_size = 0, y_size = 0, z_size = 0;
+    int current_particle_num = 0;
+    uint64_t step = 0;
+    double time = 0.0;
+    std::string rng_state;
+};
+
+// copy the current state into 's', this is the only part of a checkpoint that runs on the caller thread
+void take_simulation_snapshot(simulation_snapshot& s, const std::vector<particle>& p, voxel_field& V);
+
+// serialize a snapshot, written to 'path'.tmp first and then renamed so a crash never leaves a half written checkpoint
+bool write_checkpoint(const std::string& path, const simulation_snapshot& s);
+
+// restore the state from a checkpoint file, the file is memory mapped and copied straight into the arrays
+// the voxel field must have the same size as the one in the file, the particle vector is resized to the stored count
+bool load_checkpoint(const std::string& path, std::vector<particle>& p, voxel_field& V);
+
+
+// writes checkpoints on a background thread, only one write can be in flight at a time
+class checkpoint_writer {
+public:
+    ~checkpoint_writer();
+    // snapshot the state and start writing it, returns false (and does nothing) if the previous write is still running
+    bool request(const std::string& path, const std::vector<particle>& p, voxel_field& V);
+    bool busy() const;
+    // block until the current write (if any) has finished
+    void wait();
+private:
+    std::thread worker;
+    std::atomic<bool> writing{ false };
+    simulation_snapshot snapshot;
+};
+
+
+// ----------------------------------------------------------------------incremental checkpoints------------------------------------------------------
+// a chain of checkpoints in one directory: a full base checkpoint (base_<step>.ckpt, same format as above) followed by
+// deltas (delta_<step>.ckpd) that only contain the voxel bricks changed since the previous checkpoint of the chain,
+// the particles are small compared to the field and are always stored completely
+//
+// delta layout:
+//   checkpoint_delta_header
+//   particle array            (particle_count * particle_stride bytes)
+//   brick indices             (brick_count uint32, index = (bx * brick_y_num + by) * brick_z_num + bz)
+//   brick densities           (brick_count * brick_size^3 floats, x-major inside the brick, zero outside the field)
+//   brick flags               (brick_count * brick_size^3 bytes)
+//   rng state
+
+const uint32_t checkpoint_delta_magic = 0x44504B43; // "CKPD"
+const uint32_t checkpoint_delta_version = 1;
+
+struct checkpoint_delta_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t particle_stride;
+    uint32_t particle_count;
+    int32_t  current_particle_num;
+    int32_t  voxel_x_size, voxel_y_size, voxel_z_size;
+    uint32_t brick_size;
+    uint32_t brick_count;
+    uint32_t rng_state_size;
+    uint64_t base_step; // step of the base checkpoint this delta applies to
+    uint64_t previous_step; // step of the checkpoint right before this one in the chain, used to detect holes
+    uint64_t simulation_step;
+    double   simulation_time;
+    uint64_t particles_offset;
+    uint64_t brick_index_offset;
+    uint64_t brick_density_offset;
+    uint64_t brick_flags_offset;
+    uint64_t rng_state_offset;
+    uint64_t file_size;
+};
+
+// the dirty bricks of a delta, copied on the main thread
+struct brick_delta_snapshot {
+    simulation_snapshot state; // particles, scalars and rng, the voxel arrays stay empty
+    uint64_t base_step = 0;
+    uint64_t previous_step = 0;
+    std::vector<uint32_t> bricks;
+    std::vector<float>    density;
+    std::vector<uint8_t>  flags;
+};
+
+// copy the voxels of 'bricks' into brick_size^3 blocks (x-major inside the brick, zero outside the field)
+void copy_voxel_bricks(const voxel_field& V, const std::vector<int>& bricks, std::vector<float>& density, std::vector<uint8_t>& flags);
+// the reverse, reading 'count' brick indices, densities and flags from (possibly unaligned) memory, false on a bad index
+bool paste_voxel_bricks(voxel_field& V, const uint8_t* bricks, const uint8_t* density, const uint8_t* flags, uint32_t count);
+void take_brick_delta_snapshot(brick_delta_snapshot& s, const std::vector<int>& bricks, const std::vector<particle>& p, voxel_field& V);
+bool write_checkpoint_delta(const std::string& path, const brick_delta_snapshot& s);
+// apply the bricks and the particle state of one delta on top of the current state
+bool apply_checkpoint_delta(const std::string& path, std::vector<particle>& p, voxel_field& V);
+
+// a checkpoint found on disk, 'base_step' equals 'step' for base checkpoints
+struct checkpoint_frame {
+    uint64_t step;
+    uint64_t base_step;
+    bool is_base;
+    std::string path;
+};
+// list all base and delta checkpoints of a directory, sorted by step
+std::vector<checkpoint_frame> list_checkpoint_frames(const std::string& dir);
+// restore the state of any checkpointed step: load the base of its chain and replay the deltas up to 'step'
+bool restore_checkpoint_frame(const std::string& dir, uint64_t step, std::vector<particle>& p, voxel_field& V);
+// same, for the most recent checkpointed step
+bool restore_latest_checkpoint_frame(const std::string& dir, std::vector<particle>& p, voxel_field& V);
+
+
+// writes a base + delta chain in the background, one checkpoint in flight at a time
+// after 'deltas_per_base' deltas the next checkpoint is a new base (compaction), only 'kept_chains' chains stay on disk
+class incremental_checkpointer {
+public:
+    incremental_checkpointer(const std::string& dir, int deltas_per_base = 30, int kept_chains = 4);
+    ~incremental_checkpointer();
+    // snapshot the state and start writing it, returns false if the previous write is still running
+    // (the dirty bricks are kept and go into the next delta)
+    bool request(const std::vector<particle>& p, voxel_field& V);
+    // forget the chain, the next request writes a new base (call it after the state was replaced, e.g. restored)
+    void restart_chain();
+    bool busy() const;
+    void wait();
+private:
+    void prune_chains();
+    std::string dir;
+    int deltas_per_base;
+    int kept_chains;
+    bool has_base = false;
+    uint64_t base_step = 0;
+    uint64_t last_step = 0;
+    int chain_length = 0;
+    std::atomic<bool> chain_broken{ false }; // set by the writer thread when a write failed
+    unsigned int dirty_cursor = 0;
+    std::thread worker;
+    std::atomic<bool> writing{ false };
+    simulation_snapshot base_snapshot;
+    brick_delta_snapshot delta_snapshot;
+};
+
+
+
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+
+// ----------------------------------------------------------------------command queue------------------------------------------------------
+// bounded lock-free queue from one producer thread to one consumer thread (a ring of 'capacity' items)
+// the producer only writes 'head' and the consumer only writes 'tail', each publishes its own with a release store,
+// so neither side ever blocks; push() fails when the ring is full
+
+template<class T, size_t capacity>
+class command_queue {
+public:
+    // producer side
+    bool push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == capacity) {
+            return false;
+        }
+        items[h % capacity] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool pop(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[t % capacity];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+private:
+    T items[capacity];
+    alignas(64) std::atomic<size_t> head{ 0 };
+    alignas(64) std::atomic<size_t> tail{ 0 };
+};
+
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <vector>
+#include <memory>
+
+#include <data_structures.h>
+#include <instance_ring.h>
+
+
+// ----------------------------------------------------------------------culling------------------------------------------------------
+// the render loop only draws what the camera can see, instead of every voxel and particle of the domain
+// the domain is split into cull cells, the bricks of voxel_field::brick_size^3 voxels (the neighbour grid cells have the
+// size of a voxel, so a cull cell is also a block of those); every frame the boxes of the cells are tested against the
+// view frustum of the camera, then the instances of the visible cells are compacted:
+// - the slots of the voxel instance table, which stays on the GPU as it is and is read through the compacted slots
+// - the particle instances, which build_particle_instance_data sorts by cell, so a visible cell is one range to copy
+// with TERRAIN_MESH the boxes of the chunk meshes are tested instead
+//
+// it runs on the render thread, serially: a few thousand box tests and a scan of the surface slots are cheaper than a
+// team of threads, which would compete with the pinned simulation team (or wait for its pass in the build without OpenMP)
+// CPU only, no GL call, so it can be benchmarked headless; render_culled_voxel_field (render.cpp) draws the slots
+// CULLING=0 draws everything, CULL_DISTANCE > 0 also drops the cells farther than that from the camera
+
+#ifndef CULLING
+#define CULLING 1
+#endif
+#ifndef CULL_DISTANCE
+#define CULL_DISTANCE 0.0f
+#endif
+
+// the six planes of a view frustum, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them
+struct view_frustum {
+    glm::vec4 planes[6];
+    glm::vec3 eye = glm::vec3(0.0f);
+    float max_distance = 0.0f; // 0 = no distance test
+
+    // false only when the box [lo, hi] is certainly out of view
+    bool visible(const glm::vec3& lo, const glm::vec3& hi) const;
+};
+
+// the frustum of projection * view, 'eye' is the camera position for the distance test
+view_frustum make_view_frustum(const glm::mat4& projection, const glm::mat4& view, const glm::vec3& eye, float max_distance);
+
+// the cull cells of a field of x_size * y_size * z_size voxels
+struct cull_grid {
+    int x_num = 0, y_num = 0, z_num = 0;
+
+    cull_grid() = default;
+    cull_grid(int x_size, int y_size, int z_size);
+    int cell_count() const { return x_num * y_num * z_num; }
+    // the cell of a world position, a position out of the field is in the nearest cell at the border
+    int cell_of(const glm::vec3& world) const;
+    // the box of the voxels of a cell, a cell at the border of the field reaches far out on that side, so it also
+    // holds what cell_of puts into it from outside
+    void bounds(int cell, glm::vec3& lo, glm::vec3& hi) const;
+};
+
+struct render_snapshot;
+struct particle_instance_data;
+
+struct cull_stats {
+    int cells = 0, visible_cells = 0;
+    int voxels = 0, visible_voxels = 0;
+    int particles = 0, visible_particles = 0;
+    int chunks = 0, visible_chunks = 0; // TERRAIN_MESH, the chunks with faces
+};
+
+// the culling of one frame, kept by the render loop so the vectors keep their capacity
+struct frame_culling {
+    std::vector<char> visible_cells;   // per cull cell of the snapshot
+    std::vector<int> particle_offset;  // per cull cell, where its particles go in the compacted instances
+    std::vector<GLint> voxel_slots;    // the slots of the visible voxel instances, in slot order
+    std::vector<char> visible_chunks;  // per chunk mesh
+    cull_stats stats;
+};
+
+// tests the cells of the snapshot (and its chunk meshes) against 'frustum' and compacts the voxel slots; the particles
+// are compacted by copy_visible_particles, straight into the buffer they are drawn from
+// with CULLING=0 every cell and chunk is visible and no slot is listed
+void cull_frame(const render_snapshot& frame, const view_frustum& frustum, frame_culling& culling);
+
+// the particle instances of the visible cells, stats.visible_particles * 6 floats into 'out'
+void copy_visible_particles(const particle_instance_data& instances, const frame_culling& culling, GLfloat* out);
+
+// the GL objects of render_culled_voxel_field: the cube VAOs that fetch the instances from the voxel instance buffer
+// through a texture buffer, and the ring the slots stream through
+struct culled_voxel_gl {
+    unsigned int VAO[2] = { 0, 0 };
+    unsigned int instance_texture = 0;
+    instance_ring slots;
+    bool supported = false; // the texture buffer can hold the instances of every voxel
+};
+
+// appended to the profiler window: the visible cells and instances against all of them
+void draw_cull_stats(const cull_stats& stats);
+
+
+#endif
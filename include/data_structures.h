@@ -4,9 +4,11 @@
 #include <iostream>
 
 #include <vector>
+#include <memory>
 #include <unordered_map>
 
 #include <random>
+#include <cstdint>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -33,15 +35,16 @@ extern Shader* global_ourShader;
 #define SPH_PARTICLE_NUM 800
 #endif
 
-extern constexpr int particle_num = SPH_PARTICLE_NUM;
+inline constexpr int particle_num = SPH_PARTICLE_NUM;
 
 #ifndef VOXEL_FIELD_SIZE
 #define VOXEL_FIELD_SIZE 16
 #endif
 
-// boundary, see details in physics.h
+// boundary
 //extern const GLfloat x_max = 12.0f, x_min = 0.0f, y_max = 30.0f, y_min = 0.0f, z_max = 12.0f, z_min = 0.0f;
-extern constexpr GLfloat x_max = VOXEL_FIELD_SIZE, x_min = 0.0f, y_max = 30.0f, y_min = 0.0f, z_max = VOXEL_FIELD_SIZE, z_min = 0.0f;
+// defined in globals.cpp, VOXEL_FIELD_SIZE wide by default, set_field_size() changes them (before the fields are created)
+extern GLfloat x_max, x_min, y_max, y_min, z_max, z_min;
 
 
 // ----------------------------------------------------------------------physic part------------------------------------------------------
@@ -71,8 +74,12 @@ const float diffusion_rate = 0.00006f; // the rate that controls the diffusion o
 
 extern int current_particle_num; // can use this to control the number of particles in the system, actual particle number is min(particle_num,current_particle_num)
 
-extern constexpr float particle_render_scale_minimum = 0.005;
-extern constexpr float particle_render_scale_maximum = 0.17;
+// simulated time and number of simulation steps so far, defined in main.cpp (saved in the checkpoint)
+extern double simulation_elapsed_time;
+extern unsigned long long simulation_step_count;
+
+inline constexpr float particle_render_scale_minimum = 0.005;
+inline constexpr float particle_render_scale_maximum = 0.17;
 extern float particle_render_scale;
 
 
@@ -111,6 +118,18 @@ public:
 
     void clear_all();
     void print_field();
+
+    // dirty brick tracking, every mutation stamps its brick (brick_size^3 voxels) with the current epoch
+    // so consumers (incremental checkpoints) can ask which bricks changed since they last looked
+    static const int brick_size = 8;
+    int brick_x_num, brick_y_num, brick_z_num;
+    std::vector<unsigned int> brick_stamp;
+    unsigned int dirty_epoch = 1;
+    void mark_dirty(int x, int y, int z);
+    void mark_all_dirty();
+    // return the bricks changed after 'cursor' and move 'cursor' forward, so the next call only sees newer changes
+    std::vector<int> collect_dirty_bricks(unsigned int& cursor);
+    int brick_count() const { return brick_x_num * brick_y_num * brick_z_num; }
 };
 
 
@@ -158,8 +177,13 @@ public:
 
 
 
+// random engine used to spawn particles, defined in physics.cpp
+extern std::mt19937 simulation_rng;
+
 // generate a random vec3 in the min and max range
 glm::vec3 generateRandomVec3(float _x_max = x_max, float _x_min = x_min, float _y_max = y_max, float _y_min = y_min, float _z_max = z_max, float _z_min = z_min);
+// direction used instead of the zero delta of two particles at the same position (deterministic per pair)
+glm::vec3 overlap_jitter(int i, int j);
 
 // definition of the particle
 struct particle {
@@ -182,21 +206,53 @@ struct particle {
 
 void calculate_SPH_movement(std::vector<particle>& p, float frameTimeDiff, voxel_field& V, neighbourhood_grid& G, std::vector<int>& recycle_list);
 
+// the passes of calculate_SPH_movement in order, on the first 'particle_num' particles
+void build_neighbour_grid(std::vector<particle>& p, int particle_num, neighbourhood_grid& G);
+void calculate_density(std::vector<particle>& p, int particle_num, neighbourhood_grid& G);
+void calculate_force(std::vector<particle>& p, int particle_num, neighbourhood_grid& G);
+void integrate_particles(std::vector<particle>& p, int particle_num, float frameTimeDiff, voxel_field& V, std::vector<int>& recycle_list);
+void diffuse_particle_mass(std::vector<particle>& p, int particle_num, float frameTimeDiff, neighbourhood_grid& G);
+
 void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxel_field& V, neighbourhood_grid& G, std::vector<int>& recycle_list);
 
 
 
 void recycle_particle(std::vector<particle>& p, std::vector<int>& recycle_list);
 
+// the data a task of the step graph reads or writes (task_graph.h)
+enum step_data : uint32_t {
+    DATA_GRID = 1 << 0,           // neighbourhood grid
+    DATA_POSITIONS = 1 << 1,      // currPos, prevPos, velocity, estimated_velocity
+    DATA_SPH_STATE = 1 << 2,      // density / pressure / neighbour count, acceleration, deltaCs
+    DATA_MASS = 1 << 3,
+    DATA_VOXELS = 1 << 4,         // the voxels themselves
+    DATA_VOXEL_STAMPS = 1 << 5,   // dirty brick stamps and epoch (mark_dirty, collect_dirty_bricks)
+    DATA_RECYCLE_LIST = 1 << 6,
+    DATA_PARTICLES = DATA_POSITIONS | DATA_SPH_STATE | DATA_MASS,
+};
+
+class task_graph;
+// the passes of one step (calculate_SPH_movement, calculate_voxel_erosion, recycle_particle) as tasks of 'graph', with
+// the data each one reads and writes, all on the calling thread; 'dt' is read when the graph runs
+// the grid pass skips the build when 'grid_current' is set, because a task of the previous run already built the grid
+// for these positions, and clears it
+void add_step_tasks(task_graph& graph, std::vector<particle>& p, const float& dt, voxel_field& V, neighbourhood_grid& G,
+                    std::vector<int>& recycle_list, bool& grid_current);
+
 
 // ----------------------------------------------------------------------render part------------------------------------------------------
 // defined in main.cpp
 extern const unsigned int SCR_WIDTH;
 extern const unsigned int SCR_HEIGHT;
 extern Camera camera;
+// defined in globals.cpp
 extern int voxel_x_num, voxel_y_num, voxel_z_num;
 
-// pre-defined colors
+// set the horizontal size of the domain (x_max, z_max) and the voxel counts that follow from it,
+// for tools that run several sizes in one process, the fields have to be created after this
+void set_field_size(GLfloat horizontal_size);
+
+// pre-defined colors, defined in globals.cpp
 extern glm::vec4 red;
 extern glm::vec4 dark_red;
 extern glm::vec4 yellow;
@@ -209,8 +265,10 @@ extern glm::vec4 cube_edge_color;
 extern glm::vec4 boundary_color;
 extern glm::vec4 particle_color;
 
-// set up voxel field
+// set up voxel field, with the default terrain or the one of 'terrain' (terrain_generator.h)
+struct terrain_config;
 void set_up_voxel_field(voxel_field& V, float voxel_density);
+void set_up_voxel_field(voxel_field& V, float voxel_density, const terrain_config& terrain);
 // set up particle system
 void set_up_SPH_particles(std::vector<particle>& P);
 
@@ -230,16 +288,23 @@ void set_up_cube_base_rendering(unsigned int cube_VBO[2], unsigned int cube_VAO[
 void render_cube(Shader& ourShader, unsigned int cube_VBO[2], unsigned int cube_VAO[2], glm::mat4 model = glm::mat4(1.0f), glm::vec4 color = cube_color);
 
 
-// set up particle rendering, instanced rendering
-void set_up_particle_rendering(unsigned int& sphereVBO, unsigned int& sphereVAO, unsigned int& sphereEBO, unsigned int& particle_instance_VBO);
+class instance_ring;
+// set up particle rendering, instanced rendering, the instances stream through 'particle_instances' (instance_ring.h)
+void set_up_particle_rendering(unsigned int& sphereVBO, unsigned int& sphereVAO, unsigned int& sphereEBO, instance_ring& particle_instances);
+
+// set up particle impostor rendering, the camera facing quad of render_SPH_particle_impostors, same instance ring
+void set_up_particle_impostor_rendering(unsigned int& impostor_VBO, unsigned int& impostor_VAO);
 
 // set up sphere rendering, just one sphere, not instanced
 void set_up_sphere_rendering(unsigned int& sphereVBO, unsigned int& sphereVAO, unsigned int& sphereEBO);
 
 // render a single sphere given transformation matrix 'model', didn't use in this project
 void render_sphere(Shader& ourShader, unsigned int& sphere_VBO, unsigned int& sphere_VAO, unsigned int& sphereEBO, glm::mat4 model = glm::mat4(1.0f));
+struct particle_instance_data;
+struct frame_culling;
 // render a single sphere given transformation matrix 'model', instanced rendering, would be more efficient
-void render_sphere_instanced(Shader& ourShader, unsigned int& sphere_VAO, GLsizei intance_num, unsigned int& particle_instance_VBO, GLfloat* particle_vertices);
+// the instances of the cells in view ('culling', culling.h) stream through 'particle_instances'
+void render_sphere_instanced(Shader& ourShader, unsigned int& sphere_VAO, const particle_instance_data& instances, const frame_culling& culling, instance_ring& particle_instances);
 
 
 void set_up_boundary_rendering(unsigned int bound_VBO[2], unsigned int bound_VAO[2], bounding_box& boundary);
@@ -250,14 +315,34 @@ void render_boundary(Shader& ourShader, unsigned int bound_VBO[2], unsigned int
 // render particles, abandoned, because it's not efficient
 void render_SPH_particles_x(std::vector<particle>& particles, Shader& ourShader, unsigned int& sphere_VBO, unsigned int& sphere_VAO, unsigned int& sphere_EBO);
 
-// render particles, use instanced rendering
-void render_SPH_particles(std::vector<particle>& particles, Shader& ourShader, unsigned int& sphere_VBO, unsigned int& sphere_VAO, unsigned int& sphere_EBO, unsigned int& particle_instance_VBO);
+// render particles, use instanced rendering, 'instances' from build_particle_instance_data (render_data.h), only the
+// cells in view
+void render_SPH_particles(const particle_instance_data& instances, const frame_culling& culling, Shader& ourShader, unsigned int& sphere_VBO, unsigned int& sphere_VAO, unsigned int& sphere_EBO, instance_ring& particle_instances);
+// render particles as ray cast sphere impostors, the ones farther than 'lod_distance' (0 = none) as flat discs
+void render_SPH_particle_impostors(const particle_instance_data& instances, const frame_culling& culling, Shader& impostor_shader, Shader& disc_shader, unsigned int& impostor_VAO, instance_ring& particle_instances, float lod_distance);
 
 
 // render voxel field, not instanced rendering
 void render_voxel_field_x(voxel_field& V, Shader& ourShader, unsigned int cube_VBO[2], unsigned int cube_VAO[2]);
-// render voxel field, instanced rendering
-void render_voxel_field(voxel_field& V, Shader& ourShader, unsigned int cube_VBO[2], unsigned int cube_VAO[2], unsigned int& voxel_instance_VBO);
+struct voxel_instance_data;
+struct voxel_gpu_state;
+struct chunk_mesh;
+struct terrain_chunk_gl;
+struct culled_voxel_gl;
+struct view_frustum;
+// the frustum of the camera with the projection of the render functions (culling.h)
+view_frustum camera_view_frustum(float max_distance);
+// render voxel field, instanced rendering, 'instances' from a voxel_instance_table (render_data.h)
+// 'gpu' is what voxel_instance_VBO holds, only the slots changed since then are uploaded
+void render_voxel_field(const voxel_instance_data& instances, voxel_gpu_state& gpu, Shader& ourShader, unsigned int cube_VBO[2], unsigned int cube_VAO[2], unsigned int& voxel_instance_VBO);
+// set up render_culled_voxel_field on the cubes and the instance buffer of set_up_cube_base_instance_rendering,
+// gl.supported is false when the GL texture buffers are too small for it
+void set_up_culled_voxel_rendering(unsigned int cube_VBO[2], unsigned int& voxel_instance_VBO, culled_voxel_gl& gl);
+// render voxel field, only the instances of 'slots' (the slots in view, culling.h)
+void render_culled_voxel_field(const voxel_instance_data& instances, const std::vector<GLint>& slots, voxel_gpu_state& gpu, Shader& culled_shader, culled_voxel_gl& gl, unsigned int& voxel_instance_VBO);
+// render the chunk meshes of a terrain_mesh (voxel_mesh.h) in view, a chunk is uploaded again when its mesh was rebuilt,
+// 'upload_bytes' returns what this frame uploaded
+void render_terrain_mesh(const std::vector<std::shared_ptr<const chunk_mesh>>& meshes, const std::vector<char>& visible_chunks, Shader& terrain_shader, std::vector<terrain_chunk_gl>& chunks, uint64_t& upload_bytes);
 
 
 
@@ -0,0 +1,65 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+// ----------------------------------------------------------------------frame writer------------------------------------------------------
+// encodes and saves rendered frames on a pool of worker threads, so the render thread only pays for a memcpy
+// the queue is bounded: when the encoders fall behind, submit() blocks until a slot is free (no frame is ever dropped)
+
+enum frame_format {
+    FRAME_FORMAT_PNG = 0,       // zlib default level, smallest files
+    FRAME_FORMAT_PNG_FAST = 1,  // zlib level 1
+    FRAME_FORMAT_BMP = 2,       // uncompressed, still viewable
+    FRAME_FORMAT_RAW = 3,       // headerless BGRA dump, bottom-up rows (ffmpeg -f rawvideo -pix_fmt bgra -vf vflip)
+};
+
+class frame_writer {
+public:
+    // 'pattern' is a printf pattern for the frame number without extension, e.g. "out/%08d"
+    frame_writer(const std::string& pattern, frame_format format, int threads, int queue_size);
+    ~frame_writer();
+
+    // a BGRA buffer of w * h * 4 bytes to fill, taken from a pool of recycled buffers
+    std::vector<uint8_t> acquire(unsigned int w, unsigned int h);
+    // queue a filled buffer for encoding, blocks while the queue is full
+    void submit(std::vector<uint8_t>&& pixels, unsigned int w, unsigned int h);
+    // block until every queued frame is written
+    void drain();
+
+    int frames_submitted() const { return next_index; }
+    int frames_failed() const;
+    double stall_seconds() const { return stalled; } // time submit() spent waiting for the encoders
+private:
+    struct frame {
+        std::vector<uint8_t> pixels;
+        unsigned int w, h;
+        int index;
+    };
+    void work();
+    bool save(const frame& f);
+
+    std::string pattern;
+    frame_format format;
+    size_t queue_size;
+    std::vector<std::thread> workers;
+    mutable std::mutex mutex;
+    std::condition_variable has_work, has_space, idle;
+    std::deque<frame> queue;
+    std::vector<std::vector<uint8_t>> pool;
+    int in_progress = 0;
+    int failed = 0;
+    bool stopping = false;
+    int next_index = 0;
+    double stalled = 0.0;
+};
+
+
+#endif
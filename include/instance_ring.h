@@ -0,0 +1,38 @@
+#ifndef INSTANCE_RING_H
+#define INSTANCE_RING_H
+
+#include <cstddef>
+
+#include <glad/glad.h>
+
+
+// ----------------------------------------------------------------------instance ring------------------------------------------------------
+// streams instance data that changes every frame: the buffer is split into 'regions' parts that are written in turn,
+// each mapped unsynchronized (no implicit wait for the GPU like glBufferSubData into a buffer a draw still reads), and
+// a fence after the draws of a region tells when the GPU is done with it, so a frame only waits when the GPU is
+// 'regions' frames behind
+// GL 3.3 has no persistent mapping (ARB_buffer_storage, GL 4.4), so a region is mapped and unmapped every frame
+
+class instance_ring {
+public:
+    static const int regions = 3;
+
+    // creates the buffer, 'region_bytes' is the most one frame writes (it grows when a frame needs more)
+    void set_up(size_t region_bytes);
+    unsigned int buffer() const { return VBO; }
+
+    // the next region mapped for writing 'bytes', after the GPU finished the draws that read it 'regions' frames ago
+    void* begin_write(size_t bytes);
+    // unmaps it, returns its offset in buffer() for the attribute pointers
+    size_t end_write();
+    // after the draws that read the region written last
+    void fence();
+private:
+    unsigned int VBO = 0;
+    size_t region_bytes = 0;
+    int current = regions - 1;
+    GLsync fences[regions] = {};
+};
+
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+
+// read-only memory mapping of a whole file (mmap / MapViewOfFile), used to load checkpoints and recordings quickly
+class mapped_file {
+public:
+    mapped_file() = default;
+    ~mapped_file();
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    bool open(const std::string& path);
+    void close();
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+
+// ----------------------------------------------------------------------memory accounting------------------------------------------------------
+// bytes, peak bytes and allocations per subsystem, from a global operator new / delete hook (memory_tracker.cpp)
+// every allocation is charged to the tag of the innermost memory_scope of the allocating thread (MEMORY_OTHER if none)
+// and remembers it, so it is released from the same tag wherever it is freed
+// only C++ allocations are seen (not malloc from C libraries, ImGui or the GL driver)
+//
+// the hook costs a few atomic operations per allocation, so it is only compiled with MEMORY_TRACKING=1,
+// otherwise the scopes still work but nothing is counted
+
+#ifndef MEMORY_TRACKING
+#define MEMORY_TRACKING 0
+#endif
+
+enum memory_tag : int {
+    MEMORY_OTHER = 0,
+    MEMORY_PARTICLES,
+    MEMORY_VOXELS,
+    MEMORY_GRID,       // neighbourhood grid
+    MEMORY_SIMULATION, // temporaries of the simulation passes
+    MEMORY_RENDER,     // instance data and other render side buffers
+    MEMORY_RECORDING,  // checkpoints, trajectory / voxel recording, offscreen frames
+    MEMORY_UI,
+    MEMORY_TAG_COUNT
+};
+
+extern const char* const memory_tag_names[MEMORY_TAG_COUNT];
+
+struct memory_tag_stats {
+    int64_t bytes = 0;
+    int64_t peak_bytes = 0;
+    uint64_t allocations = 0;       // since start
+    uint64_t frame_allocations = 0; // during the last finished frame
+};
+
+class memory_tracker {
+public:
+    static constexpr bool enabled = MEMORY_TRACKING != 0;
+
+    // called by the operator new / delete hook
+    void allocated(int tag, size_t size);
+    void released(int tag, size_t size);
+
+    // close the current frame, call once per frame from the main thread
+    void end_frame();
+    memory_tag_stats stats(int tag) const;
+    // all tags together, the peak is the peak of the sum
+    memory_tag_stats total() const;
+    // start measuring the peaks again from the current bytes (e.g. between the scenes of a headless run)
+    void reset_peaks();
+private:
+    // one cache line per tag, the threads of a parallel pass share the tag
+    struct alignas(64) tag_counters {
+        std::atomic<int64_t> bytes{ 0 };
+        std::atomic<int64_t> peak_bytes{ 0 };
+        std::atomic<uint64_t> allocations{ 0 };
+        uint64_t frame_start_allocations = 0;
+        uint64_t frame_allocations = 0;
+    };
+    tag_counters tags[MEMORY_TAG_COUNT];
+    tag_counters all;
+};
+
+// constant initialized, usable from allocations made before main()
+extern memory_tracker global_memory_tracker;
+
+// charges the allocations of the calling thread in the enclosing scope to 'tag'
+// a thread of a parallel region needs its own scope, the tag is per thread
+class memory_scope {
+public:
+    explicit memory_scope(memory_tag tag) : previous(current_tag) { current_tag = tag; }
+    ~memory_scope() { current_tag = previous; }
+    static memory_tag current() { return current_tag; }
+private:
+    memory_tag previous;
+    static thread_local memory_tag current_tag;
+};
+
+// ImGui table of the tags, needs an ImGui frame (appended to the profiler window)
+void draw_memory_stats(memory_tracker& tracker);
+
+
+#endif
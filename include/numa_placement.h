@@ -0,0 +1,52 @@
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+
+#include <cstddef>
+#include <vector>
+
+
+// ----------------------------------------------------------------------NUMA placement------------------------------------------------------
+// Linux puts a page on the node of the thread that first writes it; std::vector value-initialises on the calling thread,
+// so an array resized by the main thread lives on the main thread's socket and every thread on the other sockets reads
+// it remotely in the density and force passes
+// first_touch_resize() lets each worker thread write the pages of the elements it owns in the static_range loops of
+// physics.cpp (parallel.h) before the elements are constructed, so each socket holds its own slice (the threads are pinned by
+// apply_thread_config, thread_config.h)
+//
+// on a single node (or off Linux) the touch is skipped and these are plain vector operations
+
+// nodes with memory, 1 if unknown
+int numa_node_count();
+// node of the cpu the calling thread runs on, -1 if unknown
+int numa_current_node();
+
+// writes the pages of [data, data + count * element_size) from the threads that own them in a static_range split
+// of 'count' elements over 'threads' threads; only for storage that holds no objects yet
+void numa_first_touch(void* data, size_t count, size_t element_size, int threads);
+
+// pages of an array that live on the node of the thread that owns them in the same split
+struct numa_locality {
+    size_t pages = 0;
+    size_t local_pages = 0;
+    size_t unknown_pages = 0; // not mapped yet, or the node could not be queried
+    double local_fraction() const { return pages > unknown_pages ? double(local_pages) / double(pages - unknown_pages) : 0.0; }
+};
+numa_locality numa_page_locality(const void* data, size_t count, size_t element_size, int threads);
+
+// resize 'v' to 'count' elements; a new allocation is first touched by 'threads' threads before anything is constructed
+template<class T>
+void first_touch_resize(std::vector<T>& v, size_t count, int threads) {
+    if (count <= v.capacity() || numa_node_count() <= 1) {
+        v.resize(count);
+        return;
+    }
+    std::vector<T> placed;
+    placed.reserve(count);
+    numa_first_touch(placed.data(), count, sizeof(T), threads);
+    placed.assign(v.begin(), v.end());
+    placed.resize(count);
+    v.swap(placed);
+}
+
+
+#endif
@@ -1,11 +1,11 @@
 #ifndef __OFFSCREEN_H__
 #define __OFFSCREEN_H__
 
-#include "FreeImage.h"
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
 #include "data_structures.h"
+#include "frame_writer.h"
 
 // Configurations
 #ifdef OFFLINE_RENDERING
@@ -25,28 +25,78 @@ void SetOffscreenWidthHeight(GLuint w, GLuint h) {
     HEIGHT = h;
 }
 
-static bool save_to_image(unsigned int w, unsigned int h, char *data, size_t length) {
-    static int index = 0;
+// frames are read back through two pixel buffer objects: glReadPixels of frame n only queues a copy into one PBO,
+// and the other one (frame n - 1, finished by now) is mapped and handed to the encoder threads of the frame writer
+// OFFSCREEN_FRAME_FORMAT: 0 png, 1 fast png, 2 bmp, 3 raw BGRA (see frame_format)
+#ifndef OFFSCREEN_FRAME_FORMAT
+#define OFFSCREEN_FRAME_FORMAT 0
+#endif
+#ifndef OFFSCREEN_ENCODER_THREADS
+#define OFFSCREEN_ENCODER_THREADS 4
+#endif
+#ifndef OFFSCREEN_QUEUE_SIZE
+#define OFFSCREEN_QUEUE_SIZE 8
+#endif
 
-    char filename[50];
-    std::sprintf(filename, "out/%08d.png", index++);
+static frame_writer *g_frame_writer = nullptr;
+static GLuint g_offscreen_PBO[2] = {0, 0};
+static int g_offscreen_frame = 0; // frames read so far
+
+// hand the frame waiting in 'pbo' to the encoders
+static void OffscreenSubmitPBO(GLuint pbo) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, WIDTH * HEIGHT * 4, GL_MAP_READ_BIT);
+    if (mapped != nullptr) {
+        std::vector<uint8_t> pixels = g_frame_writer->acquire(WIDTH, HEIGHT);
+        memcpy(pixels.data(), mapped, pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        g_frame_writer->submit(std::move(pixels), WIDTH, HEIGHT);
+    } else {
+        std::cout << "offscreen: cannot map the pixel buffer" << std::endl;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
 
-    FIBITMAP *bitmap = FreeImage_Allocate(w, h, 32, 0, 0, 0);
+void OffscreenSaveRGBA() {
+    if (g_frame_writer == nullptr) {
+        g_frame_writer = new frame_writer("out/%08d", (frame_format) OFFSCREEN_FRAME_FORMAT,
+                                          OFFSCREEN_ENCODER_THREADS, OFFSCREEN_QUEUE_SIZE);
+        glGenBuffers(2, g_offscreen_PBO);
+        for (GLuint pbo: g_offscreen_PBO) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, WIDTH * HEIGHT * 4, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
 
-    BYTE *pixels = (BYTE *) FreeImage_GetBits(bitmap);
+    // start the asynchronous read of this frame
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, g_offscreen_PBO[g_offscreen_frame % 2]);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
-    memcpy(pixels, data, w * h * 4);
-    bool bSuccess = FreeImage_Save(FIF_PNG, bitmap, filename, PNG_DEFAULT);
-    FreeImage_Unload(bitmap);
-    return bSuccess;
+    // and collect the previous one
+    if (g_offscreen_frame > 0) {
+        OffscreenSubmitPBO(g_offscreen_PBO[(g_offscreen_frame - 1) % 2]);
+    }
+    g_offscreen_frame++;
 }
 
-void OffscreenSaveRGBA() {
-    unsigned char *data = new unsigned char[WIDTH * HEIGHT * 4];
-    memset(data, 0, WIDTH * HEIGHT * 4);
-    glReadPixels(0, 0, WIDTH, HEIGHT, GL_BGRA, GL_UNSIGNED_BYTE, data);
-    save_to_image(WIDTH, HEIGHT, (char *) data, WIDTH * HEIGHT * 4);
-    delete[] data;
+// collect the last frame, wait for all frames to be written and release the buffers, needs the GL context
+void OffscreenFinish() {
+    if (g_frame_writer == nullptr) {
+        return;
+    }
+    if (g_offscreen_frame > 0) {
+        OffscreenSubmitPBO(g_offscreen_PBO[(g_offscreen_frame - 1) % 2]);
+    }
+    g_frame_writer->drain();
+    std::cout << "offscreen: " << g_frame_writer->frames_submitted() << " frames written, "
+              << g_frame_writer->frames_failed() << " failed, render thread waited "
+              << g_frame_writer->stall_seconds() << "s for the encoders" << std::endl;
+    delete g_frame_writer;
+    g_frame_writer = nullptr;
+    glDeleteBuffers(2, g_offscreen_PBO);
+    g_offscreen_frame = 0;
 }
 
 static glm::vec3
@@ -0,0 +1,138 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+// ----------------------------------------------------------------------parallel runtime------------------------------------------------------
+// the one way the simulation runs work on several threads: with OpenMP these map to omp parallel regions and loops,
+// without it (CMakeLists(no openMP).txt) to a small fork-join / work-stealing thread pool in parallel.cpp, so the
+// no-OpenMP build scales too instead of silently running every loop on one thread
+//
+// parallel_region  runs body(thread, team) once on each thread of a team, thread i is always the same worker
+//                  (so per-thread state like the pinning of apply_thread_config sticks)
+// parallel_for     body(i) for every i in [begin, end), in chunks of 'grain' that idle threads take from busy ones
+//                  (so which thread runs an item is not fixed: loops whose items must stay with one thread, like the
+//                  NUMA first touch of numa_placement.h, use parallel_region with static_range instead)
+// parallel_reduce  combine of map(i) over [begin, end), combined in index order, so the result does not depend on
+//                  the thread count or the schedule
+// parallel_scan    in place inclusive prefix combine
+// 'threads' 0 means parallel_default_threads(); a region started inside another region runs on the calling thread only
+
+// the team size of regions that do not ask for one (omp_set_num_threads / omp_get_max_threads with OpenMP)
+void parallel_set_default_threads(int threads);
+int parallel_default_threads();
+
+// [begin, end) of 'thread' of 'team' when 'count' items are split like schedule(static): one contiguous block each,
+// the first count % team blocks one item more
+inline void static_range(int count, int thread, int team, int& begin, int& end) {
+    int chunk = count / team, extra = count % team;
+    begin = thread * chunk + std::min(thread, extra);
+    end = begin + chunk + (thread < extra ? 1 : 0);
+}
+
+#ifdef _OPENMP
+
+template<class F>
+void parallel_region(int threads, F&& body) {
+#pragma omp parallel num_threads(threads > 0 ? threads : parallel_default_threads())
+    body(omp_get_thread_num(), omp_get_num_threads());
+}
+
+template<class F>
+void parallel_for(int begin, int end, F&& body, int grain = 1, int threads = 0) {
+#pragma omp parallel for schedule(dynamic, grain) num_threads(threads > 0 ? threads : parallel_default_threads())
+    for (int i = begin; i < end; i++) {
+        body(i);
+    }
+}
+
+#else
+
+void thread_pool_region(int threads, const std::function<void(int, int)>& body);
+void thread_pool_for(int begin, int end, int grain, int threads, const std::function<void(int, int)>& range_body);
+
+template<class F>
+void parallel_region(int threads, F&& body) {
+    thread_pool_region(threads, body);
+}
+
+template<class F>
+void parallel_for(int begin, int end, F&& body, int grain = 1, int threads = 0) {
+    thread_pool_for(begin, end, std::max(grain, 1), threads, [&body](int range_begin, int range_end) {
+        for (int i = range_begin; i < range_end; i++) {
+            body(i);
+        }
+    });
+}
+
+#endif
+
+template<class T, class M, class C>
+T parallel_reduce(int begin, int end, T identity, M&& map, C&& combine, int grain = 1024, int threads = 0) {
+    if (end <= begin) {
+        return identity;
+    }
+    grain = std::max(grain, 1);
+    int chunks = (end - begin + grain - 1) / grain;
+    std::vector<T> partial(chunks, identity);
+    parallel_for(0, chunks, [&](int c) {
+        int chunk_end = std::min(begin + (c + 1) * grain, end);
+        T value = identity;
+        for (int i = begin + c * grain; i < chunk_end; i++) {
+            value = combine(value, map(i));
+        }
+        partial[c] = value;
+    }, 1, threads);
+    T total = identity;
+    for (const T& value : partial) {
+        total = combine(total, value);
+    }
+    return total;
+}
+
+// two passes over the same static blocks: scan each block, then add the combined totals of the blocks before it
+template<class T, class C>
+void parallel_scan(T* data, int count, T identity, C&& combine, int threads = 0) {
+    if (count <= 0) {
+        return;
+    }
+    int team = std::min(threads > 0 ? threads : parallel_default_threads(), std::max(count / 4096, 1));
+    std::vector<T> block_total(team, identity);
+    parallel_region(team, [&](int thread, int actual_team) {
+        int begin, end;
+        static_range(count, thread, actual_team, begin, end);
+        for (int i = begin + 1; i < end; i++) {
+            data[i] = combine(data[i - 1], data[i]);
+        }
+        if (end > begin) {
+            block_total[thread] = data[end - 1];
+        }
+    });
+    if (team == 1) {
+        return;
+    }
+    std::vector<T> offset(team, identity);
+    for (int b = 1; b < team; b++) {
+        offset[b] = combine(offset[b - 1], block_total[b - 1]);
+    }
+    parallel_region(team, [&](int thread, int actual_team) {
+        int begin, end;
+        static_range(count, thread, actual_team, begin, end);
+        if (thread == 0) {
+            return;
+        }
+        for (int i = begin; i < end; i++) {
+            data[i] = combine(offset[thread], data[i]);
+        }
+    });
+}
+
+
+#endif
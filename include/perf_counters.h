@@ -0,0 +1,96 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+#include <profiler.h>
+
+
+// ----------------------------------------------------------------------hardware counters------------------------------------------------------
+// optional, Linux only: cycles, instructions, last level cache misses and branch misses of the simulation phases,
+// counted with perf_event_open per thread (user space only) and read around the work of every thread in a phase
+// tells whether a pass is compute bound (high IPC) or memory bound (low IPC, many LLC misses per particle)
+//
+// when the PMU has to share its counters (the NMI watchdog, another perf user) the group only counts part of the time,
+// the counts are then scaled up by enabled / running time and the phase is flagged as multiplexed
+//
+// when perf events are not permitted (perf_event_paranoid, containers, VMs without a PMU) enable() fails with a reason
+// in status() and the scopes cost a relaxed load
+
+enum perf_counter : int {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+extern const char* const perf_counter_names[PERF_COUNTER_COUNT];
+
+struct perf_sample {
+    uint64_t value[PERF_COUNTER_COUNT] = {};
+    uint64_t time_enabled = 0, time_running = 0; // of the group, in ns
+};
+
+// counts of one phase per frame, averaged over the frames since the counters were enabled
+struct perf_phase_stats {
+    double value[PERF_COUNTER_COUNT] = {};
+    bool available[PERF_COUNTER_COUNT] = {};
+    bool multiplexed = false; // some counts were scaled up from the part of the time the group was counting
+    double ipc() const { return value[PERF_CYCLES] > 0.0 ? value[PERF_INSTRUCTIONS] / value[PERF_CYCLES] : 0.0; }
+};
+
+class perf_counters {
+public:
+    // false when the counters cannot be opened, status() says why
+    bool enable();
+    void disable();
+    bool active() const { return enabled.load(std::memory_order_relaxed); }
+    const std::string& status() const { return status_message; }
+
+    // the counters of the calling thread, opened on first use; false if that fails
+    bool read(perf_sample& sample);
+    void add(profile_phase phase, const perf_sample& begin, const perf_sample& end);
+    // close the current frame, call once per frame from the main thread
+    void end_frame();
+    perf_phase_stats stats(profile_phase phase) const;
+    int frame_count() const { return frames; }
+private:
+    std::atomic<bool> enabled{ false };
+    std::atomic<unsigned int> generation{ 0 }; // bumped by enable(), threads reopen their counters when it changes
+    bool available[PERF_COUNTER_COUNT] = {};
+    std::string status_message = "disabled";
+
+    std::atomic<uint64_t> current[PHASE_COUNT][PERF_COUNTER_COUNT] = {};
+    std::atomic<bool> current_multiplexed[PHASE_COUNT] = {};
+    double total[PHASE_COUNT][PERF_COUNTER_COUNT] = {};
+    bool multiplexed[PHASE_COUNT] = {}; // since enable()
+    int frames = 0;
+};
+
+extern perf_counters global_perf_counters;
+
+// counts the work of the calling thread in 'phase', put one in every thread that works on the phase
+// (inside the parallel region, next to the trace_scope of the worker)
+class perf_scope {
+public:
+    explicit perf_scope(profile_phase _phase) : phase(_phase), counting(global_perf_counters.active() && global_perf_counters.read(begin)) {}
+    ~perf_scope() {
+        perf_sample end;
+        if (counting && global_perf_counters.read(end)) {
+            global_perf_counters.add(phase, begin, end);
+        }
+    }
+private:
+    profile_phase phase;
+    perf_sample begin;
+    bool counting;
+};
+
+// ImGui table of IPC and per particle counts, needs an ImGui frame (inside the profiler window)
+void draw_perf_counters(perf_counters& counters, int particle_num);
+
+
+#endif
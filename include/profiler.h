@@ -0,0 +1,136 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+#include <tracer.h>
+
+
+// ----------------------------------------------------------------------profiler------------------------------------------------------
+// scoped wall-clock timers around the hot phases of a frame
+// every thread adds into its own slots (one relaxed atomic add per scope), end_frame() collects them once per frame
+// into a rolling history per phase, from which min / mean / p50 / p99 are computed, and optionally appends a CSV row
+// the threads of a parallel phase also time their own share (profile_worker_scope), which gives the load imbalance:
+// the busiest thread over the mean thread, 1 when the work is spread evenly
+
+enum profile_phase : int {
+    PHASE_GRID_BUILD = 0,
+    PHASE_DENSITY,
+    PHASE_FORCE,
+    PHASE_INTEGRATE,     // integration + particle-voxel DDA collision
+    PHASE_DIFFUSION,
+    PHASE_EROSION,
+    PHASE_RECYCLE,
+    PHASE_INSTANCE_BUILD,
+    PHASE_GPU_UPLOAD,    // instance buffer upload, CPU side of the driver call
+    PHASE_DRAW,          // draw submission, contains the upload
+    PHASE_STEP,          // whole simulation step, contains grid build to recycle (and in the app the rest of the step graph)
+    PHASE_CRITICAL_PATH, // longest chain of dependent tasks of the step graph (task_graph.h), not a timed scope
+    PHASE_FRAME,         // whole frame
+    PHASE_COUNT
+};
+
+extern const char* const profile_phase_names[PHASE_COUNT];
+// the name without spaces or '+', for whitespace separated files (golden baselines, thread configs)
+std::string profile_phase_key(profile_phase phase);
+
+struct profile_stats {
+    float last = 0.0f, min = 0.0f, mean = 0.0f, p50 = 0.0f, p99 = 0.0f; // milliseconds
+    float imbalance = 0.0f; // mean over the window, 0 if the phase has no worker scopes
+};
+
+class profiler {
+public:
+    static const int history_size = 600; // frames
+
+    void add(profile_phase phase, uint64_t nanoseconds);
+    // the time one thread worked in a parallel phase
+    void add_worker(profile_phase phase, uint64_t nanoseconds);
+    // close the current frame, call once per frame from the main thread
+    void end_frame();
+
+    profile_stats stats(profile_phase phase) const;
+    // milliseconds of the last finished frame
+    float last(profile_phase phase) const { return frames > 0 ? samples[phase][(frames - 1) % history_size] : 0.0f; }
+    float last_imbalance(profile_phase phase) const { return frames > 0 ? imbalance[phase][(frames - 1) % history_size] : 0.0f; }
+    // rolling history in milliseconds, oldest first
+    std::vector<float> history(profile_phase phase) const;
+    int frame_count() const { return frames; }
+
+    // append one row per frame to 'path' until stop_csv()
+    bool start_csv(const std::string& path);
+    void stop_csv();
+    bool recording_csv() const { return csv != nullptr; }
+    // min / mean / p50 / p99 of the rolling window per phase
+    bool write_summary_csv(const std::string& path) const;
+
+    ~profiler();
+private:
+    struct thread_slots {
+        std::atomic<uint64_t> nanoseconds[PHASE_COUNT];
+        std::atomic<uint64_t> worker_nanoseconds[PHASE_COUNT];
+        thread_slots() {
+            for (auto& n : nanoseconds) n = 0;
+            for (auto& n : worker_nanoseconds) n = 0;
+        }
+    };
+    thread_slots& local_slots();
+
+    std::mutex threads_mutex;
+    std::vector<std::shared_ptr<thread_slots>> threads;
+    float samples[PHASE_COUNT][history_size] = {};
+    float imbalance[PHASE_COUNT][history_size] = {};
+    int frames = 0;
+    FILE* csv = nullptr;
+};
+
+extern profiler global_profiler;
+
+// times the enclosing scope, next() ends the current phase and starts another one without a new block
+class profile_scope {
+public:
+    explicit profile_scope(profile_phase _phase) : phase(_phase), start(std::chrono::steady_clock::now()) {}
+    ~profile_scope() { stop(); }
+    void next(profile_phase next_phase) {
+        stop();
+        phase = next_phase;
+        start = std::chrono::steady_clock::now();
+    }
+private:
+    void stop() {
+        auto now = std::chrono::steady_clock::now();
+        global_profiler.add(phase, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count()));
+        // the phases also show up on the timeline when it is recording
+        if (global_tracer.active()) {
+            global_tracer.record(profile_phase_names[phase], global_tracer.to_trace_time(start), global_tracer.to_trace_time(now));
+        }
+    }
+    profile_phase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+// times the share of the calling thread in a parallel phase, one per thread inside the parallel region
+class profile_worker_scope {
+public:
+    explicit profile_worker_scope(profile_phase _phase) : phase(_phase), start(std::chrono::steady_clock::now()) {}
+    ~profile_worker_scope() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        global_profiler.add_worker(phase, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+private:
+    profile_phase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+// ImGui window with the statistics and the CSV controls, needs an ImGui frame
+void draw_profiler_panel(profiler& prof);
+
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef RENDER_DATA_H
+#define RENDER_DATA_H
+
+#include <vector>
+#include <deque>
+#include <cstdint>
+
+#include <data_structures.h>
+#include <task_graph.h>
+#include <voxel_mesh.h>
+#include <culling.h>
+
+
+// ----------------------------------------------------------------------instance data------------------------------------------------------
+// the CPU side of the instanced rendering, without any GL call so it can be benchmarked and tested headless
+
+// {x, y, z, r, g, b} per existing voxel, returns the number of instances
+int build_voxel_instance_data(voxel_field& V, std::vector<GLfloat>& data);
+
+// {x, y, z, r, g, b} per instance
+struct instance_data {
+    std::vector<GLfloat> data;
+    int count = 0;
+};
+
+// the particle instances sorted by cull cell (culling.h), so the particles of a cell are one range
+struct particle_instance_data : instance_data {
+    cull_grid cells;
+    std::vector<int> cell_begin; // the instances of cell c are [cell_begin[c], cell_begin[c + 1])
+};
+
+// the instances of the first 'count' particles (the active ones) in the cells of 'cells', the color shows the carried mass
+// sorted and filled in parallel, the vectors keep their capacity, so after the first frames there is no allocation
+void build_particle_instance_data(const std::vector<particle>& particles, int count, const cull_grid& cells, particle_instance_data& instances);
+
+
+// ----------------------------------------------------------------------voxel instance table------------------------------------------------------
+// the voxel instances kept from step to step instead of rebuilt from the whole field: every visible voxel owns a slot
+// of a dense instance array, and update() only looks at the bricks the field stamped dirty since the last update
+// (erosion, deposition, restored checkpoints, replay frames), so its cost follows the number of changed voxels
+// a voxel that disappears gives its slot to the last instance (swap remove), so the array stays dense and one draw
+// call covers it; the order of the instances is not the order of the voxels
+//
+// only voxels with at least one exposed face get a slot (a neighbour that is not a drawn voxel, or the edge of the field):
+// the terrain of generate_terrain is solid below its surface, and the buried voxels, most of the field, can never be seen
+// erosion uncovers them, so an update also rescans the voxels next to a dirty brick, whose faces the brick may have opened
+// SURFACE_VOXELS=0 draws every existing voxel, for comparisons
+//
+// every update that changes something is a new version, with the slot ranges it changed in a short history, so a copy
+// of the instances at version v (a snapshot, the instance buffer on the GPU) only takes the ranges changed after v
+
+#ifndef SURFACE_VOXELS
+#define SURFACE_VOXELS 1
+#endif
+
+struct slot_range {
+    int begin, end; // [begin, end)
+};
+
+// the changed slot ranges of the last versions, small enough to go with every snapshot
+class voxel_change_log {
+public:
+    static const int history = 64; // versions kept
+
+    // 'version' changed every slot (a full scan), nothing older can be brought up to date by ranges
+    void restart(uint64_t version);
+    void add(uint64_t version, const std::vector<slot_range>& ranges);
+    // the merged ranges below 'count' changed after 'since', false when the history does not reach back that far
+    bool changes_since(uint64_t since, int count, std::vector<slot_range>& ranges) const;
+private:
+    struct entry {
+        uint64_t version;
+        slot_range range;
+    };
+    std::deque<entry> entries;
+    uint64_t base = 0; // every change after 'base' is in 'entries'
+};
+
+// the voxel instances of a snapshot, with what the renderer needs to upload only the slots changed since its copy
+struct voxel_instance_data : instance_data {
+    uint64_t version = 0; // of the voxel_instance_table, 0 = never filled
+    int solid = 0;        // existing voxels, count is the part of them with an exposed face
+    voxel_change_log changes;
+};
+
+class voxel_instance_table {
+public:
+    // rescans the bricks of V that are dirty since the last update (the table has its own cursor, see
+    // voxel_field::collect_dirty_bricks), the first call and a field of another size scan everything
+    void update(voxel_field& V);
+    // brings 'instances' from its version to the current one
+    void copy_to(voxel_instance_data& instances) const;
+
+    int count() const { return int(voxel_of.size()); }
+    int solid() const { return solid_count; }
+    uint64_t version() const { return current; }
+    const std::vector<GLfloat>& data() const { return instances; }
+private:
+    void rebuild(voxel_field& V);
+    // brings the slot of voxel (x, y, z) in line with the voxel and its neighbours
+    void refresh(voxel_field& V, int x, int y, int z);
+    bool exposed(voxel_field& V, int x, int y, int z) const;
+    void write_slot(int slot, int x, int y, int z, const voxel& v);
+
+    int x_size = 0, y_size = 0, z_size = 0;
+    std::vector<int> slot_of;       // per voxel, the slot, or no_voxel / buried
+    std::vector<int> voxel_of;      // per slot
+    std::vector<GLfloat> instances; // 6 per slot
+    std::vector<int> changed;       // slots written by the running update
+    voxel_change_log log;
+    int solid_count = 0;
+    uint64_t current = 0;
+    unsigned int dirty_cursor = 0;
+    static constexpr int no_voxel = -1, buried = -2;
+};
+
+// the instance buffer on the GPU, kept by the render loop
+struct voxel_gpu_state {
+    uint64_t version = 0;      // of the voxel instances in the buffer
+    uint64_t upload_bytes = 0; // uploaded by the last frame
+};
+
+// appended to the profiler window: drawn instances and uploaded bytes, next to what drawing every voxel and uploading
+// all of them every frame (what the renderer did before the table) would cost
+void draw_voxel_stats(const voxel_instance_data& instances, const voxel_gpu_state& gpu);
+
+
+// everything the render loop draws and shows of one simulation step, built on the simulation thread and handed over
+// through a triple_buffer, so the render loop always draws the latest finished step without touching the simulation
+struct render_snapshot {
+    particle_instance_data particles;
+    voxel_instance_data voxels;
+    // with TERRAIN_MESH instead of the voxel instances
+    std::vector<std::shared_ptr<const chunk_mesh>> terrain;
+    int remeshed_chunks = 0;
+    int step = 0;
+    double time = 0.0;
+    int particle_num = 0;   // current_particle_num
+    bool realtime = true;   // the step kept up with the wall clock
+    task_graph_timings step_timings;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <string>
+#include <vector>
+
+#include <camera.h>
+#include <data_structures.h>
+#include <trajectory.h>
+#include <voxel_stream.h>
+
+
+// ----------------------------------------------------------------------replay------------------------------------------------------
+// renders a recorded run (RECORD_TRAJECTORY) again without simulating it: the particles come from the trajectory stream
+// and the voxel field from the voxel delta stream recorded next to it
+
+// recorded frame 'n' of both streams belongs to the same simulation step
+const std::string replay_trajectory_file = "trajectory.sphtraj";
+const std::string replay_voxel_file = "voxels.sphvox";
+
+class replay_source {
+public:
+    // open <dir>/trajectory.sphtraj and, if present, <dir>/voxels.sphvox
+    bool open(const std::string& dir);
+    int frame_count() const { return trajectory.frame_count(); }
+    double duration() const;
+    // last recorded frame at or before the simulated time 't'
+    int frame_at(double t) const;
+    // set the particles and the voxel field to recorded frame 'frame'
+    bool load_frame(int frame, std::vector<particle>& p, voxel_field& V);
+private:
+    trajectory_reader trajectory;
+    voxel_stream_reader voxels;
+    bool has_voxels = false;
+    std::vector<glm::vec3> positions;
+    std::vector<float> masses;
+};
+
+
+// a scripted camera path, one key per line (blank lines and lines starting with '#' are skipped):
+//   time  position_x position_y position_z  look_at_x look_at_y look_at_z  [particle_render_scale]
+// the position and the look-at point follow a Catmull-Rom spline through the keys, the scale is taken from the last key passed
+struct camera_key {
+    double time;
+    glm::vec3 position;
+    glm::vec3 look_at;
+    float particle_scale; // < 0: keep the current scale
+};
+
+class camera_script {
+public:
+    bool load(const std::string& path);
+    bool empty() const { return keys.empty(); }
+    double duration() const { return keys.empty() ? 0.0 : keys.back().time; }
+    // place the camera at time 't' (clamped to the script)
+    void apply(double t, Camera& camera, float& particle_scale) const;
+private:
+    std::vector<camera_key> keys;
+};
+
+
+#endif
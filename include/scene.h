@@ -0,0 +1,38 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <string>
+#include <vector>
+
+#include <data_structures.h>
+
+
+// ----------------------------------------------------------------------scene library------------------------------------------------------
+// named initial setups for the headless tools (golden-scene runner), the application itself is still configured with
+// SPH_PARTICLE_NUM / VOXEL_FIELD_SIZE
+// to set up a scene: set_scene_size(), then create the fields (their size depends on it), then set_up_scene()
+
+enum scene_layout {
+    SCENE_RAIN,      // noise terrain, particles spawned as a sheet above it (what the application does)
+    SCENE_DAM_BREAK, // flat soil floor, a block of water against the x_min wall that collapses
+};
+
+struct scene_desc {
+    const char* name;
+    int particles;
+    int field_size; // horizontal size of the domain, see set_field_size()
+    int steps;      // number of steps the golden runner simulates
+    scene_layout layout;
+};
+
+extern const std::vector<scene_desc> golden_scenes;
+
+// nullptr if there is no scene with this name
+const scene_desc* find_scene(const std::string& name);
+
+void set_scene_size(const scene_desc& scene);
+// fill the voxel field and the particles (resized to the scene particle count), the spawn rng is seeded with 'seed'
+void set_up_scene(const scene_desc& scene, unsigned int seed, voxel_field& V, std::vector<particle>& p);
+
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+// ----------------------------------------------------------------------task graph------------------------------------------------------
+// a DAG of named tasks that is built once and run many times (once per simulation step)
+// every task says which data it reads and writes (a bit mask, the bits are up to the user, see step_data), the edges
+// follow from that in the order the tasks were added: a task waits for the earlier tasks that write what it reads or
+// writes, and for the earlier tasks that read what it writes; tasks without such a conflict may run at the same time
+//
+// run() executes the graph on the calling thread and a few helper threads of the graph: TASK_CALLER_THREAD tasks
+// (the internally parallel passes, whose teams should be the pinned threads of the main thread, and anything that
+// needs the GL context) only run on the calling thread, the other tasks on whichever thread is free first
+// every run measures the tasks and the critical path, the longest chain of dependent tasks, which is the time the step
+// would take with unlimited threads and no scheduling cost
+
+enum task_thread {
+    TASK_ANY_THREAD,
+    TASK_CALLER_THREAD,
+};
+
+// the measurements of one run, a plain copy so another thread can show them while the graph runs again
+struct task_graph_timings {
+    std::vector<const char*> names;
+    std::vector<int64_t> begin, end;  // nanoseconds since the start of the run
+    std::vector<char> critical;       // on the critical path
+    int64_t critical_path = 0;        // the longest chain of dependent tasks
+    int64_t work = 0;                 // the sum of all tasks
+    int64_t wall = 0;                 // from the start to the end of the last task
+
+    int task_count() const { return int(names.size()); }
+    // the tasks of the critical path, in order, like "grid build > density > force"
+    std::string critical_path_names() const;
+};
+
+class task_graph {
+public:
+    explicit task_graph(int helper_threads = 2) : helper_count(helper_threads) {}
+    ~task_graph();
+    task_graph(const task_graph&) = delete;
+    task_graph& operator=(const task_graph&) = delete;
+
+    // 'name' must be a string literal (it goes on the trace timeline), returns the index of the task
+    int add(const char* name, std::function<void()> work, uint32_t reads, uint32_t writes, task_thread thread = TASK_ANY_THREAD);
+    void run();
+
+    int task_count() const { return int(tasks.size()); }
+    // of the last run
+    const task_graph_timings& timings() const { return last; }
+private:
+    struct task {
+        const char* name;
+        std::function<void()> work;
+        uint32_t reads, writes;
+        task_thread thread;
+        std::vector<int> after;      // the tasks this one waits for
+        std::vector<int> successors;
+        int waiting = 0;             // unfinished tasks of 'after' during a run
+    };
+
+    void execute(int t);
+    // call with 'mutex' held: marks t finished and queues the successors it released
+    void finish(int t);
+    bool take(bool caller, int& t);
+    void helper();
+    void measure_critical_path();
+
+    std::vector<task> tasks;
+    task_graph_timings last;
+    std::chrono::steady_clock::time_point start;
+
+    // run state, guarded by 'mutex'; ready tasks sorted by index, so the order is the order they were added
+    int helper_count;
+    std::vector<std::thread> helpers;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<int> caller_ready, any_ready;
+    int finished = 0;
+    bool running = false, stopping = false;
+};
+
+// ImGui time line of a run, needs an ImGui frame (appended to the profiler window)
+void draw_task_graph(const task_graph_timings& timings);
+
+
+#endif
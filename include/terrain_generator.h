@@ -0,0 +1,40 @@
+#ifndef TERRAIN_GENERATOR_H
+#define TERRAIN_GENERATOR_H
+
+#include <string>
+
+#include <data_structures.h>
+
+
+// ----------------------------------------------------------------------terrain generation------------------------------------------------------
+// the height map terrain of set_up_voxel_field, written straight into the voxel field: the footprint is split into
+// tiles of tile_size x tile_size columns, each tile asks FastNoise2 for its own part of the height map
+// (GenUniformGrid2D, whose values only depend on the absolute grid position, so the tiles join without seams) and fills
+// its columns; the tiles run in parallel and are whole bricks, so no two tiles stamp the same dirty brick
+// there is no full size noise map or 3D array in between, the memory is the field and a tile of heights per thread
+//
+// the terrain is a height map, so a tile needs one 2D grid, not a GenUniformGrid3D block per chunk
+
+struct terrain_config {
+    // a FastNoise2 encoded node tree, see the NoiseTool of FastNoise2
+    std::string node_tree = "EwCamZk+DQAMAAAAw/VoQAkAAKRwvT4AAAAAPw==";
+    int seed = 1337;
+    float frequency = 0.05f;
+    // the noise position of voxel column (0, 0): the noise x runs along the voxel z axis, the noise y along voxel x
+    int x_start = 500, y_start = 200;
+    // the columns [0, x_size) x [0, z_size) get terrain, 0 = the whole field
+    int x_size = 0, z_size = 0;
+    // in voxels, the noise from -1 to 1 becomes a height from 0 to max_height
+    int max_height = 50;
+    int tile_size = 32; // rounded up to whole bricks
+
+    // key value lines like "seed 42" ('#' starts a comment), the keys are the names above, false if the file cannot be read
+    bool load(const std::string& path);
+};
+
+// fills the columns of 'config' with 'solid' up to the height of the terrain (the other voxels are left as they are),
+// returns false when FastNoise2 cannot decode the node tree
+bool generate_terrain(voxel_field& V, const terrain_config& config, const voxel& solid);
+
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef THREAD_CONFIG_H
+#define THREAD_CONFIG_H
+
+#include <string>
+#include <vector>
+
+#include <profiler.h>
+
+
+// ----------------------------------------------------------------------thread configuration------------------------------------------------------
+// how many threads each parallel phase uses, and whether they are pinned to physical cores
+// auto mode: one thread per physical core (no SMT siblings), pinned, unless a thread config file written by the scaling
+// benchmark (sph_erosion_golden --scaling) says otherwise for a phase
+
+struct cpu_topology {
+    int logical_cpus = 1;
+    int physical_cores = 1;
+    int packages = 1;
+    std::vector<int> core_cpus; // one logical cpu per physical core, ordered by package then core; empty if unknown
+};
+
+// from /sys/devices/system/cpu on Linux, hardware_concurrency() elsewhere
+cpu_topology detect_cpu_topology();
+
+class thread_config {
+public:
+    int default_threads = 0;             // 0 means the default of parallel.h (omp_get_max_threads with OpenMP)
+    int phase_threads[PHASE_COUNT] = {}; // 0 means default_threads
+    bool pin = false;
+
+    int threads(profile_phase phase) const;
+    int max_threads() const;
+
+    // whitespace separated "<key> <value>" lines: "default <n>", "pin <0|1>" and "<phase key> <n>"
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+};
+
+extern thread_config global_thread_config;
+
+// the phases that run in a parallel_region of their own (physics.cpp), only these can have their own thread count
+extern const std::vector<profile_phase> threaded_phases;
+
+// one thread per physical core, pinned, overridden by the file at 'path' if it exists
+thread_config auto_thread_config(const cpu_topology& topology, const std::string& path);
+// 'threads' everywhere, not pinned
+thread_config fixed_thread_config(int threads);
+
+// make 'config' the global one: sets the default team size and pins the worker threads if asked
+void apply_thread_config(const thread_config& config, const cpu_topology& topology);
+
+// gives the calling thread the cpus the process started with again: a thread inherits the mask of the thread that
+// creates it, so a thread started by a pinned team thread would otherwise share its one core
+void unpin_current_thread();
+
+
+#endif
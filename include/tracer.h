@@ -0,0 +1,96 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+
+// ----------------------------------------------------------------------tracer------------------------------------------------------
+// opt-in timeline of the begin/end of every profiled phase and every OpenMP worker scope, written as Chrome trace_event JSON
+// (open it in Perfetto or chrome://tracing)
+//
+// every thread writes into its own ring of events, single producer, no locks on the recording path
+// two ways to capture:
+//   capture_frames(n)              record the next n frames (bound to a key)
+//   set_slow_frame_trigger(ms, n)  record all the time and dump the last n frames whenever a frame takes longer than 'ms'
+
+struct trace_event {
+    const char* name; // must be a string literal or otherwise outlive the tracer
+    int64_t begin;    // nanoseconds since the tracer was created
+    int64_t end;
+};
+
+class tracer {
+public:
+    static const int ring_size = 1 << 15; // events kept per thread
+
+    tracer();
+
+    bool active() const { return recording.load(std::memory_order_relaxed); }
+    int64_t now() const { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count(); }
+    int64_t to_trace_time(std::chrono::steady_clock::time_point t) const { return std::chrono::duration_cast<std::chrono::nanoseconds>(t - epoch).count(); }
+    void record(const char* name, int64_t begin, int64_t end);
+    // names the calling thread in the trace
+    void set_thread_name(const std::string& name);
+
+    void capture_frames(int frames);
+    // 'milliseconds' <= 0 disables the trigger
+    void set_slow_frame_trigger(float milliseconds, int frames);
+    // call once per frame from the main thread with the duration of the frame that just ended
+    void end_frame(float frame_milliseconds);
+
+    std::string output_dir = "out";
+private:
+    struct thread_ring {
+        std::vector<trace_event> events;
+        std::atomic<uint64_t> written{ 0 };
+        int tid = 0;
+        std::string name;
+    };
+    thread_ring& local_ring();
+    void update_recording();
+    // write the events in [begin, end) of all threads to a new json file
+    void dump(int64_t begin, int64_t end, const char* reason);
+
+    std::chrono::steady_clock::time_point epoch;
+    std::atomic<bool> recording{ false };
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<thread_ring>> rings;
+
+    int64_t frame_start = 0;
+    int frame_index = 0;
+    // explicit capture
+    int capture_remaining = 0;
+    int64_t capture_start = 0;
+    // slow frame trigger
+    float slow_frame_ms = 0.0f;
+    int slow_frame_window = 0;
+    int cooldown = 0;
+    std::deque<int64_t> recent_frame_starts;
+    int dump_count = 0;
+};
+
+extern tracer global_tracer;
+
+// records the enclosing scope on the timeline when the tracer is active, costs a relaxed load otherwise
+class trace_scope {
+public:
+    explicit trace_scope(const char* _name) : name(_name), begin(global_tracer.active() ? global_tracer.now() : -1) {}
+    ~trace_scope() {
+        if (begin >= 0) {
+            global_tracer.record(name, begin, global_tracer.now());
+        }
+    }
+private:
+    const char* name;
+    int64_t begin;
+};
+
+
+#endif
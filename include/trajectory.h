@@ -0,0 +1,117 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <data_structures.h>
+#include <mapped_file.h>
+
+
+// ----------------------------------------------------------------------trajectory stream------------------------------------------------------
+// compact per-frame recording of particle positions (and optionally mass), so a run can be simulated once and rendered many times
+//
+// positions are quantized to 16 bits inside the bounding box, mass to 16 bits inside [mass_min, mass_max]
+// every value is predicted from the previous frames of the same particle and only the residual is stored:
+//   keyframe                  residual = q
+//   first frame after it      residual = q - q[-1]
+//   other frames              residual = q - (2 * q[-1] - q[-2])       (particles move smoothly, so this is mostly tiny)
+// residuals are zigzag + varint coded and the bytes run-length compressed, in independent blocks of 'block_size' particles
+//
+// file layout (little endian):
+//   trajectory_header
+//   frames                    trajectory_frame_header + blocks (uint32 byte size + block data each)
+//   frame index               frame_count * trajectory_index_entry
+//   trajectory_footer         points at the index, missing if the writer did not finish (the reader then scans the frames)
+
+const uint32_t trajectory_magic = 0x4A415254; // "TRAJ"
+const uint32_t trajectory_frame_magic = 0x4D415246; // "FRAM"
+const uint32_t trajectory_footer_magic = 0x58444E49; // "INDX"
+const uint32_t trajectory_version = 1;
+
+struct trajectory_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t has_mass;
+    uint32_t keyframe_interval;
+    uint32_t block_size;
+    float    box_min[3];
+    float    box_max[3];
+    float    mass_min, mass_max;
+};
+
+struct trajectory_frame_header {
+    uint32_t magic;
+    uint32_t particle_count;
+    uint32_t is_keyframe;
+    uint32_t block_count;
+    uint64_t payload_size; // bytes of all blocks following this header
+    double   time;
+};
+
+struct trajectory_index_entry {
+    uint64_t offset; // of the trajectory_frame_header
+    uint32_t particle_count;
+    uint32_t is_keyframe;
+    double   time;
+};
+
+struct trajectory_footer {
+    uint64_t index_offset;
+    uint32_t frame_count;
+    uint32_t magic;
+};
+
+
+// streams frames to disk as they are simulated, the index is appended by close()
+class trajectory_writer {
+public:
+    ~trajectory_writer();
+    bool open(const std::string& path, const bounding_box& box, bool with_mass, int keyframe_interval = 60, int block_size = 4096);
+    // record the first 'count' particles of 'p', the blocks are encoded by a team of 'threads' (0 = the default of parallel.h,
+    // 1 = serially on the calling thread, for a caller outside the pinned team such as a task graph helper)
+    bool write_frame(const std::vector<particle>& p, int count, double time, int threads = 0);
+    bool close();
+    bool is_open() const { return file != nullptr; }
+    int frame_count() const { return int(index.size()); }
+    uint64_t bytes_written() const { return offset; }
+private:
+    FILE* file = nullptr;
+    trajectory_header header;
+    uint64_t offset = 0;
+    std::vector<trajectory_index_entry> index;
+    int frames_since_keyframe = 0;
+    std::vector<uint16_t> quantized, previous, previous2; // particle-major: x, y, z, (mass) per particle
+    int previous_count = 0, previous2_count = 0;
+    std::vector<std::vector<uint8_t>> block_data;
+};
+
+
+// random access reader, decodes from the nearest keyframe and keeps the decoding state for sequential playback
+class trajectory_reader {
+public:
+    bool open(const std::string& path);
+    void close();
+    int frame_count() const { return int(index.size()); }
+    bool has_mass() const { return header.has_mass != 0; }
+    int particle_count(int frame) const { return int(index[frame].particle_count); }
+    double frame_time(int frame) const { return index[frame].time; }
+    // decode frame 'frame', 'masses' is only filled if the file has mass
+    bool read_frame(int frame, std::vector<glm::vec3>& positions, std::vector<float>* masses = nullptr);
+private:
+    bool decode_next(int frame);
+    bool rebuild_index();
+    mapped_file file;
+    trajectory_header header;
+    std::vector<trajectory_index_entry> index;
+    int decoded_frame = -1;
+    int frames_since_keyframe = 0;
+    std::vector<uint16_t> quantized, previous, previous2;
+    int previous_count = 0, previous2_count = 0;
+};
+
+
+#endif
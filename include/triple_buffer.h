@@ -0,0 +1,45 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+
+// ----------------------------------------------------------------------triple buffer------------------------------------------------------
+// hands the latest of a stream of values from one writer thread to one reader thread without locks and without either
+// side ever waiting: the writer fills back() and publish()es it, the reader takes the newest published value with
+// latest(), which stays untouched until the reader calls latest() again
+// three slots: one the writer owns, one the reader owns and the last published one in between, which publish() and
+// latest() swap with their own slot in one atomic exchange; values the reader never picked up are simply overwritten
+
+template<class T>
+class triple_buffer {
+public:
+    // writer side: the slot to fill, it keeps whatever it held two publishes ago
+    T& back() { return slots[back_index]; }
+    void publish() {
+        int previous = middle.exchange(back_index | fresh, std::memory_order_acq_rel);
+        back_index = previous & index_mask;
+    }
+
+    // reader side: the newest published value, or the one returned last time if nothing new was published
+    const T& latest() {
+        if (middle.load(std::memory_order_relaxed) & fresh) {
+            int previous = middle.exchange(front_index, std::memory_order_acq_rel);
+            front_index = previous & index_mask;
+        }
+        return slots[front_index];
+    }
+    // reader side, without looking for a newer value
+    const T& front() const { return slots[front_index]; }
+private:
+    static const int index_mask = 3;
+    static const int fresh = 4; // the middle slot was published and not read yet
+
+    T slots[3];
+    alignas(64) std::atomic<int> middle{ 1 };
+    alignas(64) int back_index = 0; // only used by the writer
+    alignas(64) int front_index = 2; // only used by the reader
+};
+
+
+#endif
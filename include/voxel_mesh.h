@@ -0,0 +1,76 @@
+#ifndef VOXEL_MESH_H
+#define VOXEL_MESH_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <data_structures.h>
+
+
+// ----------------------------------------------------------------------terrain mesh------------------------------------------------------
+// the alternative to one instanced cube per voxel (TERRAIN_MESH=1): the field is split into chunk_size^3 chunks, and each
+// chunk has a mesh of only the faces between a drawn voxel and an empty one, where neighbouring coplanar faces with the
+// same density level are merged into one rectangle (greedy meshing), so a flat patch of terrain is a few quads instead
+// of thousands of 12 triangle cubes
+// after a step only the chunks the dirty bricks touch (erosion, deposition, restores) are meshed again, in parallel
+//
+// CPU only, no GL call, so it can be benchmarked and tested headless; render_terrain_mesh (render.cpp) uploads and draws
+// a finished mesh is immutable and shared: the snapshots and the GL layer hold pointers to the meshes they use, and a
+// remesh makes a new one, so the render thread never sees a mesh that is being built
+
+#ifndef TERRAIN_MESH
+#define TERRAIN_MESH 0
+#endif
+
+// the faces of a quad carry the density of its voxels, the shader turns it into the color like voxel::update_color
+struct mesh_vertex {
+    GLfloat position[3];
+    GLfloat normal[3];
+    GLfloat density;    // density / voxel_maximum_density, the middle of the level of the merged faces
+    GLfloat deposited;  // 1 for voxels made by deposition (voxel::is_new), which have their own colors
+};
+
+struct chunk_mesh {
+    std::vector<mesh_vertex> vertices; // 4 per quad
+    std::vector<GLuint> indices;       // 6 per quad
+    int face_count = 0;                // voxel faces, before merging
+    glm::vec3 lo, hi;                  // the box of the voxels of the chunk, for culling
+    int quad_count() const { return int(indices.size() / 6); }
+};
+
+// greedy mesh of the voxels [begin, begin + size) of V, the faces toward voxels outside the range look at V too,
+// so a chunk has no faces against a solid neighbour chunk
+void build_chunk_mesh(voxel_field& V, const int begin[3], const int size[3], chunk_mesh& mesh);
+
+class terrain_mesh {
+public:
+    static const int chunk_size = 16;     // a multiple of voxel_field::brick_size
+    static const int density_levels = 16; // faces merge within a level, the color has this many steps
+
+    // meshes the chunks touched by the bricks dirty since the last update (the first call and a field of another size
+    // mesh every chunk), returns the number of chunks meshed
+    int update(voxel_field& V);
+
+    int chunk_count() const { return int(chunks.size()); }
+    // the current meshes, shared with whoever copied them
+    const std::vector<std::shared_ptr<const chunk_mesh>>& meshes() const { return chunks; }
+private:
+    int x_size = 0, y_size = 0, z_size = 0;
+    int chunk_x_num = 0, chunk_y_num = 0, chunk_z_num = 0;
+    std::vector<std::shared_ptr<const chunk_mesh>> chunks;
+    std::vector<char> dirty; // per chunk
+    unsigned int dirty_cursor = 0;
+};
+
+// the GL objects of a chunk, kept by the render loop for render_terrain_mesh
+struct terrain_chunk_gl {
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    std::shared_ptr<const chunk_mesh> uploaded; // the mesh in the buffers
+};
+
+// appended to the profiler window: quads of the meshes against the voxel faces they cover, chunks meshed and bytes uploaded
+void draw_terrain_stats(const std::vector<std::shared_ptr<const chunk_mesh>>& meshes, int remeshed_chunks, uint64_t upload_bytes);
+
+
+#endif
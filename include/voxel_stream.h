@@ -0,0 +1,90 @@
+#ifndef VOXEL_STREAM_H
+#define VOXEL_STREAM_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <data_structures.h>
+#include <mapped_file.h>
+
+
+// ----------------------------------------------------------------------voxel delta stream------------------------------------------------------
+// per-frame recording of the voxel field next to the particle trajectory: every frame stores the bricks changed since
+// the previous frame (the voxel_field dirty stamps), a keyframe stores all bricks so a reader can seek without going back to frame 0
+//
+// file layout (little endian):
+//   voxel_stream_header
+//   frames                    voxel_stream_frame_header, brick indices (uint32), densities (brick_size^3 floats each), flags (brick_size^3 bytes each)
+// the frames are indexed by scanning the file on open, so an interrupted recording stays readable
+
+const uint32_t voxel_stream_magic = 0x53584F56; // "VOXS"
+const uint32_t voxel_stream_frame_magic = 0x4D524656; // "VFRM"
+const uint32_t voxel_stream_version = 1;
+
+struct voxel_stream_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    int32_t  voxel_x_size, voxel_y_size, voxel_z_size;
+    uint32_t brick_size;
+    uint32_t keyframe_interval;
+};
+
+struct voxel_stream_frame_header {
+    uint32_t magic;
+    uint32_t brick_count;
+    uint32_t is_keyframe;
+    uint32_t reserved;
+    uint64_t step;
+    double   time;
+    uint64_t payload_size;
+};
+
+
+class voxel_stream_writer {
+public:
+    ~voxel_stream_writer();
+    bool open(const std::string& path, voxel_field& V, int keyframe_interval = 300);
+    // record the bricks changed since the previous frame (all of them for a keyframe)
+    bool write_frame(voxel_field& V, uint64_t step, double time);
+    bool close();
+    bool is_open() const { return file != nullptr; }
+private:
+    FILE* file = nullptr;
+    voxel_stream_header header;
+    int frame_count = 0;
+    unsigned int dirty_cursor = 0;
+    std::vector<int> bricks;
+    std::vector<float> density;
+    std::vector<uint8_t> flags;
+};
+
+
+// applies the recorded frames to a voxel field, seeking back restarts from the nearest keyframe
+class voxel_stream_reader {
+public:
+    bool open(const std::string& path);
+    void close();
+    int frame_count() const { return int(frames.size()); }
+    uint64_t frame_step(int frame) const { return frames[frame].step; }
+    double frame_time(int frame) const { return frames[frame].time; }
+    // bring 'V' to the state of 'frame', V must have the recorded size and not be modified between calls
+    bool apply_frame(int frame, voxel_field& V);
+private:
+    struct frame_entry {
+        uint64_t offset;
+        uint64_t step;
+        double time;
+        bool is_keyframe;
+    };
+    bool apply_one(int frame, voxel_field& V);
+    mapped_file file;
+    voxel_stream_header header;
+    std::vector<frame_entry> frames;
+    int applied_frame = -1;
+};
+
+
+#endif
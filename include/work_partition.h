@@ -0,0 +1,63 @@
+#ifndef WORK_PARTITION_H
+#define WORK_PARTITION_H
+
+#include <vector>
+
+#include <parallel.h>
+
+
+// ----------------------------------------------------------------------load balancing------------------------------------------------------
+// splits the particles of a pass into one contiguous block per thread with about the same estimated work, instead of
+// the same number of particles: water piles up at the bottom of the terrain, where a particle has several times the
+// neighbours of one in the spray, and a plain static schedule leaves the threads with the dense blocks behind
+//
+// the blocks stay contiguous (unlike a dynamic schedule), so each thread keeps walking its own part of the particle
+// array, which is close to the part first_touch_resize placed on its node (numa_placement.h)
+// BALANCED_SCHEDULE=0 gives every block the same number of particles (the static schedule), for comparisons
+
+#ifndef BALANCED_SCHEDULE
+#define BALANCED_SCHEDULE 1
+#endif
+
+class work_partition {
+public:
+    // blocks of about equal total cost for 'blocks' threads, cost(i) is the estimated work of item i
+    template<class cost_of>
+    void balance(int count, int blocks, cost_of cost);
+    // the same number of items per block
+    void uniform(int count, int blocks);
+
+    int block_count() const { return int(bounds.size()) - 1; }
+    // the items of thread 'thread' in a team of 'team' threads: its own block when the team has one thread per block,
+    // otherwise an even share of the blocks
+    void range(int thread, int team, int& begin, int& end) const;
+private:
+    std::vector<int> bounds; // block b is [bounds[b], bounds[b + 1])
+    std::vector<double> prefix; // kept between the steps, balance() runs every step
+};
+
+template<class cost_of>
+void work_partition::balance(int count, int blocks, cost_of cost) {
+    if (!BALANCED_SCHEDULE || blocks <= 1) {
+        uniform(count, blocks);
+        return;
+    }
+    prefix.resize(count + 1);
+    prefix[0] = 0.0;
+    parallel_for(0, count, [&](int i) { prefix[i + 1] = cost(i); }, 4096, blocks);
+    parallel_scan(prefix.data() + 1, count, 0.0, [](double a, double b) { return a + b; }, blocks);
+    bounds.assign(blocks + 1, count);
+    bounds[0] = 0;
+    // block b ends at the first item whose prefix reaches b / blocks of the total
+    int i = 0;
+    for (int b = 1; b < blocks; b++) {
+        double target = prefix[count] * b / blocks;
+        while (i < count && prefix[i] < target) {
+            i++;
+        }
+        bounds[b] = i;
+    }
+}
+
+
+#endif
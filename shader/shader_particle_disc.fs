@@ -0,0 +1,18 @@
+#version 330 core
+
+
+in vec3 instanceColor;
+in vec2 quadCorner;
+out vec4 FragColor;
+
+uniform float outline;
+
+// the far particles: a flat disc with the outline, no per fragment depth, so the early depth test still works
+void main()
+{
+    float d = length(quadCorner); // 1 at the edge of the outline
+    if (d > 1.0f) {
+        discard;
+    }
+    FragColor = vec4(d * outline > 1.0f ? vec3(0.0f) : instanceColor, 1.0f);
+}
@@ -0,0 +1,41 @@
+#version 330 core
+
+
+in vec3 instanceColor;
+in vec3 viewPosition;
+flat in vec3 viewCenter;
+out vec4 FragColor;
+
+uniform mat4 projection;
+uniform float radius;
+uniform float outline;
+
+// the distance along the view ray 'direction' (from the camera, the origin of view space) to the sphere, -1 for a miss
+// 'back' is the far side of the sphere
+float hit(vec3 direction, float r, bool back) {
+    float b = dot(direction, viewCenter);
+    float h = b * b - dot(viewCenter, viewCenter) + r * r;
+    if (h < 0.0f) {
+        return -1.0f;
+    }
+    return back ? b + sqrt(h) : b - sqrt(h);
+}
+
+void main()
+{
+    vec3 direction = normalize(viewPosition);
+    vec3 color = instanceColor;
+    float t = hit(direction, radius, false);
+    if (t < 0.0f) {
+        // the outline, where the sphere meshes show the back faces of a slightly larger sphere
+        t = hit(direction, radius * outline, true);
+        if (t < 0.0f) {
+            discard;
+        }
+        color = vec3(0.0f);
+    }
+    // the depth of the point of the sphere, so particles cut each other and the terrain like the meshes do
+    vec4 clip = projection * vec4(direction * t, 1.0f);
+    gl_FragDepth = 0.5f * clip.z / clip.w + 0.5f;
+    FragColor = vec4(color, 1.0f);
+}
@@ -0,0 +1,48 @@
+#version 330 core
+
+layout (location = 0) in vec2 corner;      // of the quad, from -1 to 1
+layout (location = 1) in vec3 translation; // per particle
+layout (location = 2) in vec3 color;
+
+
+out vec3 instanceColor;
+out vec2 quadCorner;
+out vec3 viewPosition;
+flat out vec3 viewCenter;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float radius;       // of the sphere, particle_render_scale
+uniform float outline;      // the black outline around the sphere, as a factor of the radius
+uniform float lod_distance; // particles farther from the camera are flat discs, 0 = no discs
+uniform bool far_pass;      // this draw is the discs, otherwise the spheres
+
+
+void main()
+{
+    vec3 center = (view * vec4(translation, 1.0f)).xyz;
+    float distance = length(center);
+    bool far = lod_distance > 0.0f && distance > lod_distance;
+    if (far != far_pass) {
+        // drawn by the other pass, outside the clip volume the quad is dropped before rasterization
+        gl_Position = vec4(2.0f, 2.0f, 2.0f, 1.0f);
+        return;
+    }
+
+    // the quad faces the camera (it is perpendicular to the view ray to the center), there the cone of view rays that
+    // touch the sphere is a circle, a little larger than the sphere in perspective
+    float r = radius * outline;
+    vec3 forward = center / max(distance, 1e-6f);
+    vec3 right = normalize(cross(forward, vec3(0.0f, 1.0f, 0.0f)));
+    vec3 up = cross(right, forward);
+    // the spheres are ray cast at the plane of the center, the discs sit at the front of the sphere
+    float plane = far_pass ? distance - radius : distance;
+    float size = plane * r / sqrt(max(distance * distance - r * r, 1e-6f));
+
+    viewPosition = forward * plane + (right * corner.x + up * corner.y) * size;
+    gl_Position = projection * vec4(viewPosition, 1.0f);
+
+    instanceColor = color;
+    quadCorner = corner;
+    viewCenter = center;
+}
@@ -0,0 +1,26 @@
+#version 330 core
+
+
+in vec3 normal;
+in float faceDensity;
+in float faceDeposited;
+out vec4 FragColor;
+
+// the colors of voxel::update_color
+uniform vec3 low_density_color;
+uniform vec3 high_density_color;
+uniform vec3 light_direction;
+
+void main()
+{
+    vec3 color;
+    if (faceDeposited > 0.5f) {
+        color = vec3(0.1f, 0.9f, faceDensity);
+    }
+    else {
+        color = mix(low_density_color, high_density_color, faceDensity);
+    }
+    // the merged faces have no edges like the cubes, a little shading keeps the shape readable
+    float light = 0.6f + 0.4f * max(dot(normalize(normal), -light_direction), 0.0f);
+    FragColor = vec4(color * light, 1.0f);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in float density;
+layout (location = 3) in float deposited;
+
+
+out vec3 normal;
+out float faceDensity;
+out float faceDeposited;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+
+void main()
+{
+    gl_Position = projection * view * vec4(aPos, 1.0f);
+
+    normal = aNormal;
+    faceDensity = density;
+    faceDeposited = deposited;
+}
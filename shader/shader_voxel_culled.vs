@@ -0,0 +1,22 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in int slot; // of the voxel instance table, per instance
+
+
+out vec3 instanceColor;
+
+uniform samplerBuffer instances; // the voxel instance buffer, {x, y, z, r, g, b} per slot
+uniform mat4 scale;
+uniform mat4 view;
+uniform mat4 projection;
+
+
+void main()
+{
+    int base = slot * 6;
+    vec3 translation = vec3(texelFetch(instances, base).r, texelFetch(instances, base + 1).r, texelFetch(instances, base + 2).r);
+    gl_Position = projection * view * vec4((scale * vec4(aPos, 1.0f)).xyz + translation, 1.0f);
+
+    instanceColor = vec3(texelFetch(instances, base + 3).r, texelFetch(instances, base + 4).r, texelFetch(instances, base + 5).r);
+}
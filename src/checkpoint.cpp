@@ -0,0 +1,580 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
+
+#include <checkpoint.h>
+#include <memory_tracker.h>
+
+
+static_assert(sizeof(checkpoint_header) == 96, "checkpoint_header layout changed, bump checkpoint_version");
+static_assert(sizeof(checkpoint_delta_header) == 128, "checkpoint_delta_header layout changed, bump checkpoint_delta_version");
+
+
+static uint8_t pack_voxel_flags(const voxel& v) {
+    return (v.exist ? VOXEL_FLAG_EXIST : 0) | (v.not_destroyable ? VOXEL_FLAG_NOT_DESTROYABLE : 0) | (v.is_new ? VOXEL_FLAG_IS_NEW : 0);
+}
+
+static void unpack_voxel(voxel& v, float density, uint8_t flags) {
+    v.density = density;
+    v.exist = (flags & VOXEL_FLAG_EXIST) != 0;
+    v.not_destroyable = (flags & VOXEL_FLAG_NOT_DESTROYABLE) != 0;
+    v.is_new = (flags & VOXEL_FLAG_IS_NEW) != 0;
+    v.debug = false;
+    if (v.exist) {
+        v.update_color();
+    }
+    else {
+        v.color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+}
+
+
+// ----------------------------------------------------------------------snapshot------------------------------------------------------
+
+// particles, scalars and rng, shared by full and delta snapshots
+static void take_state_snapshot(simulation_snapshot& s, const std::vector<particle>& p) {
+    s.particles = p;
+    s.current_particle_num = current_particle_num;
+    s.step = simulation_step_count;
+    s.time = simulation_elapsed_time;
+    std::ostringstream rng_state;
+    rng_state << simulation_rng;
+    s.rng_state = rng_state.str();
+}
+
+static void restore_state(uint64_t step, double time, int particle_num, const char* rng_state, size_t rng_state_size) {
+    current_particle_num = particle_num;
+    simulation_step_count = step;
+    simulation_elapsed_time = time;
+    std::istringstream rng(std::string(rng_state, rng_state_size));
+    rng >> simulation_rng;
+}
+
+void take_simulation_snapshot(simulation_snapshot& s, const std::vector<particle>& p, voxel_field& V) {
+    take_state_snapshot(s, p);
+    s.x_size = V.x_size;
+    s.y_size = V.y_size;
+    s.z_size = V.z_size;
+    size_t voxel_count = size_t(V.x_size) * V.y_size * V.z_size;
+    s.voxel_density.resize(voxel_count);
+    s.voxel_flags.resize(voxel_count);
+    size_t n = 0;
+    for (int i = 0; i < V.x_size; i++) {
+        for (int j = 0; j < V.y_size; j++) {
+            for (int k = 0; k < V.z_size; k++) {
+                const voxel& v = V.field[i][j][k];
+                s.voxel_density[n] = v.density;
+                s.voxel_flags[n] = pack_voxel_flags(v);
+                n++;
+            }
+        }
+    }
+}
+
+
+// ----------------------------------------------------------------------write------------------------------------------------------
+
+bool write_checkpoint(const std::string& path, const simulation_snapshot& s) {
+    checkpoint_header header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = checkpoint_magic;
+    header.version = checkpoint_version;
+    header.header_size = sizeof(checkpoint_header);
+    header.particle_stride = sizeof(particle);
+    header.particle_count = static_cast<uint32_t>(s.particles.size());
+    header.current_particle_num = s.current_particle_num;
+    header.voxel_x_size = s.x_size;
+    header.voxel_y_size = s.y_size;
+    header.voxel_z_size = s.z_size;
+    header.rng_state_size = static_cast<uint32_t>(s.rng_state.size());
+    header.simulation_step = s.step;
+    header.simulation_time = s.time;
+    header.particles_offset = sizeof(checkpoint_header);
+    header.voxel_density_offset = header.particles_offset + uint64_t(sizeof(particle)) * s.particles.size();
+    header.voxel_flags_offset = header.voxel_density_offset + sizeof(float) * s.voxel_density.size();
+    header.rng_state_offset = header.voxel_flags_offset + s.voxel_flags.size();
+    header.file_size = header.rng_state_offset + s.rng_state.size();
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "checkpoint: cannot open " << tmp_path << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(s.particles.data()), sizeof(particle) * s.particles.size());
+        out.write(reinterpret_cast<const char*>(s.voxel_density.data()), sizeof(float) * s.voxel_density.size());
+        out.write(reinterpret_cast<const char*>(s.voxel_flags.data()), s.voxel_flags.size());
+        out.write(s.rng_state.data(), s.rng_state.size());
+        if (!out) {
+            std::cout << "checkpoint: write failed " << tmp_path << std::endl;
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cout << "checkpoint: cannot rename " << tmp_path << " -> " << path << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+checkpoint_writer::~checkpoint_writer() {
+    wait();
+}
+
+bool checkpoint_writer::request(const std::string& path, const std::vector<particle>& p, voxel_field& V) {
+    if (writing.load()) {
+        return false;
+    }
+    if (worker.joinable()) {
+        worker.join();
+    }
+    take_simulation_snapshot(snapshot, p, V);
+    writing = true;
+    worker = std::thread([this, path]() {
+        memory_scope memory(MEMORY_RECORDING);
+        if (write_checkpoint(path, snapshot)) {
+            std::cout << "checkpoint saved: " << path << " (step " << snapshot.step << ")" << std::endl;
+        }
+        writing = false;
+    });
+    return true;
+}
+
+bool checkpoint_writer::busy() const {
+    return writing.load();
+}
+
+void checkpoint_writer::wait() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+
+// ----------------------------------------------------------------------load------------------------------------------------------
+
+bool load_checkpoint(const std::string& path, std::vector<particle>& p, voxel_field& V) {
+    mapped_file file;
+    if (!file.open(path)) {
+        std::cout << "checkpoint: cannot open " << path << std::endl;
+        return false;
+    }
+    if (file.size() < sizeof(checkpoint_header)) {
+        std::cout << "checkpoint: file too small " << path << std::endl;
+        return false;
+    }
+    checkpoint_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != checkpoint_magic || header.version != checkpoint_version || header.header_size != sizeof(checkpoint_header)) {
+        std::cout << "checkpoint: unknown format or version in " << path << std::endl;
+        return false;
+    }
+    if (header.particle_stride != sizeof(particle)) {
+        std::cout << "checkpoint: particle layout mismatch (" << header.particle_stride << " vs " << sizeof(particle) << ")" << std::endl;
+        return false;
+    }
+    if (header.voxel_x_size != V.x_size || header.voxel_y_size != V.y_size || header.voxel_z_size != V.z_size) {
+        std::cout << "checkpoint: voxel field size mismatch, file has " << header.voxel_x_size << "x" << header.voxel_y_size << "x" << header.voxel_z_size << std::endl;
+        return false;
+    }
+    if (header.file_size != file.size()) {
+        std::cout << "checkpoint: truncated file " << path << std::endl;
+        return false;
+    }
+
+    const uint8_t* base = file.data();
+    p.resize(header.particle_count);
+    std::memcpy(p.data(), base + header.particles_offset, sizeof(particle) * header.particle_count);
+
+    const float* density = reinterpret_cast<const float*>(base + header.voxel_density_offset);
+    const uint8_t* flags = base + header.voxel_flags_offset;
+    size_t n = 0;
+    for (int i = 0; i < V.x_size; i++) {
+        for (int j = 0; j < V.y_size; j++) {
+            for (int k = 0; k < V.z_size; k++) {
+                float d;
+                std::memcpy(&d, density + n, sizeof(float));
+                unpack_voxel(V.field[i][j][k], d, flags[n]);
+                n++;
+            }
+        }
+    }
+    V.mark_all_dirty();
+
+    restore_state(header.simulation_step, header.simulation_time, header.current_particle_num,
+                  reinterpret_cast<const char*>(base + header.rng_state_offset), header.rng_state_size);
+    return true;
+}
+
+
+// ----------------------------------------------------------------------incremental checkpoints------------------------------------------------------
+
+void copy_voxel_bricks(const voxel_field& V, const std::vector<int>& bricks, std::vector<float>& density, std::vector<uint8_t>& flags) {
+    const int bs = voxel_field::brick_size;
+    const size_t brick_voxels = size_t(bs) * bs * bs;
+    density.assign(brick_voxels * bricks.size(), 0.0f);
+    flags.assign(brick_voxels * bricks.size(), 0);
+    for (size_t n = 0; n < bricks.size(); n++) {
+        int b = bricks[n];
+        int bx = b / (V.brick_y_num * V.brick_z_num);
+        int by = (b / V.brick_z_num) % V.brick_y_num;
+        int bz = b % V.brick_z_num;
+        size_t offset = n * brick_voxels;
+        for (int i = 0; i < bs; i++) {
+            for (int j = 0; j < bs; j++) {
+                for (int k = 0; k < bs; k++) {
+                    int x = bx * bs + i, y = by * bs + j, z = bz * bs + k;
+                    if (x < V.x_size && y < V.y_size && z < V.z_size) {
+                        const voxel& v = V.field[x][y][z];
+                        density[offset] = v.density;
+                        flags[offset] = pack_voxel_flags(v);
+                    }
+                    offset++;
+                }
+            }
+        }
+    }
+}
+
+bool paste_voxel_bricks(voxel_field& V, const uint8_t* bricks, const uint8_t* density, const uint8_t* flags, uint32_t count) {
+    const int bs = voxel_field::brick_size;
+    const size_t brick_voxels = size_t(bs) * bs * bs;
+    for (uint32_t n = 0; n < count; n++) {
+        uint32_t b;
+        std::memcpy(&b, bricks + sizeof(uint32_t) * n, sizeof(uint32_t));
+        if (b >= uint32_t(V.brick_count())) {
+            return false;
+        }
+        int bx = b / (V.brick_y_num * V.brick_z_num);
+        int by = (b / V.brick_z_num) % V.brick_y_num;
+        int bz = b % V.brick_z_num;
+        const uint8_t* brick_density = density + sizeof(float) * brick_voxels * n;
+        const uint8_t* brick_flags = flags + brick_voxels * n;
+        size_t offset = 0;
+        for (int i = 0; i < bs; i++) {
+            for (int j = 0; j < bs; j++) {
+                for (int k = 0; k < bs; k++) {
+                    int x = bx * bs + i, y = by * bs + j, z = bz * bs + k;
+                    if (x < V.x_size && y < V.y_size && z < V.z_size) {
+                        float d;
+                        std::memcpy(&d, brick_density + sizeof(float) * offset, sizeof(float));
+                        unpack_voxel(V.field[x][y][z], d, brick_flags[offset]);
+                        V.mark_dirty(x, y, z);
+                    }
+                    offset++;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void take_brick_delta_snapshot(brick_delta_snapshot& s, const std::vector<int>& bricks, const std::vector<particle>& p, voxel_field& V) {
+    take_state_snapshot(s.state, p);
+    s.state.x_size = V.x_size;
+    s.state.y_size = V.y_size;
+    s.state.z_size = V.z_size;
+    s.bricks.assign(bricks.begin(), bricks.end());
+    copy_voxel_bricks(V, bricks, s.density, s.flags);
+}
+
+bool write_checkpoint_delta(const std::string& path, const brick_delta_snapshot& s) {
+    const simulation_snapshot& st = s.state;
+    checkpoint_delta_header header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = checkpoint_delta_magic;
+    header.version = checkpoint_delta_version;
+    header.header_size = sizeof(checkpoint_delta_header);
+    header.particle_stride = sizeof(particle);
+    header.particle_count = static_cast<uint32_t>(st.particles.size());
+    header.current_particle_num = st.current_particle_num;
+    header.voxel_x_size = st.x_size;
+    header.voxel_y_size = st.y_size;
+    header.voxel_z_size = st.z_size;
+    header.brick_size = voxel_field::brick_size;
+    header.brick_count = static_cast<uint32_t>(s.bricks.size());
+    header.rng_state_size = static_cast<uint32_t>(st.rng_state.size());
+    header.base_step = s.base_step;
+    header.previous_step = s.previous_step;
+    header.simulation_step = st.step;
+    header.simulation_time = st.time;
+    header.particles_offset = sizeof(checkpoint_delta_header);
+    header.brick_index_offset = header.particles_offset + uint64_t(sizeof(particle)) * st.particles.size();
+    header.brick_density_offset = header.brick_index_offset + sizeof(uint32_t) * s.bricks.size();
+    header.brick_flags_offset = header.brick_density_offset + sizeof(float) * s.density.size();
+    header.rng_state_offset = header.brick_flags_offset + s.flags.size();
+    header.file_size = header.rng_state_offset + st.rng_state.size();
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "checkpoint: cannot open " << tmp_path << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(st.particles.data()), sizeof(particle) * st.particles.size());
+        out.write(reinterpret_cast<const char*>(s.bricks.data()), sizeof(uint32_t) * s.bricks.size());
+        out.write(reinterpret_cast<const char*>(s.density.data()), sizeof(float) * s.density.size());
+        out.write(reinterpret_cast<const char*>(s.flags.data()), s.flags.size());
+        out.write(st.rng_state.data(), st.rng_state.size());
+        if (!out) {
+            std::cout << "checkpoint: write failed " << tmp_path << std::endl;
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cout << "checkpoint: cannot rename " << tmp_path << " -> " << path << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// read and validate the header of a delta file
+static bool read_delta_header(const mapped_file& file, const std::string& path, checkpoint_delta_header& header) {
+    if (file.size() < sizeof(checkpoint_delta_header)) {
+        std::cout << "checkpoint: file too small " << path << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != checkpoint_delta_magic || header.version != checkpoint_delta_version || header.header_size != sizeof(checkpoint_delta_header)) {
+        std::cout << "checkpoint: unknown delta format or version in " << path << std::endl;
+        return false;
+    }
+    if (header.file_size != file.size()) {
+        std::cout << "checkpoint: truncated file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool apply_checkpoint_delta(const std::string& path, std::vector<particle>& p, voxel_field& V) {
+    mapped_file file;
+    if (!file.open(path)) {
+        std::cout << "checkpoint: cannot open " << path << std::endl;
+        return false;
+    }
+    checkpoint_delta_header header;
+    if (!read_delta_header(file, path, header)) {
+        return false;
+    }
+    if (header.particle_stride != sizeof(particle)) {
+        std::cout << "checkpoint: particle layout mismatch (" << header.particle_stride << " vs " << sizeof(particle) << ")" << std::endl;
+        return false;
+    }
+    if (header.voxel_x_size != V.x_size || header.voxel_y_size != V.y_size || header.voxel_z_size != V.z_size || header.brick_size != voxel_field::brick_size) {
+        std::cout << "checkpoint: voxel field size mismatch in " << path << std::endl;
+        return false;
+    }
+
+    const uint8_t* base = file.data();
+    p.resize(header.particle_count);
+    std::memcpy(p.data(), base + header.particles_offset, sizeof(particle) * header.particle_count);
+
+    if (!paste_voxel_bricks(V, base + header.brick_index_offset, base + header.brick_density_offset, base + header.brick_flags_offset, header.brick_count)) {
+        std::cout << "checkpoint: brick index out of range in " << path << std::endl;
+        return false;
+    }
+
+    restore_state(header.simulation_step, header.simulation_time, header.current_particle_num,
+                  reinterpret_cast<const char*>(base + header.rng_state_offset), header.rng_state_size);
+    return true;
+}
+
+
+static std::string base_checkpoint_path(const std::string& dir, uint64_t step) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "base_%010llu.ckpt", static_cast<unsigned long long>(step));
+    return (std::filesystem::path(dir) / name).string();
+}
+
+static std::string delta_checkpoint_path(const std::string& dir, uint64_t step) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "delta_%010llu.ckpd", static_cast<unsigned long long>(step));
+    return (std::filesystem::path(dir) / name).string();
+}
+
+std::vector<checkpoint_frame> list_checkpoint_frames(const std::string& dir) {
+    std::vector<checkpoint_frame> frames;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        unsigned long long step;
+        char tail;
+        if (std::sscanf(name.c_str(), "base_%llu.ckp%c", &step, &tail) == 2 && tail == 't' && name.size() == 20) {
+            frames.push_back({ step, step, true, entry.path().string() });
+        }
+        else if (std::sscanf(name.c_str(), "delta_%llu.ckp%c", &step, &tail) == 2 && tail == 'd' && name.size() == 21) {
+            // the base step is only known from the header
+            mapped_file file;
+            checkpoint_delta_header header;
+            if (file.open(entry.path().string()) && read_delta_header(file, name, header)) {
+                frames.push_back({ step, header.base_step, false, entry.path().string() });
+            }
+        }
+    }
+    std::sort(frames.begin(), frames.end(), [](const checkpoint_frame& a, const checkpoint_frame& b) {
+        return a.step != b.step ? a.step < b.step : a.is_base > b.is_base;
+    });
+    return frames;
+}
+
+bool restore_checkpoint_frame(const std::string& dir, uint64_t step, std::vector<particle>& p, voxel_field& V) {
+    std::vector<checkpoint_frame> frames = list_checkpoint_frames(dir);
+    const checkpoint_frame* target = nullptr;
+    for (const checkpoint_frame& f : frames) {
+        if (f.step == step) {
+            target = &f;
+            break;
+        }
+    }
+    if (target == nullptr) {
+        std::cout << "checkpoint: no checkpoint of step " << step << " in " << dir << std::endl;
+        return false;
+    }
+    if (target->is_base) {
+        return load_checkpoint(target->path, p, V);
+    }
+    // load the nearest base, i.e. the base of the chain, then replay the deltas in order
+    if (!load_checkpoint(base_checkpoint_path(dir, target->base_step), p, V)) {
+        return false;
+    }
+    uint64_t previous = target->base_step;
+    for (const checkpoint_frame& f : frames) {
+        if (f.is_base || f.base_step != target->base_step || f.step > step) {
+            continue;
+        }
+        mapped_file file;
+        checkpoint_delta_header header;
+        if (!file.open(f.path) || !read_delta_header(file, f.path, header)) {
+            return false;
+        }
+        if (header.previous_step != previous) {
+            std::cout << "checkpoint: chain of base " << target->base_step << " has a hole before step " << f.step << std::endl;
+            return false;
+        }
+        file.close();
+        if (!apply_checkpoint_delta(f.path, p, V)) {
+            return false;
+        }
+        previous = f.step;
+    }
+    return true;
+}
+
+bool restore_latest_checkpoint_frame(const std::string& dir, std::vector<particle>& p, voxel_field& V) {
+    std::vector<checkpoint_frame> frames = list_checkpoint_frames(dir);
+    if (frames.empty()) {
+        std::cout << "checkpoint: no checkpoint in " << dir << std::endl;
+        return false;
+    }
+    return restore_checkpoint_frame(dir, frames.back().step, p, V);
+}
+
+
+incremental_checkpointer::incremental_checkpointer(const std::string& dir, int deltas_per_base, int kept_chains)
+    : dir(dir), deltas_per_base(deltas_per_base), kept_chains(kept_chains) {
+}
+
+incremental_checkpointer::~incremental_checkpointer() {
+    wait();
+}
+
+bool incremental_checkpointer::request(const std::vector<particle>& p, voxel_field& V) {
+    if (writing.load()) {
+        return false;
+    }
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (chain_broken.exchange(false)) {
+        has_base = false;
+    }
+    std::filesystem::create_directories(dir);
+
+    if (!has_base || chain_length >= deltas_per_base) {
+        // compaction: start a new chain with a full checkpoint, everything dirty so far is part of it
+        V.collect_dirty_bricks(dirty_cursor);
+        take_simulation_snapshot(base_snapshot, p, V);
+        has_base = true;
+        base_step = base_snapshot.step;
+        last_step = base_step;
+        chain_length = 0;
+        writing = true;
+        worker = std::thread([this]() {
+            memory_scope memory(MEMORY_RECORDING);
+            std::string path = base_checkpoint_path(dir, base_snapshot.step);
+            if (write_checkpoint(path, base_snapshot)) {
+                prune_chains();
+            }
+            else {
+                chain_broken = true;
+            }
+            writing = false;
+        });
+        return true;
+    }
+
+    std::vector<int> bricks = V.collect_dirty_bricks(dirty_cursor);
+    take_brick_delta_snapshot(delta_snapshot, bricks, p, V);
+    delta_snapshot.base_step = base_step;
+    delta_snapshot.previous_step = last_step;
+    last_step = delta_snapshot.state.step;
+    chain_length++;
+    writing = true;
+    worker = std::thread([this]() {
+        memory_scope memory(MEMORY_RECORDING);
+        if (!write_checkpoint_delta(delta_checkpoint_path(dir, delta_snapshot.state.step), delta_snapshot)) {
+            chain_broken = true;
+        }
+        writing = false;
+    });
+    return true;
+}
+
+void incremental_checkpointer::restart_chain() {
+    wait();
+    has_base = false;
+}
+
+bool incremental_checkpointer::busy() const {
+    return writing.load();
+}
+
+void incremental_checkpointer::wait() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+// remove the oldest chains (base + its deltas) so only 'kept_chains' stay on disk
+void incremental_checkpointer::prune_chains() {
+    std::vector<checkpoint_frame> frames = list_checkpoint_frames(dir);
+    std::vector<uint64_t> bases;
+    for (const checkpoint_frame& f : frames) {
+        if (f.is_base) {
+            bases.push_back(f.step);
+        }
+    }
+    if (int(bases.size()) <= kept_chains) {
+        return;
+    }
+    uint64_t oldest_kept = bases[bases.size() - kept_chains];
+    for (const checkpoint_frame& f : frames) {
+        if (f.base_step < oldest_kept) {
+            std::error_code ec;
+            std::filesystem::remove(f.path, ec);
+        }
+    }
+}
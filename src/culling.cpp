@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cstring>
+
+#include <culling.h>
+#include <render_data.h>
+#include <memory_tracker.h>
+
+
+bool view_frustum::visible(const glm::vec3& lo, const glm::vec3& hi) const {
+    // the corner of the box farthest along each plane normal, when even that one is outside, the whole box is
+    for (const glm::vec4& plane : planes) {
+        glm::vec3 corner(plane.x >= 0.0f ? hi.x : lo.x, plane.y >= 0.0f ? hi.y : lo.y, plane.z >= 0.0f ? hi.z : lo.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+            return false;
+        }
+    }
+    if (max_distance > 0.0f) {
+        glm::vec3 nearest = glm::clamp(eye, lo, hi);
+        if (glm::dot(nearest - eye, nearest - eye) > max_distance * max_distance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+view_frustum make_view_frustum(const glm::mat4& projection, const glm::mat4& view, const glm::vec3& eye, float max_distance) {
+    // the planes are sums and differences of the rows of the matrix (glm is column major, m[column][row])
+    glm::mat4 m = projection * view;
+    glm::vec4 row[4];
+    for (int r = 0; r < 4; r++) {
+        row[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    }
+    view_frustum frustum;
+    frustum.planes[0] = row[3] + row[0]; // left
+    frustum.planes[1] = row[3] - row[0]; // right
+    frustum.planes[2] = row[3] + row[1]; // bottom
+    frustum.planes[3] = row[3] - row[1]; // top
+    frustum.planes[4] = row[3] + row[2]; // near
+    frustum.planes[5] = row[3] - row[2]; // far
+    for (glm::vec4& plane : frustum.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    frustum.eye = eye;
+    frustum.max_distance = max_distance;
+    return frustum;
+}
+
+
+cull_grid::cull_grid(int x_size, int y_size, int z_size) {
+    const int b = voxel_field::brick_size;
+    x_num = (x_size + b - 1) / b;
+    y_num = (y_size + b - 1) / b;
+    z_num = (z_size + b - 1) / b;
+}
+
+int cull_grid::cell_of(const glm::vec3& world) const {
+    // voxel (x, y, z) is the cube of voxel_size_scale around voxel_to_world(x, y, z)
+    const int b = voxel_field::brick_size;
+    glm::vec3 origin(voxel_x_origin, voxel_y_origin, voxel_z_origin);
+    glm::vec3 index = glm::floor((world - origin) / voxel_size_scale + 0.5f) / float(b);
+    int x = std::min(std::max(int(std::floor(index.x)), 0), x_num - 1);
+    int y = std::min(std::max(int(std::floor(index.y)), 0), y_num - 1);
+    int z = std::min(std::max(int(std::floor(index.z)), 0), z_num - 1);
+    return (x * y_num + y) * z_num + z;
+}
+
+void cull_grid::bounds(int cell, glm::vec3& lo, glm::vec3& hi) const {
+    const int b = voxel_field::brick_size;
+    // far enough to hold anything that can leave the field, finite so the plane tests stay numbers
+    const float outside = 1.0e6f;
+    int cx = cell / (y_num * z_num), cy = (cell / z_num) % y_num, cz = cell % z_num;
+    glm::vec3 half(voxel_size_scale / 2);
+    lo = voxel_to_world(cx * b, cy * b, cz * b) - half;
+    hi = voxel_to_world(cx * b + b - 1, cy * b + b - 1, cz * b + b - 1) + half;
+    int c[3] = { cx, cy, cz }, num[3] = { x_num, y_num, z_num };
+    for (int axis = 0; axis < 3; axis++) {
+        if (c[axis] == 0) {
+            lo[axis] = -outside;
+        }
+        if (c[axis] == num[axis] - 1) {
+            hi[axis] = outside;
+        }
+    }
+}
+
+
+// the slots of the voxel instances in visible cells, in slot order
+static void compact_voxel_slots(const voxel_instance_data& voxels, const cull_grid& grid, frame_culling& culling) {
+    culling.voxel_slots.clear();
+    for (int slot = 0; slot < voxels.count; slot++) {
+        const GLfloat* instance = &voxels.data[size_t(slot) * 6];
+        if (culling.visible_cells[grid.cell_of(glm::vec3(instance[0], instance[1], instance[2]))]) {
+            culling.voxel_slots.push_back(slot);
+        }
+    }
+}
+
+void cull_frame(const render_snapshot& frame, const view_frustum& frustum, frame_culling& culling) {
+    memory_scope memory(MEMORY_RENDER);
+    const particle_instance_data& particles = frame.particles;
+    const cull_grid& grid = particles.cells;
+    int cell_count = grid.cell_count();
+    cull_stats& stats = culling.stats;
+    stats = cull_stats();
+    stats.cells = cell_count;
+    stats.voxels = frame.voxels.count;
+    stats.particles = particles.count;
+
+    // a particle is drawn as a sphere around its position, a little larger with the outline
+    const float margin = particle_render_scale * 1.05f;
+    culling.visible_cells.resize(cell_count);
+    for (int c = 0; c < cell_count; c++) {
+        glm::vec3 lo, hi;
+        grid.bounds(c, lo, hi);
+        culling.visible_cells[c] = !CULLING || frustum.visible(lo - margin, hi + margin);
+    }
+    stats.visible_cells = int(std::count(culling.visible_cells.begin(), culling.visible_cells.end(), 1));
+
+    // the place of the particles of each visible cell in the compacted instances
+    culling.particle_offset.resize(cell_count);
+    int next = 0;
+    for (int c = 0; c < cell_count && c + 1 < int(particles.cell_begin.size()); c++) {
+        culling.particle_offset[c] = next;
+        if (culling.visible_cells[c]) {
+            next += particles.cell_begin[c + 1] - particles.cell_begin[c];
+        }
+    }
+    stats.visible_particles = next;
+
+    if (CULLING && cell_count > 0) {
+        compact_voxel_slots(frame.voxels, grid, culling);
+    } else {
+        culling.voxel_slots.clear();
+    }
+    stats.visible_voxels = CULLING && cell_count > 0 ? int(culling.voxel_slots.size()) : frame.voxels.count;
+
+    culling.visible_chunks.assign(frame.terrain.size(), 0);
+    for (size_t c = 0; c < frame.terrain.size(); c++) {
+        const std::shared_ptr<const chunk_mesh>& mesh = frame.terrain[c];
+        if (mesh && !mesh->indices.empty()) {
+            stats.chunks++;
+            culling.visible_chunks[c] = !CULLING || frustum.visible(mesh->lo, mesh->hi);
+            stats.visible_chunks += culling.visible_chunks[c];
+        }
+    }
+}
+
+void copy_visible_particles(const particle_instance_data& instances, const frame_culling& culling, GLfloat* out) {
+    int cell_count = int(culling.visible_cells.size());
+    for (int c = 0; c < cell_count; c++) {
+        if (!culling.visible_cells[c]) {
+            continue;
+        }
+        int begin = instances.cell_begin[c], end = instances.cell_begin[c + 1];
+        std::memcpy(out + size_t(culling.particle_offset[c]) * 6, instances.data.data() + size_t(begin) * 6, sizeof(GLfloat) * 6 * (end - begin));
+    }
+}
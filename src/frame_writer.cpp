@@ -0,0 +1,131 @@
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+#include "FreeImage.h"
+#include <frame_writer.h>
+#include <memory_tracker.h>
+
+
+frame_writer::frame_writer(const std::string& _pattern, frame_format _format, int threads, int _queue_size)
+    : pattern(_pattern), format(_format), queue_size(std::max(_queue_size, 1)) {
+    threads = std::max(threads, 1);
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(&frame_writer::work, this);
+    }
+}
+
+frame_writer::~frame_writer() {
+    drain();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    has_work.notify_all();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+
+std::vector<uint8_t> frame_writer::acquire(unsigned int w, unsigned int h) {
+    std::vector<uint8_t> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!pool.empty()) {
+            buffer = std::move(pool.back());
+            pool.pop_back();
+        }
+    }
+    buffer.resize(size_t(w) * h * 4);
+    return buffer;
+}
+
+void frame_writer::submit(std::vector<uint8_t>&& pixels, unsigned int w, unsigned int h) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queue.size() >= queue_size) {
+        auto start = std::chrono::steady_clock::now();
+        has_space.wait(lock, [this] { return queue.size() < queue_size; });
+        stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    queue.push_back({ std::move(pixels), w, h, next_index++ });
+    lock.unlock();
+    has_work.notify_one();
+}
+
+void frame_writer::drain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return queue.empty() && in_progress == 0; });
+}
+
+int frame_writer::frames_failed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+void frame_writer::work() {
+    memory_scope memory(MEMORY_RECORDING);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        has_work.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return; // stopping, and nothing left
+        }
+        frame f = std::move(queue.front());
+        queue.pop_front();
+        in_progress++;
+        lock.unlock();
+        has_space.notify_one();
+
+        bool ok = save(f);
+
+        lock.lock();
+        if (!ok) {
+            failed++;
+        }
+        pool.push_back(std::move(f.pixels));
+        in_progress--;
+        if (queue.empty() && in_progress == 0) {
+            idle.notify_all();
+        }
+    }
+}
+
+bool frame_writer::save(const frame& f) {
+    char filename[256];
+    std::snprintf(filename, sizeof(filename), pattern.c_str(), f.index);
+    std::string path = filename;
+
+    if (format == FRAME_FORMAT_RAW) {
+        path += ".bgra";
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            std::cout << "frame writer: cannot open " << path << std::endl;
+            return false;
+        }
+        bool ok = std::fwrite(f.pixels.data(), 1, f.pixels.size(), file) == f.pixels.size();
+        ok = std::fclose(file) == 0 && ok;
+        return ok;
+    }
+
+    // wrap the buffer without copying it, the rows are bottom-up like glReadPixels returns them
+    FIBITMAP* bitmap = FreeImage_ConvertFromRawBitsEx(FALSE, const_cast<BYTE*>(f.pixels.data()), FIT_BITMAP, f.w, f.h, f.w * 4, 32,
+                                                      FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+    if (bitmap == nullptr) {
+        return false;
+    }
+    bool ok;
+    if (format == FRAME_FORMAT_BMP) {
+        path += ".bmp";
+        ok = FreeImage_Save(FIF_BMP, bitmap, path.c_str(), BMP_DEFAULT);
+    }
+    else {
+        path += ".png";
+        ok = FreeImage_Save(FIF_PNG, bitmap, path.c_str(), format == FRAME_FORMAT_PNG_FAST ? PNG_Z_BEST_SPEED : PNG_DEFAULT);
+    }
+    FreeImage_Unload(bitmap);
+    if (!ok) {
+        std::cout << "frame writer: cannot save " << path << std::endl;
+    }
+    return ok;
+}
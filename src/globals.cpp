@@ -0,0 +1,53 @@
+#include <data_structures.h>
+
+
+// globals shared by the simulation and the render code, kept out of main.cpp so that tools (e.g. the benchmarks)
+// can link the simulation without the application
+// the sizes are constant-initialized, so they are set before main.cpp constructs its fields during dynamic initialization
+
+// some color setting in data_structures
+glm::vec4 red = glm::vec4(1.f, 0.f, 0.f, 1.0f);
+glm::vec4 dark_red = glm::vec4(0.5f, 0.f, 0.f, 1.0f);
+glm::vec4 soil_color = glm::vec4(0.65f, 0.45f, 0.15f, 1.0f);
+glm::vec4 yellow = glm::vec4(1.f, 1.f, 0.f, 1.0f);
+glm::vec4 green = glm::vec4(0.f, 1.f, 0.f, 1.0f);
+glm::vec4 blue = glm::vec4(0.f, 0.f, 1.f, 1.0f);
+glm::vec4 black = glm::vec4(0.f, 0.f, 0.f, 1.0f);
+glm::vec4 cube_color = glm::vec4(0.4f, 0.4f, 1.f, 1.0f);
+glm::vec4 cube_edge_color = glm::vec4(0.8f, 0.8f, 1.f, 1.0f);
+glm::vec4 boundary_color = glm::vec4(0.2f, 0.2f, 0.f, 1.0f);
+glm::vec4 particle_color = glm::vec4(0.2f, 0.4f, 0.8f, 0.3f);
+
+static constexpr float initial_voxel_size = 0.5f;
+static constexpr GLfloat initial_y_max = 30.0f;
+
+// boundary
+GLfloat x_max = VOXEL_FIELD_SIZE, x_min = 0.0f, y_max = initial_y_max, y_min = 0.0f, z_max = VOXEL_FIELD_SIZE, z_min = 0.0f;
+
+// this will adjust voxel size, the voxel size will be voxel_size_scale * 1
+extern const float voxel_size_scale = initial_voxel_size;
+
+// same as voxel_size_scale, but this will be used in speed up the particle calculation
+extern const float neighbour_grid_size = initial_voxel_size;
+
+// this will inicate the beginning of the voxel field(x=y=z=0) in world space
+extern const float voxel_x_origin = initial_voxel_size / 2;
+extern const float voxel_y_origin = initial_voxel_size / 2;
+extern const float voxel_z_origin = initial_voxel_size / 2;
+
+// voxel field
+int voxel_x_num = int(VOXEL_FIELD_SIZE / initial_voxel_size), voxel_y_num = int(initial_y_max / initial_voxel_size), voxel_z_num = int(VOXEL_FIELD_SIZE / initial_voxel_size);
+
+int current_particle_num;
+double simulation_elapsed_time = 0.0;
+unsigned long long simulation_step_count = 0;
+float particle_render_scale = particle_render_scale_maximum;
+
+
+void set_field_size(GLfloat horizontal_size) {
+    x_max = x_min + horizontal_size;
+    z_max = z_min + horizontal_size;
+    voxel_x_num = int((x_max - x_min) / voxel_size_scale);
+    voxel_y_num = int((y_max - y_min) / voxel_size_scale);
+    voxel_z_num = int((z_max - z_min) / voxel_size_scale);
+}
@@ -0,0 +1,47 @@
+#include <algorithm>
+
+#include <instance_ring.h>
+
+
+void instance_ring::set_up(size_t bytes) {
+    if (VBO == 0) {
+        glGenBuffers(1, &VBO);
+    }
+    for (GLsync& f : fences) {
+        if (f) {
+            glDeleteSync(f);
+            f = nullptr;
+        }
+    }
+    region_bytes = bytes;
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(region_bytes * regions), nullptr, GL_STREAM_DRAW);
+}
+
+void* instance_ring::begin_write(size_t bytes) {
+    if (bytes > region_bytes) {
+        // a new store, the draws still reading the old one keep it alive
+        set_up(bytes + bytes / 2);
+    }
+    current = (current + 1) % regions;
+    GLsync& f = fences[current];
+    if (f) {
+        // almost always signaled already, a full second means the GPU is gone, write anyway
+        glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(f);
+        f = nullptr;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    return glMapBufferRange(GL_ARRAY_BUFFER, GLintptr(region_bytes * current), GLsizeiptr(std::max(bytes, size_t(1))),
+                            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+size_t instance_ring::end_write() {
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    return region_bytes * current;
+}
+
+void instance_ring::fence() {
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
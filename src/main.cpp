@@ -17,6 +17,10 @@
 #include <unordered_map>
 #include <chrono>
 #include <list>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "offscreen.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
@@ -28,23 +32,31 @@
 #include "imgui/imgui_impl_opengl3.h"
 
 #include <data_structures.h>
-
-#include <omp.h>
-
-int numThreads = 8; // 指定线程数量
-
-// some color setting in data_structures
-extern glm::vec4 red = glm::vec4(1.f, 0.f, 0.f, 1.0f);
-extern glm::vec4 dark_red = glm::vec4(0.5f, 0.f, 0.f, 1.0f);
-extern glm::vec4 soil_color = glm::vec4(0.65f, 0.45f, 0.15f, 1.0f);
-extern glm::vec4 yellow = glm::vec4(1.f, 1.f, 0.f, 1.0f);
-extern glm::vec4 green = glm::vec4(0.f, 1.f, 0.f, 1.0f);
-extern glm::vec4 blue = glm::vec4(0.f, 0.f, 1.f, 1.0f);
-extern glm::vec4 black = glm::vec4(0.f, 0.f, 0.f, 1.0f);
-extern glm::vec4 cube_color = glm::vec4(0.4f, 0.4f, 1.f, 1.0f);
-extern glm::vec4 cube_edge_color = glm::vec4(0.8f, 0.8f, 1.f, 1.0f);
-extern glm::vec4 boundary_color = glm::vec4(0.2f, 0.2f, 0.f, 1.0f);
-extern glm::vec4 particle_color = glm::vec4(0.2f, 0.4f, 0.8f, 0.3f);
+#include <checkpoint.h>
+#include <trajectory.h>
+#include <replay.h>
+#include <profiler.h>
+#include <perf_counters.h>
+#include <memory_tracker.h>
+#include <thread_config.h>
+#include <numa_placement.h>
+#include <task_graph.h>
+#include <render_data.h>
+#include <voxel_mesh.h>
+#include <triple_buffer.h>
+#include <command_queue.h>
+#include <instance_ring.h>
+#include <culling.h>
+#include <terrain_generator.h>
+
+// simulation threads, 0 picks them from the cpu topology: one per physical core, pinned, with the per-phase counts of
+// THREAD_CONFIG_FILE if it exists (written by sph_erosion_golden --scaling max --write-thread-config thread_config.txt)
+#ifndef THREADS
+#define THREADS 0
+#endif
+#ifndef THREAD_CONFIG_FILE
+#define THREAD_CONFIG_FILE "thread_config.txt"
+#endif
 
 // some debug shit
 unsigned int global_cube_VBO[2];
@@ -77,7 +89,6 @@ bool firstMouse = true;
 float deltaTime = 0.0f; // time between current frame and last frame
 float lastFrame = 0.0f;
 float LastTime = 0.0f;
-bool is_realtime = true; // the current simulation is in real time or not
 float average_fps = 0.0f;
 float sliding_deltaTime = 0.0f;
 const int num_frames_to_average = 100;
@@ -86,48 +97,416 @@ std::list<float> frameTime_list;
 
 bounding_box boundary = bounding_box(x_max, x_min, y_max, y_min, z_max, z_min);
 
-// voxel field
-extern int voxel_x_num = (x_max - x_min) / voxel_size_scale, voxel_y_num =
-        (y_max - y_min) / voxel_size_scale, voxel_z_num = (z_max - z_min) / voxel_size_scale;
-
-// this will adjust voxel size, the voxel size will be voxel_size_scale * 1
-extern const float voxel_size_scale = 0.5;
-
-// same as voxel_size_scale, but this will be used in speed up the particle calculation
-extern const float neighbour_grid_size = voxel_size_scale;
-
-// this will inicate the beginning of the voxel field(x=y=z=0) in world space
-extern const float voxel_x_origin = voxel_size_scale / 2;
-extern const float voxel_y_origin = voxel_size_scale / 2;
-extern const float voxel_z_origin = voxel_size_scale / 2;
-
+// voxel field, its size and the other simulation globals are in globals.cpp
 voxel_field V = voxel_field(voxel_x_num, voxel_y_num, voxel_z_num);
 int neighbour_grid_x_num = voxel_x_num;
 int neighbour_grid_y_num = voxel_y_num;
 int neighbour_grid_z_num = voxel_z_num;
 neighbourhood_grid G = neighbourhood_grid(neighbour_grid_x_num, neighbour_grid_y_num, neighbour_grid_z_num);
 
-int current_particle_num;
-float particle_render_scale = particle_render_scale_maximum;
-
-// particle set
-std::vector<particle> particles(particle_num);
+// particle set, allocated in main() so it is charged to MEMORY_PARTICLES
+std::vector<particle> particles;
 
 // particle simulation parameters
 bool time_stop = true;
-bool regenerate = false;
 // tracking space key press
 bool isSpaceKeyPressed = false;
 bool isRightKeyPressed = false;
 bool isDownKeyPressed = false;
 bool isUpKeyPressed = false;
+bool isSaveKeyPressed = false;
+bool isLoadKeyPressed = false;
+bool isLoadIncrementalKeyPressed = false;
+bool isProfilerKeyPressed = false;
+bool isTraceKeyPressed = false;
+bool isImpostorKeyPressed = false;
 bool next_frame_request = false;
+bool show_profiler = !g_use_offscreen; // F3 toggles the profiler panel
+
+// PARTICLE_IMPOSTORS=1 starts with the particles drawn as ray cast impostors instead of sphere meshes, F6 switches,
+// the impostors farther than PARTICLE_LOD_DISTANCE from the camera (0 = none) are flat discs
+#ifndef PARTICLE_IMPOSTORS
+#define PARTICLE_IMPOSTORS 0
+#endif
+#ifndef PARTICLE_LOD_DISTANCE
+#define PARTICLE_LOD_DISTANCE 8.0f
+#endif
+bool particle_impostors = PARTICLE_IMPOSTORS;
 
 // the set of particles that will be recycled, updated every frame
 std::vector<int> recycle_list;
 
-int main() {
-    omp_set_num_threads(numThreads); // 设置线程数量
+// checkpoint/restart, F5 saves and F9 restores a full checkpoint
+// CHECKPOINT_INTERVAL > 0 also writes an incremental checkpoint (base + dirty brick deltas) every N simulation steps,
+// F8 restores the most recent one of those
+#ifndef CHECKPOINT_INTERVAL
+#define CHECKPOINT_INTERVAL 0
+#endif
+#ifndef CHECKPOINT_DELTAS_PER_BASE
+#define CHECKPOINT_DELTAS_PER_BASE 30
+#endif
+const std::string checkpoint_dir = "checkpoint";
+const std::string checkpoint_path = checkpoint_dir + "/latest.ckpt";
+const std::string incremental_checkpoint_dir = checkpoint_dir + "/chain";
+checkpoint_writer checkpointer;
+incremental_checkpointer incremental_checkpoints(incremental_checkpoint_dir, CHECKPOINT_DELTAS_PER_BASE);
+
+// PROFILE_CSV=1 writes the per-phase timings of every frame to out/profile.csv from the start,
+// otherwise the CSV is recorded with the button in the profiler panel
+#ifndef PROFILE_CSV
+#define PROFILE_CSV 0
+#endif
+
+// PERF_COUNTERS=1 enables the hardware counters (Linux) from the start, otherwise with the button in the profiler panel
+#ifndef PERF_COUNTERS
+#define PERF_COUNTERS 0
+#endif
+
+// timeline tracing, F4 writes a Chrome trace of the next TRACE_FRAMES frames to out/trace_*.json,
+// TRACE_SLOW_FRAME_MS > 0 records all the time and writes the last TRACE_FRAMES frames whenever a frame is slower than that
+#ifndef TRACE_FRAMES
+#define TRACE_FRAMES 10
+#endif
+#ifndef TRACE_SLOW_FRAME_MS
+#define TRACE_SLOW_FRAME_MS 0
+#endif
+
+// RECORD_TRAJECTORY=1 streams the particle positions of every simulation step to out/trajectory.sphtraj and the changed
+// voxel bricks to out/voxels.sphvox, which is what the replay mode renders, RECORD_TRAJECTORY_MASS=1 also stores the particle mass
+#ifndef RECORD_TRAJECTORY
+#define RECORD_TRAJECTORY 0
+#endif
+#ifndef RECORD_TRAJECTORY_MASS
+#define RECORD_TRAJECTORY_MASS 0
+#endif
+const std::string recording_dir = "out";
+trajectory_writer trajectory;
+voxel_stream_writer voxel_recording;
+
+// replay mode (--replay <dir> [--camera <file>]): render a recording instead of simulating
+bool replaying = false;
+replay_source replay;
+camera_script replay_camera;
+double replay_time = 0.0;
+
+// the terrain of the voxel field, --terrain <file> changes its noise, seed and size (terrain_generator.h)
+terrain_config terrain_generation;
+
+// snapshot the state and write it in the background
+void save_checkpoint() {
+    memory_scope memory(MEMORY_RECORDING);
+    std::filesystem::create_directories(checkpoint_dir);
+    if (!checkpointer.request(checkpoint_path, particles, V)) {
+        std::cout << "checkpoint skipped, previous one is still being written" << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------simulation thread------------------------------------------------------
+// the simulation runs on its own thread, which owns particles, V, G, recycle_list, the recordings and the checkpoints
+// after every step it publishes a render_snapshot (instance data of particles and voxels, step, timings) through a
+// triple buffer, and the render loop draws the latest one, so a slow step no longer stalls the window and the GPU
+// draws the previous step while the next one is computed
+// the render loop controls it with commands on a lock-free queue (processInput and the pause state of the frame)
+// with OFFLINE_RENDERING it runs in lock step: one step per rendered frame, the frame waits for it
+
+enum sim_command : int {
+    SIM_PAUSE,
+    SIM_RESUME,
+    SIM_STEP,               // one step; while running only in lock step, where it is the step of the frame
+    SIM_REGENERATE,
+    SIM_SAVE_CHECKPOINT,
+    SIM_LOAD_CHECKPOINT,
+    SIM_LOAD_INCREMENTAL_CHECKPOINT,
+    SIM_QUIT,
+};
+
+command_queue<sim_command, 64> sim_commands;
+triple_buffer<render_snapshot> snapshots;
+// the step of the last published snapshot, for the lock step frame to sleep on until its step is there
+std::mutex published_mutex;
+std::condition_variable published_changed;
+int published_step = 0;
+std::thread simulation;
+const bool sim_lockstep = g_use_offscreen;
+const float sim_step_dt = 0.0167f;
+
+// from the render loop, dropped when the queue is full (the simulation thread is stuck in a long step),
+// like a key press during a frame that did not poll the keys
+bool send_command(sim_command command) {
+    if (replaying || !simulation.joinable()) {
+        return false;
+    }
+    return sim_commands.push(command);
+}
+
+// a step is a task graph: the passes (add_step_tasks) and the work of the frame that only needs part of their results,
+// which the helper threads of the graph do while the simulation thread goes on with the passes:
+// the voxel instances and the voxel recording only need the voxels after erosion and overlap recycle, the trajectory
+// overlaps the particle instances (filled in parallel, so on the calling thread) and the grid build of the next step,
+// which is done at the end of this one
+task_graph step_graph;
+float step_dt = 0.0f;
+// G already holds the grid of the current positions, cleared whenever the particles change outside of a step
+bool grid_current = false;
+int grid_particle_num = 0;
+// the voxel instances, only the changed voxels are rescanned every step (render_data.h)
+voxel_instance_table voxel_instances;
+// with TERRAIN_MESH the chunk meshes instead, only the changed chunks are meshed again (voxel_mesh.h)
+terrain_mesh terrain;
+
+void build_step_graph() {
+    add_step_tasks(step_graph, particles, step_dt, V, G, recycle_list, grid_current);
+    if (TERRAIN_MESH) {
+        // meshes the chunks in parallel, so on the thread whose team is pinned
+        step_graph.add("terrain mesh", [] {
+            profile_scope scope(PHASE_INSTANCE_BUILD);
+            render_snapshot& snapshot = snapshots.back();
+            snapshot.remeshed_chunks = terrain.update(V);
+            snapshot.terrain = terrain.meshes();
+        }, DATA_VOXELS, DATA_VOXEL_STAMPS, TASK_CALLER_THREAD);
+    } else {
+        step_graph.add("voxel instances", [] {
+            profile_scope scope(PHASE_INSTANCE_BUILD);
+            memory_scope memory(MEMORY_RENDER);
+            voxel_instances.update(V);
+            voxel_instances.copy_to(snapshots.back().voxels);
+        }, DATA_VOXELS, DATA_VOXEL_STAMPS);
+    }
+    if (RECORD_TRAJECTORY) {
+        step_graph.add("voxel recording", [] {
+            memory_scope memory(MEMORY_RECORDING);
+            voxel_recording.write_frame(V, simulation_step_count, simulation_elapsed_time);
+        }, DATA_VOXELS, DATA_VOXEL_STAMPS);
+        step_graph.add("trajectory", [] {
+            memory_scope memory(MEMORY_RECORDING);
+            // serially: on a helper a team of its own would compete with the pinned team of the passes
+            trajectory.write_frame(particles, current_particle_num, simulation_elapsed_time, 1);
+        }, DATA_POSITIONS | DATA_MASS, 0);
+    }
+    step_graph.add("particle instances", [] {
+        profile_scope scope(PHASE_INSTANCE_BUILD);
+        memory_scope memory(MEMORY_RENDER);
+        int count = std::min(current_particle_num, (int)particles.size());
+        build_particle_instance_data(particles, count, cull_grid(V.x_size, V.y_size, V.z_size), snapshots.back().particles);
+    }, DATA_POSITIONS | DATA_MASS, 0, TASK_CALLER_THREAD);
+    step_graph.add("next grid build", [] {
+        memory_scope memory(MEMORY_SIMULATION);
+        grid_particle_num = std::min(current_particle_num, (int)particles.size());
+        build_neighbour_grid(particles, grid_particle_num, G);
+        grid_current = true;
+    }, DATA_POSITIONS, DATA_GRID, TASK_CALLER_THREAD);
+}
+
+// one simulation step with time step 'dt'
+void step_simulation(float dt) {
+    if (step_graph.task_count() == 0) {
+        build_step_graph();
+    }
+    if (RECORD_TRAJECTORY && !trajectory.is_open()) {
+        memory_scope memory(MEMORY_RECORDING);
+        std::filesystem::create_directories(recording_dir);
+        trajectory.open(recording_dir + "/" + replay_trajectory_file, boundary, RECORD_TRAJECTORY_MASS);
+        voxel_recording.open(recording_dir + "/" + replay_voxel_file, V);
+    }
+    // particles were added since the grid was built
+    if (grid_particle_num != std::min(current_particle_num, (int)particles.size())) {
+        grid_current = false;
+    }
+    step_dt = dt;
+    // the recording tasks write the frame with the time and step count after this step
+    simulation_elapsed_time += dt;
+    simulation_step_count++;
+    {
+        profile_scope scope(PHASE_STEP);
+        step_graph.run();
+    }
+    global_profiler.add(PHASE_CRITICAL_PATH, uint64_t(step_graph.timings().critical_path));
+
+    memory_scope memory(MEMORY_RECORDING);
+    if (CHECKPOINT_INTERVAL > 0 && simulation_step_count % CHECKPOINT_INTERVAL == 0) {
+        if (!incremental_checkpoints.request(particles, V)) {
+            std::cout << "incremental checkpoint skipped, previous one is still being written" << std::endl;
+        }
+    }
+}
+
+// the snapshot of the current state without a step (start up, paused after regenerate or a restored checkpoint, replay)
+void publish_snapshot(bool realtime) {
+    render_snapshot& snapshot = snapshots.back();
+    snapshot.step = simulation_step_count;
+    snapshot.time = simulation_elapsed_time;
+    snapshot.particle_num = current_particle_num;
+    snapshot.realtime = realtime;
+    snapshot.step_timings = step_graph.timings();
+    snapshots.publish();
+    {
+        std::lock_guard<std::mutex> lock(published_mutex);
+        published_step = snapshot.step;
+    }
+    published_changed.notify_all();
+}
+
+void build_snapshot_instances() {
+    profile_scope scope(PHASE_INSTANCE_BUILD);
+    memory_scope memory(MEMORY_RENDER);
+    render_snapshot& snapshot = snapshots.back();
+    int count = std::min(current_particle_num, (int)particles.size());
+    build_particle_instance_data(particles, count, cull_grid(V.x_size, V.y_size, V.z_size), snapshot.particles);
+    if (TERRAIN_MESH) {
+        snapshot.remeshed_chunks = terrain.update(V);
+        snapshot.terrain = terrain.meshes();
+    } else {
+        voxel_instances.update(V);
+        voxel_instances.copy_to(snapshot.voxels);
+    }
+}
+
+// thread config, NUMA placement and the scene, on the thread that runs the simulation: apply_thread_config pins the
+// team of the calling thread, and the particles are first touched by that team
+void set_up_simulation(const cpu_topology& topology) {
+    apply_thread_config(THREADS > 0 ? fixed_thread_config(THREADS) : auto_thread_config(topology, THREAD_CONFIG_FILE), topology);
+    std::cout << topology.logical_cpus << " logical cpus, " << topology.physical_cores << " physical cores, "
+              << global_thread_config.max_threads() << " threads" << (global_thread_config.pin ? " pinned" : "") << std::endl;
+    if (numa_node_count() > 1) {
+        // the global fields were built before the threads were pinned, build them again so each socket first touches its slices
+        std::cout << numa_node_count() << " NUMA nodes" << std::endl;
+        V = voxel_field(voxel_x_num, voxel_y_num, voxel_z_num);
+        G = neighbourhood_grid(neighbour_grid_x_num, neighbour_grid_y_num, neighbour_grid_z_num);
+    }
+
+    // set up voxel field
+    set_up_voxel_field(V, voxel_density, terrain_generation);
+
+    // set up particles
+    {
+        memory_scope memory(MEMORY_PARTICLES);
+        first_touch_resize(particles, particle_num, global_thread_config.threads(PHASE_DENSITY));
+    }
+    set_up_SPH_particles(particles);
+}
+
+// a command that changes the particles or the voxels outside of a step, true if it did
+bool run_command(sim_command command) {
+    switch (command) {
+    case SIM_REGENERATE:
+        set_up_SPH_particles(particles);
+        // set_up_voxel_field(V, voxel_density);
+        G.clear_grid();
+        grid_current = false;
+        return true;
+    case SIM_SAVE_CHECKPOINT:
+        save_checkpoint();
+        return false;
+    case SIM_LOAD_CHECKPOINT:
+        // don't read the file while it is being replaced
+        checkpointer.wait();
+        if (load_checkpoint(checkpoint_path, particles, V)) {
+            G.clear_grid();
+            grid_current = false;
+            recycle_list.clear();
+            incremental_checkpoints.restart_chain();
+            std::cout << "checkpoint restored: step " << simulation_step_count << ", time " << simulation_elapsed_time << "s" << std::endl;
+            return true;
+        }
+        return false;
+    case SIM_LOAD_INCREMENTAL_CHECKPOINT:
+        incremental_checkpoints.wait();
+        if (restore_latest_checkpoint_frame(incremental_checkpoint_dir, particles, V)) {
+            G.clear_grid();
+            grid_current = false;
+            recycle_list.clear();
+            incremental_checkpoints.restart_chain();
+            std::cout << "incremental checkpoint restored: step " << simulation_step_count << ", time " << simulation_elapsed_time << "s" << std::endl;
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+void simulation_loop(cpu_topology topology) {
+    global_tracer.set_thread_name("simulation");
+    set_up_simulation(topology);
+    build_snapshot_instances();
+    publish_snapshot(true);
+
+    // running, one step per sim_step_dt of wall time (the frame rate of the vsynced loop it used to run in), or back to
+    // back when the steps are slower, which is when the simulation falls behind real time
+    const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(sim_step_dt));
+    auto last_step = std::chrono::steady_clock::now();
+    bool paused = true;
+    while (true) {
+        int steps = 0;
+        bool changed = false;
+        sim_command command;
+        while (sim_commands.pop(command)) {
+            if (command == SIM_QUIT) {
+                return;
+            }
+            if (command == SIM_PAUSE || command == SIM_RESUME) {
+                paused = command == SIM_PAUSE;
+            } else if (command == SIM_STEP) {
+                steps++;
+            } else {
+                changed |= run_command(command);
+            }
+        }
+
+        int count = paused || sim_lockstep ? steps : 1;
+        for (int n = 0; n < count; n++) {
+            if (!paused) {
+                if (!sim_lockstep) {
+                    std::this_thread::sleep_until(last_step + period);
+                }
+                // increase the number of particles gradually
+                if (current_particle_num < particle_num) {
+                    current_particle_num += 200;
+                }
+            }
+            last_step = std::chrono::steady_clock::now();
+            step_simulation(sim_step_dt);
+            publish_snapshot(std::chrono::steady_clock::now() - last_step <= period);
+        }
+        if (count == 0) {
+            if (changed) {
+                build_snapshot_instances();
+                publish_snapshot(true);
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    cpu_topology topology = detect_cpu_topology();
+
+    std::string replay_dir, camera_script_path;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--replay") {
+            replay_dir = argv[i + 1];
+        } else if (arg == "--camera") {
+            camera_script_path = argv[i + 1];
+        } else if (arg == "--terrain") {
+            if (!terrain_generation.load(argv[i + 1])) {
+                std::cout << "cannot read the terrain file " << argv[i + 1] << std::endl;
+            }
+        } else {
+            std::cout << "unknown argument " << arg << std::endl;
+        }
+    }
+
+    // the simulation sets itself up on its own thread while the window and the GL resources are created here
+    if (!replay_dir.empty()) {
+        replaying = replay.open(replay_dir);
+    }
+    if (replaying) {
+        set_up_simulation(topology);
+    } else {
+        simulation = std::thread(simulation_loop, topology);
+    }
 
     // glfw: initialize and configure
     // ------------------------------
@@ -200,12 +579,6 @@ int main() {
 
     // scene building----------------------
 
-    // set up voxel field
-    set_up_voxel_field(V, voxel_density);
-
-    // set up particles
-    set_up_SPH_particles(particles);
-
     // set up coordinate axes to render
     unsigned int coordi_VBO, coordi_VAO;
     set_up_CoordinateAxes(coordi_VBO, coordi_VAO);
@@ -216,6 +589,18 @@ int main() {
     unsigned int voxel_instance_VBO;
 
     set_up_cube_base_instance_rendering(cube_VBO, cube_VAO, voxel_instance_VBO);
+    voxel_gpu_state voxel_gpu;
+    // the same cubes, only the voxels in view
+    Shader culled_voxel_shader("../../shader/shader_voxel_culled.vs", "../../shader/shader_instance.fs");
+    culled_voxel_gl culled_voxels;
+    if (CULLING) {
+        set_up_culled_voxel_rendering(cube_VBO, voxel_instance_VBO, culled_voxels);
+    }
+    frame_culling culling;
+    // or the terrain as chunk meshes
+    Shader terrain_shader("../../shader/shader_terrain.vs", "../../shader/shader_terrain.fs");
+    std::vector<terrain_chunk_gl> terrain_chunks;
+    uint64_t terrain_upload_bytes = 0;
     // set_up_cube_base_rendering(cube_VBO, cube_VAO);
 
     // set up boundary
@@ -223,8 +608,14 @@ int main() {
     set_up_boundary_rendering(bound_VBO, bound_VAO, boundary);
 
     // set up sphere model and particle instance
-    unsigned int sphere_VBO, sphere_VAO, sphere_EBO, particle_instance_VBO;
-    set_up_particle_rendering(sphere_VBO, sphere_VAO, sphere_EBO, particle_instance_VBO);
+    unsigned int sphere_VBO, sphere_VAO, sphere_EBO;
+    instance_ring particle_instances;
+    set_up_particle_rendering(sphere_VBO, sphere_VAO, sphere_EBO, particle_instances);
+    // or as impostors
+    Shader impostor_shader("../../shader/shader_particle_impostor.vs", "../../shader/shader_particle_impostor.fs");
+    Shader disc_shader("../../shader/shader_particle_impostor.vs", "../../shader/shader_particle_disc.fs");
+    unsigned int impostor_VBO, impostor_VAO;
+    set_up_particle_impostor_rendering(impostor_VBO, impostor_VAO);
 
     // --------------------------------
 
@@ -265,20 +656,38 @@ int main() {
     std::cout << "voxel_damage_scale : " << voxel_damage_scale << std::endl;
     std::cout << "voxel_density : " << voxel_density << std::endl;
 
+    if (replaying) {
+        std::cout << "replaying " << replay.frame_count() << " frames (" << replay.duration() << "s) from " << replay_dir << std::endl;
+        replay.load_frame(0, particles, V);
+    }
+    if (!camera_script_path.empty() && replay_camera.load(camera_script_path)) {
+        replay_camera.apply(0.0, camera, particle_render_scale);
+    }
+
+    global_tracer.set_thread_name("main");
+    if (TRACE_SLOW_FRAME_MS > 0) {
+        global_tracer.set_slow_frame_trigger(TRACE_SLOW_FRAME_MS, TRACE_FRAMES);
+    }
+    if (PROFILE_CSV) {
+        std::filesystem::create_directories("out");
+        global_profiler.start_csv("out/profile.csv");
+    }
+    if (PERF_COUNTERS) {
+        global_perf_counters.enable();
+    }
+
     // render loop
+    bool first_frame = true;
     while (!glfwWindowShouldClose(window)) {
-        // increase the number of particles gradually
-        if (current_particle_num < particle_num && !time_stop) {
-            current_particle_num += 200;
-            // std::cout << "current particle num: " << current_particle_num << std::endl;
-        }
-
-        if (regenerate) {
-            regenerate = false;
-            set_up_SPH_particles(particles);
-            // set_up_voxel_field(V, voxel_density);
-            G.clear_grid();
+        // the previous frame's timers are all closed here
+        if (!first_frame) {
+            global_profiler.end_frame();
+            global_perf_counters.end_frame();
+            global_memory_tracker.end_frame();
+            global_tracer.end_frame(global_profiler.last(PHASE_FRAME));
         }
+        first_frame = false;
+        profile_scope frame_scope(PHASE_FRAME);
 
         // per-frame time logic
         // --------------------
@@ -288,53 +697,59 @@ int main() {
         float fps = 1.0f / deltaTime;
         LastTime += deltaTime;
 
+        // sliding window of frame timestamps, the average fps is frames per elapsed time over the window
         if (num_frames_in_sliding_window >= num_frames_to_average) {
             frameTime_list.pop_front();
-            frameTime_list.push_back(currentFrame);
         } else {
-            frameTime_list.push_back(fps);
             num_frames_in_sliding_window++;
         }
-        float average_fps =
-                1.0f * (num_frames_in_sliding_window - 1) / (frameTime_list.back() - frameTime_list.front());
+        {
+            memory_scope memory(MEMORY_UI);
+            frameTime_list.push_back(currentFrame);
+        }
+        if (num_frames_in_sliding_window > 1 && frameTime_list.back() > frameTime_list.front()) {
+            average_fps = 1.0f * (num_frames_in_sliding_window - 1) / (frameTime_list.back() - frameTime_list.front());
+        }
 
         // input
         // -----
         processInput(window);
 
-        if (!g_use_offscreen) {
-            // if physics calculation is too slow, we can use a fixed time step to avoid the simulation error
-            // caused by the time step is too large
-            if (deltaTime > 0.0167f) {
-                is_realtime = false;
-            } else {
-                is_realtime = true;
+        if (replaying) {
+            // no simulation, show the recorded frame of the current time instead
+            // offscreen frames advance by the fixed step of the recording, space pauses the interactive replay
+            if (g_use_offscreen) {
+                replay_time += 0.0167;
+            } else if (!time_stop) {
+                replay_time += deltaTime;
+            } else if (next_frame_request) {
+                replay_time += 0.0167;
             }
-        } else {
-            is_realtime = false;
-        }
-
-        // do the physics calculation here, this will be the bottleneck of the program
-        if (!time_stop) {
-            if (!is_realtime) {
-                calculate_SPH_movement(particles, 0.0167, V, G, recycle_list);
-                calculate_voxel_erosion(particles, 0.0167, V, G, recycle_list);
-                recycle_particle(particles, recycle_list);
-
-            } else {
-                calculate_SPH_movement(particles, deltaTime, V, G, recycle_list);
-                calculate_voxel_erosion(particles, deltaTime, V, G, recycle_list);
-                recycle_particle(particles, recycle_list);
+            replay.load_frame(replay.frame_at(replay_time), particles, V);
+            if (!replay_camera.empty()) {
+                replay_camera.apply(replay_time, camera, particle_render_scale);
             }
-
+            if (g_use_offscreen && replay_time > std::max(replay.duration(), replay_camera.duration())) {
+                glfwSetWindowShouldClose(window, true);
+            }
+            build_snapshot_instances();
+            publish_snapshot(deltaTime <= sim_step_dt);
         } else {
-            if (next_frame_request) {
-                calculate_SPH_movement(particles, 0.0167, V, G, recycle_list);
-                calculate_voxel_erosion(particles, 0.0167, V, G, recycle_list);
-                recycle_particle(particles, recycle_list);
-                next_frame_request = false;
+            // the physics runs on the simulation thread, tell it whether to run
+            static bool sent_time_stop = true;
+            if (time_stop != sent_time_stop && send_command(time_stop ? SIM_PAUSE : SIM_RESUME)) {
+                sent_time_stop = time_stop;
+            }
+            // lock step: the step of this frame, sleep until it is published instead of spinning a core next to the
+            // pinned simulation team
+            if (sim_lockstep && !time_stop && send_command(SIM_STEP)) {
+                int step = snapshots.latest().step;
+                std::unique_lock<std::mutex> lock(published_mutex);
+                published_changed.wait(lock, [step] { return published_step != step; });
             }
         }
+        // the latest finished step, unchanged until the next latest()
+        const render_snapshot& frame = snapshots.latest();
 
         next_frame_request = false;
 
@@ -353,13 +768,29 @@ int main() {
         // render_cube(ourShader, cube_VBO, cube_VAO, cube_position);
         // render_cube(ourShader, cube_VBO, cube_VAO, glm::translate(cube_position, glm::vec3(1.0f, 0.0f, 0.0f)));
 
+        // the cells and chunks in view of the camera, and the instances in them
+        {
+            profile_scope scope(PHASE_DRAW);
+            cull_frame(frame, camera_view_frustum(CULL_DISTANCE), culling);
+        }
+
         // render_voxel_field(V, ourShader, cube_VBO, cube_VAO);
-        render_voxel_field(V, instance_shader, cube_VBO, cube_VAO, voxel_instance_VBO);
+        if (TERRAIN_MESH) {
+            render_terrain_mesh(frame.terrain, culling.visible_chunks, terrain_shader, terrain_chunks, terrain_upload_bytes);
+        } else if (culled_voxels.supported) {
+            render_culled_voxel_field(frame.voxels, culling.voxel_slots, voxel_gpu, culled_voxel_shader, culled_voxels, voxel_instance_VBO);
+        } else {
+            render_voxel_field(frame.voxels, voxel_gpu, instance_shader, cube_VBO, cube_VAO, voxel_instance_VBO);
+        }
 
         render_boundary(ourShader, bound_VBO, bound_VAO);
 
         // render_SPH_particles(particles, ourShader, sphere_VBO, sphere_VAO, sphere_EBO);
-        render_SPH_particles(particles, instance_shader, sphere_VBO, sphere_VAO, sphere_EBO, particle_instance_VBO);
+        if (particle_impostors) {
+            render_SPH_particle_impostors(frame.particles, culling, impostor_shader, disc_shader, impostor_VAO, particle_instances, PARTICLE_LOD_DISTANCE);
+        } else {
+            render_SPH_particles(frame.particles, culling, instance_shader, sphere_VBO, sphere_VAO, sphere_EBO, particle_instances);
+        }
 
         // std::cout <<"pos"<< particles[d].currPos[0]<<" "<<          particles[d].currPos[1]<<" "<<          particles[d].currPos[2]<<std::endl;
         // std::cout <<"spd"<< particles[d].velocity[0] << " " <<      particles[d].velocity[1] << " " <<      particles[d].velocity[2] << std::endl;
@@ -381,18 +812,33 @@ int main() {
         if (ImGui::Begin("LOG", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize)) {
 
             ImGui::Text("FPS: %.1f \t AVG_FPS: %.1f", fps, average_fps);
-            ImGui::Text("IS_REALTIME: %s", is_realtime ? "TRUE" : "FALSE");
+            ImGui::Text("IS_REALTIME: %s", frame.realtime ? "TRUE" : "FALSE");
+            ImGui::Text("PARTICLES: %s (F6)", particle_impostors ? "IMPOSTORS" : "SPHERES");
             ImGui::Text("CAM POS: %.3f %.3f %.3f", camera.Position[0], camera.Position[1], camera.Position[2]);
             ImGui::Text("CAM DIR: %.3f %.3f %.3f", camera.Front[0], camera.Front[1], camera.Front[2]);
             ImGui::Text("CAM FOV: %.3f", camera.Zoom);
         }
         ImGui::End();
+        if (show_profiler) {
+            draw_profiler_panel(global_profiler);
+            draw_perf_counters(global_perf_counters, frame.particle_num);
+            draw_memory_stats(global_memory_tracker);
+            draw_task_graph(frame.step_timings);
+            if (TERRAIN_MESH) {
+                draw_terrain_stats(frame.terrain, frame.remeshed_chunks, terrain_upload_bytes);
+            } else {
+                draw_voxel_stats(frame.voxels, voxel_gpu);
+            }
+            draw_cull_stats(culling.stats);
+        }
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         // --------------------------------
 
         if (g_use_offscreen) {
-            OffscreenProcessCameraNew(&camera);
+            if (!replaying) {
+                OffscreenProcessCameraNew(&camera);
+            }
             OffscreenSaveRGBA();
         }
 
@@ -402,6 +848,26 @@ int main() {
         glfwPollEvents();
     }
 
+    // write the frames still queued in the offscreen path
+    if (g_use_offscreen) {
+        OffscreenFinish();
+    }
+
+    if (simulation.joinable()) {
+        while (!sim_commands.push(SIM_QUIT)) {
+            std::this_thread::yield();
+        }
+        simulation.join();
+    }
+
+    // make sure a checkpoint in flight is completely written
+    checkpointer.wait();
+    incremental_checkpoints.wait();
+    // writes the frame index of the trajectory
+    global_profiler.stop_csv();
+    trajectory.close();
+    voxel_recording.close();
+
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
     glDeleteVertexArrays(1, &coordi_VAO);
@@ -410,6 +876,13 @@ int main() {
     glDeleteVertexArrays(2, cube_VAO);
     glDeleteBuffers(2, cube_VBO);
 
+    glDeleteVertexArrays(1, &impostor_VAO);
+    if (culled_voxels.supported) {
+        glDeleteVertexArrays(2, culled_voxels.VAO);
+        glDeleteTextures(1, &culled_voxels.instance_texture);
+    }
+    glDeleteBuffers(1, &impostor_VBO);
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -446,13 +919,68 @@ void processInput(GLFWwindow *window) {
     }
 
     if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-        regenerate = true;
+        send_command(SIM_REGENERATE);
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F5) == GLFW_PRESS) {
+        if (!isSaveKeyPressed) {
+            send_command(SIM_SAVE_CHECKPOINT);
+        }
+        isSaveKeyPressed = true;
+    } else {
+        isSaveKeyPressed = false;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS) {
+        if (!isProfilerKeyPressed) {
+            show_profiler = !show_profiler;
+        }
+        isProfilerKeyPressed = true;
+    } else {
+        isProfilerKeyPressed = false;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F4) == GLFW_PRESS) {
+        if (!isTraceKeyPressed) {
+            global_tracer.capture_frames(TRACE_FRAMES);
+        }
+        isTraceKeyPressed = true;
+    } else {
+        isTraceKeyPressed = false;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F6) == GLFW_PRESS) {
+        if (!isImpostorKeyPressed) {
+            particle_impostors = !particle_impostors;
+        }
+        isImpostorKeyPressed = true;
+    } else {
+        isImpostorKeyPressed = false;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F8) == GLFW_PRESS) {
+        if (!isLoadIncrementalKeyPressed) {
+            send_command(SIM_LOAD_INCREMENTAL_CHECKPOINT);
+        }
+        isLoadIncrementalKeyPressed = true;
+    } else {
+        isLoadIncrementalKeyPressed = false;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS) {
+        if (!isLoadKeyPressed) {
+            send_command(SIM_LOAD_CHECKPOINT);
+        }
+        isLoadKeyPressed = true;
+    } else {
+        isLoadKeyPressed = false;
     }
 
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
         if (!isRightKeyPressed) {
             std::cout << "next frame" << std::endl;
             next_frame_request = true;
+            send_command(SIM_STEP);
         }
         isRightKeyPressed = true;
     }
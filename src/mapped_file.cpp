@@ -0,0 +1,101 @@
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <mapped_file.h>
+
+
+mapped_file::~mapped_file() {
+    close();
+}
+
+#ifdef _WIN32
+bool mapped_file::open(const std::string& path) {
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return false;
+    }
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    file_handle = file;
+    mapping_handle = mapping;
+    bytes = static_cast<const uint8_t*>(view);
+    length = static_cast<size_t>(file_size.QuadPart);
+    return true;
+}
+
+void mapped_file::close() {
+    if (bytes) {
+        UnmapViewOfFile(bytes);
+    }
+    if (mapping_handle) {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle) {
+        CloseHandle(file_handle);
+    }
+    bytes = nullptr;
+    length = 0;
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+}
+#else
+bool mapped_file::open(const std::string& path) {
+    close();
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(file, &st) != 0 || st.st_size == 0) {
+        ::close(file);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED) {
+        ::close(file);
+        return false;
+    }
+    // the whole file is copied out right away, let the kernel read ahead
+    madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL | MADV_WILLNEED);
+    fd = file;
+    bytes = static_cast<const uint8_t*>(view);
+    length = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void mapped_file::close() {
+    if (bytes) {
+        munmap(const_cast<uint8_t*>(bytes), length);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    bytes = nullptr;
+    length = 0;
+    fd = -1;
+}
+#endif
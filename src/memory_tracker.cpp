@@ -0,0 +1,141 @@
+#include <new>
+#include <cstdlib>
+
+#include <memory_tracker.h>
+
+
+memory_tracker global_memory_tracker;
+
+thread_local memory_tag memory_scope::current_tag = MEMORY_OTHER;
+
+const char* const memory_tag_names[MEMORY_TAG_COUNT] = {
+    "other",
+    "particles",
+    "voxels",
+    "neighbour grid",
+    "simulation temporaries",
+    "render",
+    "recording",
+    "ui",
+};
+
+
+static void raise_peak(std::atomic<int64_t>& peak, int64_t value) {
+    int64_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void memory_tracker::allocated(int tag, size_t size) {
+    tag_counters& t = tags[tag];
+    raise_peak(t.peak_bytes, t.bytes.fetch_add(int64_t(size), std::memory_order_relaxed) + int64_t(size));
+    t.allocations.fetch_add(1, std::memory_order_relaxed);
+    raise_peak(all.peak_bytes, all.bytes.fetch_add(int64_t(size), std::memory_order_relaxed) + int64_t(size));
+    all.allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void memory_tracker::released(int tag, size_t size) {
+    tags[tag].bytes.fetch_sub(int64_t(size), std::memory_order_relaxed);
+    all.bytes.fetch_sub(int64_t(size), std::memory_order_relaxed);
+}
+
+void memory_tracker::end_frame() {
+    auto close = [](tag_counters& t) {
+        uint64_t allocations = t.allocations.load(std::memory_order_relaxed);
+        t.frame_allocations = allocations - t.frame_start_allocations;
+        t.frame_start_allocations = allocations;
+    };
+    for (tag_counters& t : tags) {
+        close(t);
+    }
+    close(all);
+}
+
+void memory_tracker::reset_peaks() {
+    for (tag_counters& t : tags) {
+        t.peak_bytes.store(t.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    all.peak_bytes.store(all.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+static memory_tag_stats read_counters(const std::atomic<int64_t>& bytes, const std::atomic<int64_t>& peak, const std::atomic<uint64_t>& allocations, uint64_t frame_allocations) {
+    memory_tag_stats s;
+    s.bytes = bytes.load(std::memory_order_relaxed);
+    s.peak_bytes = peak.load(std::memory_order_relaxed);
+    s.allocations = allocations.load(std::memory_order_relaxed);
+    s.frame_allocations = frame_allocations;
+    return s;
+}
+
+memory_tag_stats memory_tracker::stats(int tag) const {
+    const tag_counters& t = tags[tag];
+    return read_counters(t.bytes, t.peak_bytes, t.allocations, t.frame_allocations);
+}
+
+memory_tag_stats memory_tracker::total() const {
+    return read_counters(all.bytes, all.peak_bytes, all.allocations, all.frame_allocations);
+}
+
+
+#if MEMORY_TRACKING
+
+// every block starts with a header in front of the returned pointer: the malloc'ed base (aligned blocks are shifted),
+// the size and the tag to release it from
+struct alignas(16) allocation_header {
+    void* base;
+    size_t size;
+    int tag;
+};
+
+static void* tracked_allocate(size_t size, size_t alignment, bool nothrow) {
+    if (alignment < alignof(allocation_header)) {
+        alignment = alignof(allocation_header);
+    }
+    void* base = std::malloc(size + sizeof(allocation_header) + alignment - alignof(allocation_header));
+    if (base == nullptr) {
+        if (nothrow) {
+            return nullptr;
+        }
+        throw std::bad_alloc();
+    }
+    uintptr_t user = (reinterpret_cast<uintptr_t>(base) + sizeof(allocation_header) + alignment - 1) & ~uintptr_t(alignment - 1);
+    allocation_header* header = reinterpret_cast<allocation_header*>(user) - 1;
+    header->base = base;
+    header->size = size;
+    header->tag = memory_scope::current();
+    global_memory_tracker.allocated(header->tag, size);
+    return reinterpret_cast<void*>(user);
+}
+
+static void tracked_release(void* p) {
+    if (p == nullptr) {
+        return;
+    }
+    allocation_header* header = static_cast<allocation_header*>(p) - 1;
+    global_memory_tracker.released(header->tag, header->size);
+    std::free(header->base);
+}
+
+void* operator new(size_t size) { return tracked_allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__, false); }
+void* operator new[](size_t size) { return tracked_allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__, false); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return tracked_allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__, true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return tracked_allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__, true); }
+void* operator new(size_t size, std::align_val_t alignment) { return tracked_allocate(size, size_t(alignment), false); }
+void* operator new[](size_t size, std::align_val_t alignment) { return tracked_allocate(size, size_t(alignment), false); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return tracked_allocate(size, size_t(alignment), true); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return tracked_allocate(size, size_t(alignment), true); }
+
+void operator delete(void* p) noexcept { tracked_release(p); }
+void operator delete[](void* p) noexcept { tracked_release(p); }
+void operator delete(void* p, size_t) noexcept { tracked_release(p); }
+void operator delete[](void* p, size_t) noexcept { tracked_release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { tracked_release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { tracked_release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { tracked_release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { tracked_release(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { tracked_release(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { tracked_release(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { tracked_release(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { tracked_release(p); }
+
+#endif
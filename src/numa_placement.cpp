@@ -0,0 +1,127 @@
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <filesystem>
+#include <algorithm>
+#include <mutex>
+
+#include <numa_placement.h>
+#include <parallel.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef __linux__
+
+int numa_node_count() {
+    static const int nodes = [] {
+        int n = 0;
+        std::error_code error;
+        for (auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+            std::string name = entry.path().filename().string();
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+                n++;
+            }
+        }
+        return std::max(n, 1);
+    }();
+    return nodes;
+}
+
+int numa_current_node() {
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return -1;
+    }
+    return int(node);
+}
+
+#else
+
+int numa_node_count() {
+    return 1;
+}
+
+int numa_current_node() {
+    return -1;
+}
+
+#endif
+
+
+static size_t page_size() {
+#ifdef __linux__
+    static const size_t size = size_t(sysconf(_SC_PAGESIZE));
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+// the bytes of the elements that 'thread' of 'team' gets in static_range (parallel.h), the split of the particle loops
+static void static_block(size_t count, size_t element_size, int thread, int team, size_t& begin, size_t& end) {
+    int first, last;
+    static_range(int(count), thread, team, first, last);
+    begin = size_t(first) * element_size;
+    end = size_t(last) * element_size;
+}
+
+void numa_first_touch(void* data, size_t count, size_t element_size, int threads) {
+    if (data == nullptr || count == 0) {
+        return;
+    }
+    char* bytes = static_cast<char*>(data);
+    const size_t page = page_size();
+    threads = std::max(threads, 1);
+    parallel_region(threads, [&](int thread, int team) {
+        size_t begin, end;
+        static_block(count, element_size, thread, team, begin, end);
+        // a page shared by two blocks goes to whoever touches it first, either is fine
+        for (size_t offset = begin; offset < end; offset = (offset / page + 1) * page) {
+            bytes[offset] = 0;
+        }
+    });
+}
+
+numa_locality numa_page_locality(const void* data, size_t count, size_t element_size, int threads) {
+    numa_locality total;
+#ifdef __linux__
+    if (data == nullptr || count == 0) {
+        return total;
+    }
+    const uintptr_t page = page_size();
+    const uintptr_t base = reinterpret_cast<uintptr_t>(data);
+    threads = std::max(threads, 1);
+    std::mutex total_mutex;
+    parallel_region(threads, [&](int thread, int team) {
+        size_t begin, end;
+        static_block(count, element_size, thread, team, begin, end);
+        std::vector<void*> pages;
+        for (uintptr_t address = (base + begin) / page * page; address < base + end; address += page) {
+            pages.push_back(reinterpret_cast<void*>(address));
+        }
+        // move_pages without target nodes only reports where each page is
+        std::vector<int> status(pages.size(), -1);
+        int node = numa_current_node();
+        bool queried = !pages.empty() && syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) == 0;
+        numa_locality local;
+        local.pages = pages.size();
+        for (int s : status) {
+            if (!queried || s < 0 || node < 0) {
+                local.unknown_pages++;
+            }
+            else if (s == node) {
+                local.local_pages++;
+            }
+        }
+        std::lock_guard<std::mutex> lock(total_mutex);
+        total.pages += local.pages;
+        total.local_pages += local.local_pages;
+        total.unknown_pages += local.unknown_pages;
+    });
+#endif
+    return total;
+}
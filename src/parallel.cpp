@@ -0,0 +1,187 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include <parallel.h>
+
+
+#ifdef _OPENMP
+
+void parallel_set_default_threads(int threads) {
+    omp_set_num_threads(std::max(threads, 1));
+}
+
+int parallel_default_threads() {
+    return omp_get_max_threads();
+}
+
+#else
+
+static std::atomic<int> default_threads{ 0 };
+
+void parallel_set_default_threads(int threads) {
+    default_threads = std::max(threads, 1);
+}
+
+int parallel_default_threads() {
+    int threads = default_threads.load(std::memory_order_relaxed);
+    return threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+
+// fork-join pool: worker w always runs thread w + 1 of a region, the calling thread is thread 0
+// the workers sleep on a condition variable between regions; it grows to the largest team asked for and never shrinks
+class thread_pool {
+public:
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    void run(int team, const std::function<void(int, int)>& body) {
+        // one region at a time: a second thread starting a region waits for the first one to finish
+        std::lock_guard<std::mutex> region_lock(region_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (int(workers.size()) < team - 1) {
+                int index = int(workers.size());
+                workers.emplace_back([this, index] { work(index); });
+            }
+            job = &body;
+            job_team = team;
+            running = team - 1;
+            generation++;
+        }
+        wake.notify_all();
+        in_region = true;
+        body(0, team);
+        in_region = false;
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return running == 0; });
+        job = nullptr;
+    }
+
+    static thread_local bool in_region;
+private:
+    void work(int index) {
+        in_region = true;
+        unsigned long long seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            if (index + 1 >= job_team) {
+                continue;
+            }
+            const std::function<void(int, int)>* body = job;
+            int team = job_team;
+            lock.unlock();
+            (*body)(index + 1, team);
+            lock.lock();
+            if (--running == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+    std::mutex region_mutex;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::vector<std::thread> workers;
+    const std::function<void(int, int)>* job = nullptr;
+    int job_team = 0;
+    int running = 0;
+    unsigned long long generation = 0;
+    bool stopping = false;
+};
+
+thread_local bool thread_pool::in_region = false;
+
+static thread_pool& global_thread_pool() {
+    static thread_pool pool;
+    return pool;
+}
+
+void thread_pool_region(int threads, const std::function<void(int, int)>& body) {
+    int team = threads > 0 ? threads : parallel_default_threads();
+    if (team <= 1 || thread_pool::in_region) {
+        body(0, 1);
+        return;
+    }
+    global_thread_pool().run(team, body);
+}
+
+// the range a thread still has to do; the owner takes 'grain' items from the front, a thief takes the back half
+struct alignas(64) steal_range {
+    std::mutex mutex;
+    int begin = 0, end = 0;
+};
+
+void thread_pool_for(int begin, int end, int grain, int threads, const std::function<void(int, int)>& range_body) {
+    if (end <= begin) {
+        return;
+    }
+    int team = std::min(threads > 0 ? threads : parallel_default_threads(), (end - begin + grain - 1) / grain);
+    if (team <= 1 || thread_pool::in_region) {
+        range_body(begin, end);
+        return;
+    }
+    std::unique_ptr<steal_range[]> ranges(new steal_range[team]);
+    for (int t = 0; t < team; t++) {
+        int b, e;
+        static_range(end - begin, t, team, b, e);
+        ranges[t].begin = begin + b;
+        ranges[t].end = begin + e;
+    }
+    global_thread_pool().run(team, [&](int thread, int actual_team) {
+        steal_range& own = ranges[thread];
+        while (true) {
+            int chunk_begin, chunk_end;
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                chunk_begin = own.begin;
+                chunk_end = std::min(own.begin + grain, own.end);
+                own.begin = chunk_end;
+            }
+            if (chunk_begin < chunk_end) {
+                range_body(chunk_begin, chunk_end);
+                continue;
+            }
+            // out of work: steal the back half of the first victim with work left (all of it if it is at most a chunk)
+            // nothing new is ever added, so when every range is empty the loop is done
+            // (never two locks at once: an empty range is only written by its owner, thieves skip it)
+            int stolen_begin = 0, stolen_end = 0;
+            for (int n = 1; n < actual_team && stolen_begin == stolen_end; n++) {
+                steal_range& victim = ranges[(thread + n) % actual_team];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                int left = victim.end - victim.begin;
+                if (left <= 0) {
+                    continue;
+                }
+                int take = left > grain ? left / 2 : left;
+                stolen_begin = victim.end - take;
+                stolen_end = victim.end;
+                victim.end -= take;
+            }
+            if (stolen_begin == stolen_end) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.begin = stolen_begin;
+            own.end = stolen_end;
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,210 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <perf_counters.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+
+perf_counters global_perf_counters;
+
+const char* const perf_counter_names[PERF_COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "LLC misses",
+    "branch misses",
+};
+
+
+#ifdef __linux__
+
+static const uint64_t perf_counter_configs[PERF_COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static int open_counter(uint64_t config, int group_fd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+    attr.exclude_hv = 1;
+    // calling thread, any cpu
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+// one group per thread, cycles leads it so all counters are scheduled (and multiplexed) together
+struct thread_counters {
+    int fd[PERF_COUNTER_COUNT] = { -1, -1, -1, -1 };
+    int slot[PERF_COUNTER_COUNT] = { -1, -1, -1, -1 }; // position in the group read
+    int members = 0;
+    unsigned int generation = 0;
+    bool failed = false;
+
+    void open(std::string* error) {
+        close();
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            fd[c] = open_counter(perf_counter_configs[c], c == 0 ? -1 : fd[0]);
+            if (fd[c] >= 0) {
+                slot[c] = members++;
+            }
+            else if (c == 0) {
+                failed = true;
+                if (error != nullptr) {
+                    *error = std::string("perf_event_open: ") + std::strerror(errno);
+                    if (errno == EACCES || errno == EPERM) {
+                        *error += " (check /proc/sys/kernel/perf_event_paranoid)";
+                    }
+                    else if (errno == ENOENT || errno == EOPNOTSUPP) {
+                        *error += " (no hardware counters, e.g. a virtual machine)";
+                    }
+                }
+                return;
+            }
+        }
+        failed = false;
+    }
+    void close() {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            if (fd[c] >= 0) {
+                ::close(fd[c]);
+            }
+            fd[c] = -1;
+            slot[c] = -1;
+        }
+        members = 0;
+    }
+    ~thread_counters() { close(); }
+};
+
+static thread_local thread_counters local_counters;
+
+bool perf_counters::enable() {
+    if (active()) {
+        return true;
+    }
+    // try on this thread first, so a failure is reported here instead of silently in every scope
+    std::string error;
+    generation.fetch_add(1, std::memory_order_relaxed);
+    local_counters.open(&error);
+    if (local_counters.failed) {
+        status_message = error;
+        std::cout << "perf counters unavailable: " << status_message << std::endl;
+        return false;
+    }
+    local_counters.generation = generation.load(std::memory_order_relaxed);
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        available[c] = local_counters.fd[c] >= 0;
+    }
+    status_message = "enabled";
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (!available[c]) {
+            status_message += std::string(", no ") + perf_counter_names[c];
+        }
+    }
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            current[p][c].store(0, std::memory_order_relaxed);
+            total[p][c] = 0.0;
+        }
+        current_multiplexed[p].store(false, std::memory_order_relaxed);
+        multiplexed[p] = false;
+    }
+    frames = 0;
+    enabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+bool perf_counters::read(perf_sample& sample) {
+    unsigned int g = generation.load(std::memory_order_relaxed);
+    if (local_counters.generation != g) {
+        local_counters.generation = g;
+        local_counters.open(nullptr);
+    }
+    if (local_counters.failed) {
+        return false;
+    }
+    // { nr, time_enabled, time_running, value of each member }
+    uint64_t buffer[3 + PERF_COUNTER_COUNT];
+    ssize_t expected = ssize_t(sizeof(uint64_t) * (3 + local_counters.members));
+    if (::read(local_counters.fd[0], buffer, sizeof(buffer)) != expected) {
+        return false;
+    }
+    sample.time_enabled = buffer[1];
+    sample.time_running = buffer[2];
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        sample.value[c] = local_counters.slot[c] >= 0 ? buffer[3 + local_counters.slot[c]] : 0;
+    }
+    return true;
+}
+
+#else
+
+bool perf_counters::enable() {
+    status_message = "only available on Linux";
+    return false;
+}
+
+bool perf_counters::read(perf_sample& /*sample*/) {
+    return false;
+}
+
+#endif
+
+
+void perf_counters::disable() {
+    enabled.store(false, std::memory_order_relaxed);
+    status_message = "disabled";
+    // the threads keep their file descriptors until they exit, reopened (and reset) when enabled again
+}
+
+void perf_counters::add(profile_phase phase, const perf_sample& begin, const perf_sample& end) {
+    uint64_t enabled_ns = end.time_enabled - begin.time_enabled;
+    uint64_t running_ns = end.time_running - begin.time_running;
+    // the group only counted for running_ns of the enabled_ns, estimate the whole as perf stat does
+    double scale = 1.0;
+    if (running_ns < enabled_ns) {
+        current_multiplexed[phase].store(true, std::memory_order_relaxed);
+        if (running_ns == 0) {
+            return; // never on the PMU in this scope, nothing to scale
+        }
+        scale = double(enabled_ns) / double(running_ns);
+    }
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        current[phase][c].fetch_add(uint64_t(double(end.value[c] - begin.value[c]) * scale + 0.5), std::memory_order_relaxed);
+    }
+}
+
+void perf_counters::end_frame() {
+    if (!active()) {
+        return;
+    }
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            total[p][c] += double(current[p][c].exchange(0, std::memory_order_relaxed));
+        }
+        multiplexed[p] |= current_multiplexed[p].exchange(false, std::memory_order_relaxed);
+    }
+    frames++;
+}
+
+perf_phase_stats perf_counters::stats(profile_phase phase) const {
+    perf_phase_stats s;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        s.value[c] = frames > 0 ? total[phase][c] / frames : 0.0;
+        s.available[c] = available[c];
+    }
+    s.multiplexed = multiplexed[phase];
+    return s;
+}
@@ -4,11 +4,21 @@
 
 #include <vector>
 #include <unordered_map>
+#include <algorithm>
+#include <mutex>
 
 #include <random>
-#include <FastNoise/FastNoise.h>
 
 #include <data_structures.h>
+#include <profiler.h>
+#include <tracer.h>
+#include <perf_counters.h>
+#include <memory_tracker.h>
+#include <thread_config.h>
+#include <work_partition.h>
+#include <parallel.h>
+#include <task_graph.h>
+#include <terrain_generator.h>
 
 
 // this will inicate the beginning of the voxel field(x=y=z=0) in world space
@@ -18,44 +28,11 @@ extern const float voxel_z_origin;
 // this will adjust voxel size, the voxel size will be voxel_size_scale * 1
 extern const float voxel_size_scale;
 
-std::vector<std::vector<std::vector<float>>> CreateGround(int xStart, int yStart) {
-    // 创建FastNoise2生成器
-    FastNoise::SmartNode<> fnGenerator = FastNoise::NewFromEncodedNodeTree("EwCamZk+DQAMAAAAw/VoQAkAAKRwvT4AAAAAPw==");
-
-    // 定义噪声图的大小
-    const int noiseSizeX = (x_max - x_min) * 2;
-    const int noiseSizeY = (z_max - z_min) * 2;
-    std::vector<float> noiseOutput(noiseSizeX * noiseSizeY);
-
-    // 生成2D噪声
-    fnGenerator->GenUniformGrid2D(noiseOutput.data(), xStart, yStart, noiseSizeX, noiseSizeY, 0.05f, 1337);
-
-    // 噪声值的最大高度
-    const int maxHeight = 50;
-
-    // 初始化三维数组
-    auto noise3DArray = std::vector<std::vector<std::vector<float>>>(noiseSizeX, std::vector<std::vector<float>>(noiseSizeY, std::vector<float>(maxHeight, 0)));
-
-    // 填充三维数组
-    for (int x = 0; x < noiseSizeX; ++x) {
-        for (int y = 0; y < noiseSizeY; ++y) {
-            // 将噪声值从[-1, 1]映射到[0, 1]
-            float scaledHeight = (noiseOutput[x * noiseSizeY + y] + 1.0f) / 2.0f;
-
-            // 将映射后的噪声值转换为体素高度
-            int voxelHeight = static_cast<int>(scaledHeight * maxHeight);
-
-            // 设置该点对应的高度值
-            for (int z = 0; z < voxelHeight; ++z) {
-                noise3DArray[x][y][z] = 1.0f; // 在高度 z 处设置体素存在
-            }
-        }
-    }
-
-    return noise3DArray;
+void set_up_voxel_field(voxel_field& V, float voxel_density) {
+    set_up_voxel_field(V, voxel_density, terrain_config());
 }
 
-void set_up_voxel_field(voxel_field& V, float voxel_density) {
+void set_up_voxel_field(voxel_field& V, float voxel_density, const terrain_config& terrain) {
     // common destroyable voxel
     voxel v1;
     v1.density = voxel_density;
@@ -64,27 +41,11 @@ void set_up_voxel_field(voxel_field& V, float voxel_density) {
     v1.not_destroyable = false;
     v1.update_color();
 
-    // 生成地形数据
-    int xStart = 500; // 可以根据需要更改这些值
-    int yStart = 200;
-    auto terrainData = CreateGround(xStart, yStart);
-
-
-    // 根据地形数据设置体素
-    for (int i = 0; i < terrainData.size(); i++) {
-        for (int k = 0; k < terrainData[i].size(); k++) {
-            for (int j = 0; j < terrainData[i][k].size(); j++) {
-                if (terrainData[i][k][j] > 0 && i < V.x_size && j <V .y_size && k < V.z_size) {
-                    V.set_voxel(i, j, k, v1);
-                }
-            }
-        }
-    }
+    // the terrain goes straight into the field, tile by tile
+    generate_terrain(V, terrain, v1);
 }
 
 
-
-
 void refresh_debug(voxel_field& V) {
     for (int i = 0; i < V.x_size; i++) {
         for (int j = 0; j < V.y_size; j++) {
@@ -145,30 +106,45 @@ void voxel::update_color() {
 // definition of the field, contains a 3D array of voxels
 
 voxel_field::voxel_field(int x, int y, int z) {
+    memory_scope memory(MEMORY_VOXELS);
     x_size = x;
     y_size = y;
     z_size = z;
     NULL_VOXEL.exist = false;
     field.resize(x);
-    for (int i = 0; i < x; i++) {
-        field[i].resize(y);
-        for (int j = 0; j < y; j++) {
-            field[i][j].resize(z);
-            for (int k = 0; k < z; k++) {
-                field[i][j][k].exist = false;
-                field[i][j][k].density = 0.0f;
-                field[i][j][k].color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    // no loop owns the voxels, so the x slices are spread over the threads (and sockets) to spread the remote reads
+    // instead of putting the whole field on the main thread's node; a static split, so the pages of a slice land on the
+    // node of a fixed thread instead of whichever thread a dynamic schedule hands the slice to
+    parallel_region(global_thread_config.threads(PHASE_INTEGRATE), [&](int thread, int team) {
+        memory_scope slice_memory(MEMORY_VOXELS);
+        int begin, end;
+        static_range(x, thread, team, begin, end);
+        for (int i = begin; i < end; i++) {
+            field[i].resize(y);
+            for (int j = 0; j < y; j++) {
+                field[i][j].resize(z);
+                for (int k = 0; k < z; k++) {
+                    field[i][j][k].exist = false;
+                    field[i][j][k].density = 0.0f;
+                    field[i][j][k].color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+                }
             }
         }
-    }
+    });
+    brick_x_num = (x + brick_size - 1) / brick_size;
+    brick_y_num = (y + brick_size - 1) / brick_size;
+    brick_z_num = (z + brick_size - 1) / brick_size;
+    brick_stamp.assign(brick_count(), 0);
 }
 void voxel_field::set_voxel(int x, int y, int z, float density, glm::vec4 color) {
     field[x][y][z].exist = true;
     field[x][y][z].density = density;
     field[x][y][z].color = color;
+    mark_dirty(x, y, z);
 }
 void voxel_field::set_voxel(int x, int y, int z, voxel v) {
     field[x][y][z] = v;
+    mark_dirty(x, y, z);
 }
 voxel& voxel_field::get_voxel(int x, int y, int z) {
     if (x < 0 || x >= x_size || y < 0 || y >= y_size || z < 0 || z >= z_size) {
@@ -200,6 +176,7 @@ void voxel_field::clear_voxel(int x, int y, int z) {
     field[x][y][z].exist = false;
     field[x][y][z].density = 0.0f;
     field[x][y][z].color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    mark_dirty(x, y, z);
 }
 void voxel_field::clear_all() {
     for (int i = 0; i < x_size; i++) {
@@ -211,6 +188,7 @@ void voxel_field::clear_all() {
             }
         }
     }
+    mark_all_dirty();
 }
 void voxel_field::print_field() {
     for (int i = 0; i < field.size(); i++) {
@@ -232,6 +210,29 @@ void voxel_field::print_field() {
 
 
 
+void voxel_field::mark_dirty(int x, int y, int z) {
+    int b = ((x / brick_size) * brick_y_num + (y / brick_size)) * brick_z_num + (z / brick_size);
+    brick_stamp[b] = dirty_epoch;
+}
+void voxel_field::mark_all_dirty() {
+    std::fill(brick_stamp.begin(), brick_stamp.end(), dirty_epoch);
+}
+std::vector<int> voxel_field::collect_dirty_bricks(unsigned int& cursor) {
+    // everything stamped up to now belongs to this collection, later mutations get a newer epoch
+    unsigned int upto = dirty_epoch++;
+    std::vector<int> res;
+    for (int b = 0; b < brick_count(); b++) {
+        if (brick_stamp[b] > cursor && brick_stamp[b] <= upto) {
+            res.push_back(b);
+        }
+    }
+    cursor = upto;
+    return res;
+}
+
+
+
+
 // avoid some cases that the voxel index is out of bound
 void check_voxel_index(int& x, int& y, int& z, voxel_field& V) {
     if (x < 0) {
@@ -305,19 +306,26 @@ std::vector<int> world_to_voxel(glm::vec3 world, voxel_field& V) {
 // definition of the neighbourhood grid, contains a 3D array of vectors of particle indices
 // Neighborhood Search speed up part:// cell with size = smoothing_length
 neighbourhood_grid::neighbourhood_grid(int x, int y, int z) {
+    memory_scope memory(MEMORY_GRID);
     x_size = x;
     y_size = y;
     z_size = z;
     grid.resize(x);
-    for (int i = 0; i < x_size; i++) {
-        grid[i].resize(y_size);
-        for (int j = 0; j < y_size; j++) {
-            grid[i][j].resize(z_size);
-            for (int k = 0; k < z_size; k++) {
-                grid[i][j][k].resize(0);
+    // the x slices in a static split over the threads, like the voxel field
+    parallel_region(global_thread_config.threads(PHASE_DENSITY), [&](int thread, int team) {
+        memory_scope slice_memory(MEMORY_GRID);
+        int begin, end;
+        static_range(x_size, thread, team, begin, end);
+        for (int i = begin; i < end; i++) {
+            grid[i].resize(y_size);
+            for (int j = 0; j < y_size; j++) {
+                grid[i][j].resize(z_size);
+                for (int k = 0; k < z_size; k++) {
+                    grid[i][j][k].resize(0);
+                }
             }
         }
-    }
+    });
 };
 void neighbourhood_grid::add_particle(int x, int y, int z, int particle_index) {
     grid[x][y][z].push_back(particle_index);
@@ -554,31 +562,45 @@ bounding_box::bounding_box(GLfloat _x_max, GLfloat _x_min, GLfloat _y_max, GLflo
 
 }
 
+// the one random engine of the simulation, its state is saved in the checkpoint so a restored run spawns the same particles
+std::mt19937 simulation_rng(std::random_device{}());
+
 // generate a random vec3 in the min and max range
 glm::vec3 generateRandomVec3(float _x_max, float _x_min, float _y_max, float _y_min, float _z_max, float _z_min) {
-    std::mt19937 rng(std::random_device{}());
     std::uniform_real_distribution<float> distributionX(_x_min, _x_max);
     std::uniform_real_distribution<float> distributionY(_y_min, _y_max);
     std::uniform_real_distribution<float> distributionZ(_z_min, _z_max);
 
-    float randomX = distributionX(rng);
-    float randomY = distributionY(rng);
-    float randomZ = distributionZ(rng);
+    float randomX = distributionX(simulation_rng);
+    float randomY = distributionY(simulation_rng);
+    float randomZ = distributionZ(simulation_rng);
 
     return glm::vec3(randomX * 0.9f, randomY * 0.9f, randomZ * 0.9f);
 }
 
+// small offset used when two particles sit at exactly the same position, derived from the pair index so it is
+// deterministic, thread safe (no shared rng inside the parallel loop) and opposite for (i,j) and (j,i)
+glm::vec3 overlap_jitter(int i, int j) {
+    unsigned int a = static_cast<unsigned int>(std::min(i, j));
+    unsigned int b = static_cast<unsigned int>(std::max(i, j));
+    unsigned int h = a * 73856093u ^ b * 19349663u;
+    glm::vec3 d = glm::vec3(float(h & 1023u), float((h >> 10) & 1023u), float((h >> 20) & 1023u)) / 511.5f - 1.0f;
+    if (glm::length(d) == 0.0f) {
+        d = glm::vec3(1.0f, 0.0f, 0.0f);
+    }
+    return (i < j ? 0.0001f : -0.0001f) * glm::normalize(d);
+}
 
 
 
 
 
-void calculate_SPH_movement(std::vector<particle>& p, float frameTimeDiff, voxel_field& V, neighbourhood_grid& G, std::vector<int>& recycle_list) {
-    int particle_num = std::min(current_particle_num, (int)p.size());
-    //std::cout << "particle_num: " << particle_num << std::endl;
-    // int particle_num = p.size();
-    //refresh_debug(V);
-    // first, re-genereate the neighbourhood grid
+
+// rebuild the neighbourhood grid from the particle positions
+void build_neighbour_grid(std::vector<particle>& p, int particle_num, neighbourhood_grid& G) {
+    profile_scope scope(PHASE_GRID_BUILD);
+    perf_scope counters(PHASE_GRID_BUILD);
+    memory_scope memory(MEMORY_GRID);
     G.clear_grid();
     // looks like we cannot use parallel here, shit (even use thread with mutex lock or reduction, it is slower than default)
     for (int i = 0; i < particle_num; i++) {
@@ -586,330 +608,380 @@ void calculate_SPH_movement(std::vector<particle>& p, float frameTimeDiff, voxel
         std::vector<int> grid_index = G.world_to_grid(p[i].currPos);
         G.add_particle(grid_index[0], grid_index[1], grid_index[2], i);
     }
+}
 
+// for each particle, calculate the density and pressure
+// the pair work of a particle is about its neighbour count, the one of the last density pass (the previous step for the
+// density pass itself), plus the grid lookup
+static float particle_pair_cost(const particle& p) {
+    return p.pamameters[2] + 1.0f;
+}
 
-    // for each particle, calculate the density and pressure
-#pragma omp parallel for
-    for (int i = 0; i < particle_num; i++) {
-        std::vector<int> current_grid = G.world_to_grid(p[i].currPos);
-        std::vector<int> neighbour_particles = G.get_neighbourhood(current_grid[0], current_grid[1], current_grid[2]);
+static work_partition density_partition, force_partition;
+// the particles the integrate threads push out of the domain
+static std::mutex recycle_list_mutex;
+
+void calculate_density(std::vector<particle>& p, int particle_num, neighbourhood_grid& G) {
+    profile_scope scope(PHASE_DENSITY);
+    const int threads = global_thread_config.threads(PHASE_DENSITY);
+    density_partition.balance(particle_num, threads, [&p](int i) { return particle_pair_cost(p[i]); });
+    parallel_region(threads, [&](int thread, int team) {
+        trace_scope worker_scope("density worker");
+        perf_scope worker_counters(PHASE_DENSITY);
+        memory_scope worker_memory(MEMORY_SIMULATION);
+        profile_worker_scope worker_time(PHASE_DENSITY);
+        int begin, end;
+        density_partition.range(thread, team, begin, end);
+        for (int i = begin; i < end; i++) {
+            std::vector<int> current_grid = G.world_to_grid(p[i].currPos);
+            std::vector<int> neighbour_particles = G.get_neighbourhood(current_grid[0], current_grid[1], current_grid[2]);
+
+
+            int cnt = 0;
+            float density_sum = 0.f;
+
+            //for (int j = 0; j < particle_num; j++) {
+            for (int j : neighbour_particles) {
+                glm::vec3 delta = (p[i].currPos - p[j].currPos);
+                float r = length(delta);
+                if (r < smoothing_length)
+                {
+                    cnt++;
+                    density_sum += p[j].mass * /* poly6 kernel */ 315.f * glm::pow(smoothing_length * smoothing_length - r * r, 3.f) / (64.f * PI_FLOAT * glm::pow(smoothing_length, 9));
+                    //density_sum += particle_mass * /* poly6 kernel */ 315.f * glm::pow(smoothing_length * smoothing_length - r * r, 3.f) / (64.f * PI_FLOAT * glm::pow(smoothing_length, 9));
+                }
+            }
+            p[i].pamameters[0] = density_sum;
+            p[i].pamameters[1] = glm::max(particle_stiffness * (density_sum - particle_resting_density), 0.f);
+            p[i].pamameters[2] = float(cnt);
+        }
+    });
+}
 
+// for each particle, calculate the force and acceleration
+void calculate_force(std::vector<particle>& p, int particle_num, neighbourhood_grid& G) {
+    profile_scope scope(PHASE_FORCE);
+    const int threads = global_thread_config.threads(PHASE_FORCE);
+    force_partition.balance(particle_num, threads, [&p](int i) { return particle_pair_cost(p[i]); });
+    parallel_region(threads, [&](int thread, int team) {
+        trace_scope worker_scope("force worker");
+        perf_scope worker_counters(PHASE_FORCE);
+        memory_scope worker_memory(MEMORY_SIMULATION);
+        profile_worker_scope worker_time(PHASE_FORCE);
+        int begin, end;
+        force_partition.range(thread, team, begin, end);
+        for (int i = begin; i < end; i++) {
+            std::vector<int> current_grid = G.world_to_grid(p[i].currPos);
+            std::vector<int> neighbour_particles = G.get_neighbourhood(current_grid[0], current_grid[1], current_grid[2]);
+
+
+            glm::vec3 pressure_force = glm::vec3(0.0f, 0.0f, 0.0f);
+            glm::vec3 viscosity_force = glm::vec3(0.0f, 0.0f, 0.0f);
+            glm::vec3 dCs = glm::vec3(0.0f, 0.0f, 0.0f);
+            //for (int j = 0; j < particle_num; j++) {
+            for (int j : neighbour_particles) {
+                if (i == j) {
+                    continue;
+                }
+                glm::vec3 delta = (p[i].currPos - p[j].currPos);
+                float r = length(delta);
+                if (r < smoothing_length) {
+                    if (r == 0.0f) {
+                        // if the two particles are at the same position, add a small random delta to avoid NaN
+                        delta = overlap_jitter(i, j);
+                    }
+                    // calculate the pressure force
+                    // pressure_force -= particle_mass * (p[i].pamameters[1] + p[j].pamameters[1]) / (2.f * p[j].pamameters[0]) *
+                    pressure_force -= p[i].mass * (p[i].pamameters[1] + p[j].pamameters[1]) / (2.f * p[j].pamameters[0]) *
+                        // gradient of spiky kernel
+                        -45.f / (PI_FLOAT * glm::pow(smoothing_length, 6.f)) * glm::pow(smoothing_length - r, 2.f) * glm::normalize(delta);
+                    // calculate the viscosity force
+                    // viscosity_force += particle_mass * (p[j].velocity - p[i].velocity) / p[j].pamameters[0] *
+                    viscosity_force += p[j].mass * (p[j].velocity - p[i].velocity) / p[j].pamameters[0] *
+                        // Laplacian of viscosity kernel
+                        45.f / (PI_FLOAT * glm::pow(smoothing_length, 6.f)) * (smoothing_length - r);
+
+                    // dCs -= particle_mass * glm::pow(smoothing_length * smoothing_length - r * r, 2.f) / p[j].pamameters[0] *
+                    dCs -= p[j].mass * glm::pow(smoothing_length * smoothing_length - r * r, 2.f) / p[j].pamameters[0] *
+                        // Poly6 kernel
+                        945.f / (32.f * PI_FLOAT * glm::pow(smoothing_length, 9.f)) * delta;
+                }
 
-        int cnt = 0;
-        float density_sum = 0.f;
 
-        //for (int j = 0; j < particle_num; j++) {
-        for (int j : neighbour_particles) {
-            glm::vec3 delta = (p[i].currPos - p[j].currPos);
-            float r = length(delta);
-            if (r < smoothing_length)
-            {
-                cnt++;
-                density_sum += p[j].mass * /* poly6 kernel */ 315.f * glm::pow(smoothing_length * smoothing_length - r * r, 3.f) / (64.f * PI_FLOAT * glm::pow(smoothing_length, 9));
-                //density_sum += particle_mass * /* poly6 kernel */ 315.f * glm::pow(smoothing_length * smoothing_length - r * r, 3.f) / (64.f * PI_FLOAT * glm::pow(smoothing_length, 9));
-            }
-        }
-        p[i].pamameters[0] = density_sum;
-        p[i].pamameters[1] = glm::max(particle_stiffness * (density_sum - particle_resting_density), 0.f);
-        p[i].pamameters[2] = float(cnt);
-    }
-    // for each particle, calculate the force and acceleration
-#pragma omp parallel for
-    for (int i = 0; i < particle_num; i++) {
-        std::vector<int> current_grid = G.world_to_grid(p[i].currPos);
-        std::vector<int> neighbour_particles = G.get_neighbourhood(current_grid[0], current_grid[1], current_grid[2]);
 
 
-        glm::vec3 pressure_force = glm::vec3(0.0f, 0.0f, 0.0f);
-        glm::vec3 viscosity_force = glm::vec3(0.0f, 0.0f, 0.0f);
-        glm::vec3 dCs = glm::vec3(0.0f, 0.0f, 0.0f);
-        //for (int j = 0; j < particle_num; j++) {
-        for (int j : neighbour_particles) {
-            if (i == j) {
-                continue;
-            }
-            glm::vec3 delta = (p[i].currPos - p[j].currPos);
-            float r = length(delta);
-            if (r < smoothing_length) {
-                if (r == 0.0f) {
-                    // if the two particles are at the same position, add a small random delta to avoid NaN
-                    delta = generateRandomVec3(0.0001f, -0.0001f, 0.0001f, -0.0001f, 0.0001f, -0.0001f);
-                }
-                // calculate the pressure force
-                // pressure_force -= particle_mass * (p[i].pamameters[1] + p[j].pamameters[1]) / (2.f * p[j].pamameters[0]) *
-                pressure_force -= p[i].mass * (p[i].pamameters[1] + p[j].pamameters[1]) / (2.f * p[j].pamameters[0]) *
-                    // gradient of spiky kernel
-                    -45.f / (PI_FLOAT * glm::pow(smoothing_length, 6.f)) * glm::pow(smoothing_length - r, 2.f) * glm::normalize(delta);
-                // calculate the viscosity force
-                // viscosity_force += particle_mass * (p[j].velocity - p[i].velocity) / p[j].pamameters[0] *
-                viscosity_force += p[j].mass * (p[j].velocity - p[i].velocity) / p[j].pamameters[0] *
-                    // Laplacian of viscosity kernel
-                    45.f / (PI_FLOAT * glm::pow(smoothing_length, 6.f)) * (smoothing_length - r);
-
-                // dCs -= particle_mass * glm::pow(smoothing_length * smoothing_length - r * r, 2.f) / p[j].pamameters[0] *
-                dCs -= p[j].mass * glm::pow(smoothing_length * smoothing_length - r * r, 2.f) / p[j].pamameters[0] *
-                    // Poly6 kernel
-                    945.f / (32.f * PI_FLOAT * glm::pow(smoothing_length, 9.f)) * delta;
             }
 
 
-
+            viscosity_force *= particle_viscosity;
+            p[i].acceleration = glm::vec3((pressure_force / p[i].pamameters[0] + viscosity_force / p[i].pamameters[0] + gravity_force));
+            p[i].deltaCs = glm::vec3(glm::normalize(dCs));
 
         }
+    });
+}
 
+// for each particle, calculate the velocity and new position, with the particle - voxel collision (3D-DDA)
+void integrate_particles(std::vector<particle>& p, int particle_num, float frameTimeDiff, voxel_field& V, std::vector<int>& recycle_list) {
+    profile_scope scope(PHASE_INTEGRATE);
+    size_t recycle_begin = recycle_list.size();
+    auto recycle = [&recycle_list](int i) {
+        std::lock_guard<std::mutex> lock(recycle_list_mutex);
+        recycle_list.push_back(i);
+    };
+    parallel_region(global_thread_config.threads(PHASE_INTEGRATE), [&](int thread, int team) {
+        trace_scope worker_scope("integrate worker");
+        perf_scope worker_counters(PHASE_INTEGRATE);
+        memory_scope worker_memory(MEMORY_SIMULATION);
+        profile_worker_scope worker_time(PHASE_INTEGRATE);
+        // about the same work per particle, the blocks first_touch_resize placed on each thread's node (numa_placement.h)
+        int begin, end;
+        static_range(particle_num, thread, team, begin, end);
+        for (int i = begin; i < end; i++) {
+            glm::vec3 new_velocity = (p[i].velocity + frameTimeDiff * p[i].acceleration);
+            glm::vec3 old_velocity = p[i].velocity;
+            glm::vec3 old_position = p[i].currPos;
+            glm::vec3 new_position = p[i].currPos + frameTimeDiff * new_velocity;
 
-        viscosity_force *= particle_viscosity;
-        p[i].acceleration = glm::vec3((pressure_force / p[i].pamameters[0] + viscosity_force / p[i].pamameters[0] + gravity_force));
-        p[i].deltaCs = glm::vec3(glm::normalize(dCs));
 
-    }
 
 
 
+            p[i].velocity = new_velocity;
+            p[i].prevPos = p[i].currPos;
+            p[i].currPos = new_position;
 
-    // for each particle, calculate the velocity and new position
-#pragma omp parallel for
-    for (int i = 0; i < particle_num; i++) {
-        glm::vec3 new_velocity = (p[i].velocity + frameTimeDiff * p[i].acceleration);
-        glm::vec3 old_velocity = p[i].velocity;
-        glm::vec3 old_position = p[i].currPos;
-        glm::vec3 new_position = p[i].currPos + frameTimeDiff * new_velocity;
+            //std::cout<<"old position: "<<old_position.x<<" "<<old_position.y<<" "<<old_position.z<<std::endl;   
+            //std::cout<<"new position: "<<new_position.x<<" "<<new_position.y<<" "<<new_position.z<<std::endl;
 
 
+            // -----------------------particle - voxel collision detection-----------------------
 
+            // ------3D-DDA collision------
+            //std::cout << "begin DDA" << std::endl;
+            // 1. get the initial voxel index & the final voxel index
+            std::vector<int> begin_voxel_index = world_to_voxel(old_position, V);//check_voxel_index
+            std::vector<int> end_voxel_index = world_to_voxel(new_position, V);
 
 
-        p[i].velocity = new_velocity;
-        p[i].prevPos = p[i].currPos;
-        p[i].currPos = new_position;
+            voxel* end_v = &V.get_voxel(end_voxel_index[0], end_voxel_index[1], end_voxel_index[2]);
+            voxel* current_v = &V.get_voxel(begin_voxel_index[0], begin_voxel_index[1], begin_voxel_index[2]);
 
-        //std::cout<<"old position: "<<old_position.x<<" "<<old_position.y<<" "<<old_position.z<<std::endl;   
-        //std::cout<<"new position: "<<new_position.x<<" "<<new_position.y<<" "<<new_position.z<<std::endl;
 
+            std::vector<int> current_voxel_index = begin_voxel_index;
+            // 2. get the ray direction
+            glm::vec3 ray_direction = glm::normalize(new_position - old_position);
+            //std::cout << "ray_direction: " << ray_direction.x << " " << ray_direction.y << " " << ray_direction.z << std::endl;
+            // 3. get the initial t and final t
+            float t_current = 0.f; // begin at 0, start from the beginning of the ray AKA---> the previous position
+            float t_end = glm::length(new_position - old_position); // end at the length of the ray
+            // 4. get the delta t in each direction X/Y/Z
+            float delta_t_x = voxel_size_scale / glm::abs(ray_direction.x);
+            float delta_t_y = voxel_size_scale / glm::abs(ray_direction.y);
+            float delta_t_z = voxel_size_scale / glm::abs(ray_direction.z);
 
-        // -----------------------particle - voxel collision detection-----------------------
 
-        // ------3D-DDA collision------
-        //std::cout << "begin DDA" << std::endl;
-        // 1. get the initial voxel index & the final voxel index
-        std::vector<int> begin_voxel_index = world_to_voxel(old_position, V);//check_voxel_index
-        std::vector<int> end_voxel_index = world_to_voxel(new_position, V);
+            int sign_x = ray_direction.x > 0 ? 1 : -1;
+            int sign_y = ray_direction.y > 0 ? 1 : -1;
+            int sign_z = ray_direction.z > 0 ? 1 : -1;
+            // 5. initialize t_next_x, t_next_y, t_next_z
+            std::vector<float> voxel_6_face = voxel_to_world_6_face(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);
+            float t_next_x;
+            float t_next_y;
+            float t_next_z;
+            // initialize t_next_x, t_next_y, t_next_z, it is the distance from the current position to the next X/Y/Z direction voxel's face
+            if (sign_x == 1) {
+                t_next_x = glm::abs((voxel_6_face[0] - old_position.x) / ray_direction.x);
+            }
+            else {
+                t_next_x = glm::abs((voxel_6_face[1] - old_position.x) / ray_direction.x);
+            }
+            if (sign_y == 1) {
+                t_next_y = glm::abs((voxel_6_face[2] - old_position.y) / ray_direction.y);
+            }
+            else {
+                t_next_y = glm::abs((voxel_6_face[3] - old_position.y) / ray_direction.y);
+            }
+            if (sign_z == 1) {
+                t_next_z = glm::abs((voxel_6_face[4] - old_position.z) / ray_direction.z);
+            }
+            else {
+                t_next_z = glm::abs((voxel_6_face[5] - old_position.z) / ray_direction.z);
+            }
 
+            // exclude NAN
+            if (std::isnan(t_next_x)) {
+                t_next_x = INFINITY;
+            }
+            if (std::isnan(t_next_y)) {
+                t_next_y = INFINITY;
+            }
+            if (std::isnan(t_next_z)) {
+                t_next_z = INFINITY;
+            }
 
-        voxel* end_v = &V.get_voxel(end_voxel_index[0], end_voxel_index[1], end_voxel_index[2]);
-        voxel* current_v = &V.get_voxel(begin_voxel_index[0], begin_voxel_index[1], begin_voxel_index[2]);
+            // if it is already inside a voxel, then try push it out (I cannot fix this bug by avoiding all the stucking inside possibilities, so just push it out)
+            if (current_v->exist) {
+                new_velocity = glm::vec3(0);
+                //new_velocity *= -1.0f;
+                glm::vec3 push_direction = glm::normalize(new_position - voxel_to_world(begin_voxel_index[0], begin_voxel_index[1], begin_voxel_index[2]));
+                float push_distance = voxel_size_scale * 0.005f;
+                new_position = old_position + push_distance * push_direction;
+                p[i].currPos = new_position;
+                p[i].velocity = new_velocity;
 
+            }
 
-        std::vector<int> current_voxel_index = begin_voxel_index;
-        // 2. get the ray direction
-        glm::vec3 ray_direction = glm::normalize(new_position - old_position);
-        //std::cout << "ray_direction: " << ray_direction.x << " " << ray_direction.y << " " << ray_direction.z << std::endl;
-        // 3. get the initial t and final t
-        float t_current = 0.f; // begin at 0, start from the beginning of the ray AKA---> the previous position
-        float t_end = glm::length(new_position - old_position); // end at the length of the ray
-        // 4. get the delta t in each direction X/Y/Z
-        float delta_t_x = voxel_size_scale / glm::abs(ray_direction.x);
-        float delta_t_y = voxel_size_scale / glm::abs(ray_direction.y);
-        float delta_t_z = voxel_size_scale / glm::abs(ray_direction.z);
 
+            // 6. recursively check the voxel in the ray direction, if the voxel is occupied, 
+            // then it collides, reverse the velocity and stop the particle at(/before) the collision point
+            while ((t_current <= t_end) && !current_v->exist) {
+                float t_min_next = glm::min(t_next_x, glm::min(t_next_y, t_next_z));
+                int x_or_y_or_z = -1; // 0 for x, 1 for y, 2 for z, indicating which direction is the next voxel
+                t_current += t_min_next;
+                if (t_current > t_end) {
+                    break;
+                }
+                if (t_min_next == t_next_x)
+                {
+                    x_or_y_or_z = 0;
+                    t_next_x += delta_t_x;
+                    current_voxel_index[0] += sign_x;
+                    if (current_voxel_index[0] < 0 || current_voxel_index[0] >= V.x_size)
+                        break;
+                }
+                else if (t_min_next == t_next_y)
+                {
+                    x_or_y_or_z = 1;
+                    t_next_y += delta_t_y;
+                    current_voxel_index[1] += sign_y;
+                    if (current_voxel_index[1] < 0 || current_voxel_index[1] >= V.y_size)
+                        break;
+                }
+                else if (t_min_next == t_next_z)
+                {
+                    x_or_y_or_z = 2;
+                    t_next_z += delta_t_z;
+                    current_voxel_index[2] += sign_z;
+                    if (current_voxel_index[2] < 0 || current_voxel_index[2] >= V.z_size)
+                        break;
+                }
+                else
+                {
+                    std::cout << "error in 3D-DDA ray delta" << t_min_next << t_next_x << "," << t_next_y << "," << t_next_z << std::endl;
+                    break;
+                }
 
-        int sign_x = ray_direction.x > 0 ? 1 : -1;
-        int sign_y = ray_direction.y > 0 ? 1 : -1;
-        int sign_z = ray_direction.z > 0 ? 1 : -1;
-        // 5. initialize t_next_x, t_next_y, t_next_z
-        std::vector<float> voxel_6_face = voxel_to_world_6_face(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);
-        float t_next_x;
-        float t_next_y;
-        float t_next_z;
-        // initialize t_next_x, t_next_y, t_next_z, it is the distance from the current position to the next X/Y/Z direction voxel's face
-        if (sign_x == 1) {
-            t_next_x = glm::abs((voxel_6_face[0] - old_position.x) / ray_direction.x);
-        }
-        else {
-            t_next_x = glm::abs((voxel_6_face[1] - old_position.x) / ray_direction.x);
-        }
-        if (sign_y == 1) {
-            t_next_y = glm::abs((voxel_6_face[2] - old_position.y) / ray_direction.y);
-        }
-        else {
-            t_next_y = glm::abs((voxel_6_face[3] - old_position.y) / ray_direction.y);
-        }
-        if (sign_z == 1) {
-            t_next_z = glm::abs((voxel_6_face[4] - old_position.z) / ray_direction.z);
-        }
-        else {
-            t_next_z = glm::abs((voxel_6_face[5] - old_position.z) / ray_direction.z);
-        }
+                current_v = &V.get_voxel(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);
+                if (current_v->exist) {
+                    // TRICK: I let the particle stop a little bit earlier than the true computed collision point to avoid the case that the particle is stucking inside the voxel
+                    // caused by floating point error
+                    // get the collision point
+                    glm::vec3 collision_point = old_position + (t_current)*ray_direction * 0.999f;// some trick
+                    //new_position = collision_point;
+                    //std::vector<float> collide_voxel_6_face = voxel_to_world_6_face(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);
+                    std::vector<float> collide_voxel_6_face = voxel_to_world_6_face_extend(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);//trick version
+                    // reverse the velocity  component that is in the direction of the collision face
+                    if (x_or_y_or_z == 0) {
+                        new_position.x = collide_voxel_6_face[(1 + sign_x) / 2];
+                        new_velocity.x = -old_velocity.x;
+                        collision_point.x = new_position.x;
+                    }
+                    else if (x_or_y_or_z == 1) {
+                        new_position.y = collide_voxel_6_face[(5 + sign_y) / 2];
+                        new_velocity.y = -old_velocity.y;
+                        collision_point.y = new_position.y;
+                    }
+                    else if (x_or_y_or_z == 2) {
+                        new_position.z = collide_voxel_6_face[(9 + sign_z) / 2];
+                        new_velocity.z = -old_velocity.z;
+                        collision_point.z = new_position.z;
+                    }
+                    new_velocity *= 0.5f;
 
-        // exclude NAN
-        if (std::isnan(t_next_x)) {
-            t_next_x = INFINITY;
-        }
-        if (std::isnan(t_next_y)) {
-            t_next_y = INFINITY;
-        }
-        if (std::isnan(t_next_z)) {
-            t_next_z = INFINITY;
-        }
+                    // quickly detect if the particle's new bounced position is still inside the voxel (just fast approximation, not physical based)
+                    current_voxel_index = world_to_voxel(old_position, V);
+                    current_v = &V.get_voxel(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);
+                    if (current_v->exist) {
+                        new_position = collision_point;
+                    }
 
-        // if it is already inside a voxel, then try push it out (I cannot fix this bug by avoiding all the stucking inside possibilities, so just push it out)
-        if (current_v->exist) {
-            new_velocity = glm::vec3(0);
-            //new_velocity *= -1.0f;
-            glm::vec3 push_direction = glm::normalize(new_position - voxel_to_world(begin_voxel_index[0], begin_voxel_index[1], begin_voxel_index[2]));
-            float push_distance = voxel_size_scale * 0.005f;
-            new_position = old_position + push_distance * push_direction;
-            p[i].currPos = new_position;
-            p[i].velocity = new_velocity;
 
-        }
+                    break;
+                }
 
+            }
 
-        // 6. recursively check the voxel in the ray direction, if the voxel is occupied, 
-        // then it collides, reverse the velocity and stop the particle at(/before) the collision point
-        while ((t_current <= t_end) && !current_v->exist) {
-            float t_min_next = glm::min(t_next_x, glm::min(t_next_y, t_next_z));
-            int x_or_y_or_z = -1; // 0 for x, 1 for y, 2 for z, indicating which direction is the next voxel
-            t_current += t_min_next;
-            if (t_current > t_end) {
-                break;
+            // check collision with the bounding box
+            if (new_position.y < y_min)
+            {
+                new_position.y = y_min;
+                new_velocity.y *= -1 * wall_damping;
             }
-            if (t_min_next == t_next_x)
+            else if (new_position.y > y_max)
             {
-                x_or_y_or_z = 0;
-                t_next_x += delta_t_x;
-                current_voxel_index[0] += sign_x;
-                if (current_voxel_index[0] < 0 || current_voxel_index[0] >= V.x_size)
-                    break;
+                new_position.y = y_max;
+                new_velocity.y *= -1 * wall_damping;
             }
-            else if (t_min_next == t_next_y)
+            if (new_position.x < x_min)
             {
-                x_or_y_or_z = 1;
-                t_next_y += delta_t_y;
-                current_voxel_index[1] += sign_y;
-                if (current_voxel_index[1] < 0 || current_voxel_index[1] >= V.y_size)
-                    break;
+                recycle(i);
+                new_position.x = x_min;
+                new_velocity.x *= -1 * wall_damping;
             }
-            else if (t_min_next == t_next_z)
+            else if (new_position.x > x_max)
             {
-                x_or_y_or_z = 2;
-                t_next_z += delta_t_z;
-                current_voxel_index[2] += sign_z;
-                if (current_voxel_index[2] < 0 || current_voxel_index[2] >= V.z_size)
-                    break;
+                recycle(i);
+                new_position.x = x_max;
+                new_velocity.x *= -1 * wall_damping;
             }
-            else
+            if (new_position.z < z_min)
             {
-                std::cout << "error in 3D-DDA ray delta" << t_min_next << t_next_x << "," << t_next_y << "," << t_next_z << std::endl;
-                break;
+                recycle(i);
+                new_position.z = z_min;
+                new_velocity.z *= -1 * wall_damping;
             }
-
-            current_v = &V.get_voxel(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);
-            if (current_v->exist) {
-                // TRICK: I let the particle stop a little bit earlier than the true computed collision point to avoid the case that the particle is stucking inside the voxel
-                // caused by floating point error
-                // get the collision point
-                glm::vec3 collision_point = old_position + (t_current)*ray_direction * 0.999f;// some trick
-                //new_position = collision_point;
-                //std::vector<float> collide_voxel_6_face = voxel_to_world_6_face(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);
-                std::vector<float> collide_voxel_6_face = voxel_to_world_6_face_extend(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);//trick version
-                // reverse the velocity  component that is in the direction of the collision face
-                if (x_or_y_or_z == 0) {
-                    new_position.x = collide_voxel_6_face[(1 + sign_x) / 2];
-                    new_velocity.x = -old_velocity.x;
-                    collision_point.x = new_position.x;
-                }
-                else if (x_or_y_or_z == 1) {
-                    new_position.y = collide_voxel_6_face[(5 + sign_y) / 2];
-                    new_velocity.y = -old_velocity.y;
-                    collision_point.y = new_position.y;
-                }
-                else if (x_or_y_or_z == 2) {
-                    new_position.z = collide_voxel_6_face[(9 + sign_z) / 2];
-                    new_velocity.z = -old_velocity.z;
-                    collision_point.z = new_position.z;
-                }
-                new_velocity *= 0.5f;
-
-                // quickly detect if the particle's new bounced position is still inside the voxel (just fast approximation, not physical based)
-                current_voxel_index = world_to_voxel(old_position, V);
-                current_v = &V.get_voxel(current_voxel_index[0], current_voxel_index[1], current_voxel_index[2]);
-                if (current_v->exist) {
-                    new_position = collision_point;
-                }
-
-
-                break;
+            else if (new_position.z > z_max)
+            {
+                recycle(i);
+                new_position.z = z_max;
+                new_velocity.z *= -1 * wall_damping;
             }
 
-        }
+            p[i].velocity = new_velocity;
+            p[i].currPos = new_position;
 
-        // check collision with the bounding box
-        if (new_position.y < y_min)
-        {
-            new_position.y = y_min;
-            new_velocity.y *= -1 * wall_damping;
-        }
-        else if (new_position.y > y_max)
-        {
-            new_position.y = y_max;
-            new_velocity.y *= -1 * wall_damping;
-        }
-        if (new_position.x < x_min)
-        {
-            recycle_list.push_back(i);
-            new_position.x = x_min;
-            new_velocity.x *= -1 * wall_damping;
-        }
-        else if (new_position.x > x_max)
-        {
-            recycle_list.push_back(i);
-            new_position.x = x_max;
-            new_velocity.x *= -1 * wall_damping;
-        }
-        if (new_position.z < z_min)
-        {
-            recycle_list.push_back(i);
-            new_position.z = z_min;
-            new_velocity.z *= -1 * wall_damping;
-        }
-        else if (new_position.z > z_max)
-        {
-            recycle_list.push_back(i);
-            new_position.z = z_max;
-            new_velocity.z *= -1 * wall_damping;
-        }
+            // esitmation of the velocity
+            p[i].estimated_velocity = (p[i].estimated_velocity) * 0.5f + (p[i].currPos - p[i].prevPos) / frameTimeDiff * 0.5f;
+
+            // // ------simplest collision detection, just reverse the velocity if this pos has a voxel------
+            // std::vector<int> voxel_index = world_to_voxel(new_position,V);
+            // int x = voxel_index[0];
+            // int y = voxel_index[1];
+            // int z = voxel_index[2];
+            // // avoid some cases that the voxel index is out of bound
+            // /*if (x < 0) {
+            // 	x = 0;
+            // }*/
+            // 
+            // //std::cout << x << " " << y << " " << z << std::endl;
+            // voxel & v = V.get_voxel(x, y, z);
+            // if (v.exist) {
+            //     
+            //     std::cout << "collision" << std::endl;
+            //     v.color = glm::vec4(1.f, 0.f, 0.f, 1.0f);
+            //     new_velocity.x = -new_velocity.x;
+            //     new_velocity.y = -new_velocity.y;
+            //     new_velocity.z = -new_velocity.z;
+            //     p[i].velocity = new_velocity;
+            // 
+            // }
 
-        p[i].velocity = new_velocity;
-        p[i].currPos = new_position;
-
-        // esitmation of the velocity
-        p[i].estimated_velocity = (p[i].estimated_velocity) * 0.5f + (p[i].currPos - p[i].prevPos) / frameTimeDiff * 0.5f;
-
-        // // ------simplest collision detection, just reverse the velocity if this pos has a voxel------
-        // std::vector<int> voxel_index = world_to_voxel(new_position,V);
-        // int x = voxel_index[0];
-        // int y = voxel_index[1];
-        // int z = voxel_index[2];
-        // // avoid some cases that the voxel index is out of bound
-        // /*if (x < 0) {
-        // 	x = 0;
-        // }*/
-        // 
-        // //std::cout << x << " " << y << " " << z << std::endl;
-        // voxel & v = V.get_voxel(x, y, z);
-        // if (v.exist) {
-        //     
-        //     std::cout << "collision" << std::endl;
-        //     v.color = glm::vec4(1.f, 0.f, 0.f, 1.0f);
-        //     new_velocity.x = -new_velocity.x;
-        //     new_velocity.y = -new_velocity.y;
-        //     new_velocity.z = -new_velocity.z;
-        //     p[i].velocity = new_velocity;
-        // 
-        // }
+        }
+    });
 
-    }
+    // the threads append in any order, sort so the particles are respawned in the same order on every run
+    std::sort(recycle_list.begin() + recycle_begin, recycle_list.end());
 
     // std::cout << "velocity: " << p[0].velocity.x <<" " << p[0].velocity.y << " " << p[0].velocity.z << std::endl;
     // std::cout << "true velocity: " << (p[0].currPos.x - p[0].prevPos.x)/frameTimeDiff << " " << (p[0].currPos.y - p[0].prevPos.y) / frameTimeDiff << " " << (p[0].currPos.z - p[0].prevPos.z) / frameTimeDiff << std::endl;
@@ -926,8 +998,12 @@ void calculate_SPH_movement(std::vector<particle>& p, float frameTimeDiff, voxel
     //     std::vector<int> grid_index = G.world_to_grid(p[i].currPos);
     //     G.add_particle(grid_index[0], grid_index[1], grid_index[2], i);
     // }
+}
 
-    // diffusion and stuck check
+// diffusion of the carried mass to the lower neighbours, and stuck check
+void diffuse_particle_mass(std::vector<particle>& p, int particle_num, float frameTimeDiff, neighbourhood_grid& G) {
+    profile_scope scope(PHASE_DIFFUSION);
+    perf_scope counters(PHASE_DIFFUSION);
     //#pragma omp parallel for
     for (int i = 0; i < particle_num; i++) {
         std::vector<int> current_grid = G.world_to_grid(p[i].currPos);
@@ -972,9 +1048,63 @@ void calculate_SPH_movement(std::vector<particle>& p, float frameTimeDiff, voxel
 
 }
 
+void calculate_SPH_movement(std::vector<particle>& p, float frameTimeDiff, voxel_field& V, neighbourhood_grid& G, std::vector<int>& recycle_list) {
+    memory_scope memory(MEMORY_SIMULATION);
+    int particle_num = std::min(current_particle_num, (int)p.size());
+    //std::cout << "particle_num: " << particle_num << std::endl;
+    // int particle_num = p.size();
+    //refresh_debug(V);
+    // first, re-genereate the neighbourhood grid
+    build_neighbour_grid(p, particle_num, G);
+    calculate_density(p, particle_num, G);
+    calculate_force(p, particle_num, G);
+    integrate_particles(p, particle_num, frameTimeDiff, V, recycle_list);
+    diffuse_particle_mass(p, particle_num, frameTimeDiff, G);
+}
+
+void add_step_tasks(task_graph& graph, std::vector<particle>& p, const float& dt, voxel_field& V, neighbourhood_grid& G,
+                    std::vector<int>& recycle_list, bool& grid_current) {
+    // current_particle_num grows between the runs, so it is read when the tasks run
+    auto particle_num = [&p] { return std::min(current_particle_num, (int)p.size()); };
+    graph.add("grid build", [&, particle_num] {
+        memory_scope memory(MEMORY_SIMULATION);
+        if (!grid_current) {
+            build_neighbour_grid(p, particle_num(), G);
+        }
+        grid_current = false;
+    }, DATA_POSITIONS, DATA_GRID, TASK_CALLER_THREAD);
+    graph.add("density", [&, particle_num] {
+        memory_scope memory(MEMORY_SIMULATION);
+        calculate_density(p, particle_num(), G);
+    }, DATA_GRID | DATA_POSITIONS | DATA_MASS, DATA_SPH_STATE, TASK_CALLER_THREAD);
+    graph.add("force", [&, particle_num] {
+        memory_scope memory(MEMORY_SIMULATION);
+        calculate_force(p, particle_num(), G);
+    }, DATA_GRID | DATA_POSITIONS | DATA_MASS | DATA_SPH_STATE, DATA_SPH_STATE, TASK_CALLER_THREAD);
+    graph.add("integrate", [&, particle_num] {
+        memory_scope memory(MEMORY_SIMULATION);
+        integrate_particles(p, particle_num(), dt, V, recycle_list);
+    }, DATA_SPH_STATE | DATA_VOXELS, DATA_POSITIONS | DATA_RECYCLE_LIST, TASK_CALLER_THREAD);
+    graph.add("diffusion", [&, particle_num] {
+        memory_scope memory(MEMORY_SIMULATION);
+        diffuse_particle_mass(p, particle_num(), dt, G);
+    }, DATA_GRID | DATA_POSITIONS | DATA_SPH_STATE, DATA_MASS, TASK_CALLER_THREAD);
+    graph.add("erosion", [&] {
+        memory_scope memory(MEMORY_SIMULATION);
+        calculate_voxel_erosion(p, dt, V, G, recycle_list);
+    }, DATA_GRID | DATA_POSITIONS | DATA_SPH_STATE, DATA_MASS | DATA_VOXELS | DATA_VOXEL_STAMPS | DATA_RECYCLE_LIST, TASK_CALLER_THREAD);
+    graph.add("recycle", [&] {
+        recycle_particle(p, recycle_list);
+    }, 0, DATA_PARTICLES | DATA_RECYCLE_LIST, TASK_CALLER_THREAD);
+}
+
+
 void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxel_field& V, neighbourhood_grid& G, std::vector<int>& recycle_list) {
     float voxel_pressure_range = smoothing_length * 2.0;
     float voxel_deposition_range = smoothing_length * 2.0;
+    profile_scope scope(PHASE_EROSION);
+    perf_scope counters(PHASE_EROSION);
+    memory_scope memory(MEMORY_SIMULATION);
     //#pragma omp parallel for collapse(3)  // unfortunately, simple parallelization does not work here when deposition is calculated
     for (int i = 0; i < V.x_size; i++) {
         int G_x = i;
@@ -997,6 +1127,7 @@ void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxe
                                 float weight = length(p[n].mass * (p[n].pamameters[1]) / (p[n].pamameters[0]) * -45.f / (PI_FLOAT * glm::pow(voxel_pressure_range, 6.f)) * glm::pow(voxel_pressure_range - r, 2.f) * glm::normalize(delta));
                                 v->density -= frameTimeDiff * voxel_damage_scale * weight;
                                 v->update_color();
+                                V.mark_dirty(i, j, k);
 
                                 // particles gain mass from voxels (carry the mass)
                                 p[n].mass += frameTimeDiff * particle_mass_transfer_ratio * weight;
@@ -1007,6 +1138,7 @@ void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxe
                             if (v->density < voxel_destroy_density_threshold) {
                                 v->exist = false;
                                 v->color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+                                V.mark_dirty(i, j, k);
                             }
 
                         }
@@ -1020,6 +1152,7 @@ void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxe
                                 float weight = length(p[n].mass * (p[n].pamameters[1]) / (p[n].pamameters[0]) * -45.f / (PI_FLOAT * glm::pow(voxel_pressure_range, 6.f)) * glm::pow(voxel_pressure_range - r, 2.f) * glm::normalize(delta));
                                 v->density -= frameTimeDiff * voxel_damage_scale * weight;
                                 v->update_color();
+                                V.mark_dirty(i, j, k);
 
                                 // particles gain mass from voxels (carry the mass)
                                 p[n].mass += frameTimeDiff * particle_mass_transfer_ratio * weight;
@@ -1051,6 +1184,7 @@ void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxe
                             if (v->density < voxel_maximum_density) {// if the voxel is not full, then it can gain mass
                                 v->density += frameTimeDiff * voxel_damage_scale * weight;
                                 v->update_color();
+                                V.mark_dirty(i, j, k);
                                 // particles lose mass
                                 p[n].mass -= frameTimeDiff * particle_mass_transfer_ratio * weight;
 
@@ -1070,6 +1204,8 @@ void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxe
                                         // the current voxel loses a part of the mass and share it to the new voxel
                                         v->density -= upper_v->density;
                                         v->update_color();
+                                        V.mark_dirty(i, j, k);
+                                        V.mark_dirty(upper_voxel_x, upper_voxel_y, upper_voxel_z);
                                         // then, we need to destroy and re-create the particles that are inside the new voxel
                                         // let's first break this for loop and find out which particles are inside the new voxel,
                                         new_voxel_created = true;
@@ -1098,6 +1234,7 @@ void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxe
                                 new_V->density += (p[n].mass - particle_mass) * voxel_damage_scale / particle_mass_transfer_ratio;
                                 new_V->is_new = true;
                                 new_V->update_color();
+                                V.mark_dirty(i, j + 1, k);
                                 // clear particles mass
                                 p[n].mass = particle_mass;
                                 recycle_list.push_back(n);
@@ -1120,6 +1257,8 @@ void calculate_voxel_erosion(std::vector<particle>& p, float frameTimeDiff, voxe
 }
 
 void recycle_particle(std::vector<particle>& p, std::vector<int>& recycle_list) {
+    profile_scope scope(PHASE_RECYCLE);
+    perf_scope counters(PHASE_RECYCLE);
     particle p1;
     p1.prevPos = glm::vec3(0.0f, 0.0f, 0.0f);
     p1.velocity = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -0,0 +1,64 @@
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include <physics.h>
+
+
+// for each particle, calculate the density and pressure
+void reference_density(std::vector<particle>& p, int particle_num) {
+    for (int i = 0; i < particle_num; i++) {
+        int cnt = 0;
+        float density_sum = 0.f;
+        for (int j = 0; j < particle_num; j++) {
+            glm::vec3 delta = (p[i].currPos - p[j].currPos);
+            float r = length(delta);
+            if (r < smoothing_length)
+            {
+                cnt++;
+                density_sum += p[j].mass * /* poly6 kernel */ 315.f * glm::pow(smoothing_length * smoothing_length - r * r, 3.f) / (64.f * PI_FLOAT * glm::pow(smoothing_length, 9));
+            }
+        }
+        p[i].pamameters[0] = density_sum;
+        p[i].pamameters[1] = glm::max(particle_stiffness * (density_sum - particle_resting_density), 0.f);
+        p[i].pamameters[2] = float(cnt);
+    }
+}
+
+// for each particle, calculate the force and acceleration
+void reference_force(std::vector<particle>& p, int particle_num) {
+    for (int i = 0; i < particle_num; i++) {
+        glm::vec3 pressure_force = glm::vec3(0.0f, 0.0f, 0.0f);
+        glm::vec3 viscosity_force = glm::vec3(0.0f, 0.0f, 0.0f);
+        glm::vec3 dCs = glm::vec3(0.0f, 0.0f, 0.0f);
+        for (int j = 0; j < particle_num; j++) {
+            if (i == j) {
+                continue;
+            }
+            glm::vec3 delta = (p[i].currPos - p[j].currPos);
+            float r = length(delta);
+            if (r < smoothing_length) {
+                if (r == 0.0f) {
+                    // if the two particles are at the same position, use the same small delta as the grid version to avoid NaN
+                    delta = overlap_jitter(i, j);
+                }
+                // calculate the pressure force
+                pressure_force -= p[i].mass * (p[i].pamameters[1] + p[j].pamameters[1]) / (2.f * p[j].pamameters[0]) *
+                    // gradient of spiky kernel
+                    -45.f / (PI_FLOAT * glm::pow(smoothing_length, 6.f)) * glm::pow(smoothing_length - r, 2.f) * glm::normalize(delta);
+                // calculate the viscosity force
+                viscosity_force += p[j].mass * (p[j].velocity - p[i].velocity) / p[j].pamameters[0] *
+                    // Laplacian of viscosity kernel
+                    45.f / (PI_FLOAT * glm::pow(smoothing_length, 6.f)) * (smoothing_length - r);
+
+                dCs -= p[j].mass * glm::pow(smoothing_length * smoothing_length - r * r, 2.f) / p[j].pamameters[0] *
+                    // Poly6 kernel
+                    945.f / (32.f * PI_FLOAT * glm::pow(smoothing_length, 9.f)) * delta;
+            }
+        }
+
+        viscosity_force *= particle_viscosity;
+        p[i].acceleration = glm::vec3((pressure_force / p[i].pamameters[0] + viscosity_force / p[i].pamameters[0] + gravity_force));
+        p[i].deltaCs = glm::vec3(glm::normalize(dCs));
+    }
+}
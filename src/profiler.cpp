@@ -0,0 +1,168 @@
+#include <iostream>
+#include <algorithm>
+
+#include <profiler.h>
+
+
+profiler global_profiler;
+
+const char* const profile_phase_names[PHASE_COUNT] = {
+    "grid build",
+    "density",
+    "force",
+    "integrate+DDA",
+    "diffusion",
+    "erosion",
+    "recycle",
+    "instance build",
+    "GPU upload",
+    "draw",
+    "simulation step",
+    "step critical path",
+    "frame",
+};
+
+std::string profile_phase_key(profile_phase phase) {
+    std::string key = profile_phase_names[phase];
+    for (char& c : key) {
+        if (c == ' ' || c == '+') {
+            c = '_';
+        }
+    }
+    return key;
+}
+
+
+profiler::~profiler() {
+    stop_csv();
+}
+
+profiler::thread_slots& profiler::local_slots() {
+    // the slots are shared with the profiler, so they outlive a thread that exits mid-frame
+    thread_local std::shared_ptr<thread_slots> slots;
+    if (!slots) {
+        slots = std::make_shared<thread_slots>();
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        threads.push_back(slots);
+    }
+    return *slots;
+}
+
+void profiler::add(profile_phase phase, uint64_t nanoseconds) {
+    local_slots().nanoseconds[phase].fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+void profiler::add_worker(profile_phase phase, uint64_t nanoseconds) {
+    local_slots().worker_nanoseconds[phase].fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+void profiler::end_frame() {
+    uint64_t total[PHASE_COUNT] = {};
+    uint64_t worker_max[PHASE_COUNT] = {}, worker_sum[PHASE_COUNT] = {};
+    int workers[PHASE_COUNT] = {};
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        for (auto& t : threads) {
+            for (int i = 0; i < PHASE_COUNT; i++) {
+                total[i] += t->nanoseconds[i].exchange(0, std::memory_order_relaxed);
+                uint64_t worked = t->worker_nanoseconds[i].exchange(0, std::memory_order_relaxed);
+                if (worked > 0) {
+                    worker_max[i] = std::max(worker_max[i], worked);
+                    worker_sum[i] += worked;
+                    workers[i]++;
+                }
+            }
+        }
+    }
+    int slot = frames % history_size;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        samples[i][slot] = float(total[i] * 1e-6);
+        imbalance[i][slot] = workers[i] > 0 ? float(double(worker_max[i]) * workers[i] / double(worker_sum[i])) : 0.0f;
+    }
+    if (csv != nullptr) {
+        std::fprintf(csv, "%d", frames);
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            std::fprintf(csv, ",%.4f", samples[i][slot]);
+        }
+        std::fprintf(csv, "\n");
+    }
+    frames++;
+}
+
+std::vector<float> profiler::history(profile_phase phase) const {
+    int count = std::min(frames, history_size);
+    std::vector<float> h(count);
+    for (int n = 0; n < count; n++) {
+        h[n] = samples[phase][(frames - count + n) % history_size];
+    }
+    return h;
+}
+
+profile_stats profiler::stats(profile_phase phase) const {
+    profile_stats s;
+    std::vector<float> h = history(phase);
+    if (h.empty()) {
+        return s;
+    }
+    s.last = h.back();
+    double sum = 0.0;
+    for (float v : h) {
+        sum += v;
+    }
+    s.mean = float(sum / h.size());
+    s.min = *std::min_element(h.begin(), h.end());
+    auto percentile = [&h](float q) {
+        size_t n = std::min(h.size() - 1, size_t(q * (h.size() - 1) + 0.5f));
+        std::nth_element(h.begin(), h.begin() + n, h.end());
+        return h[n];
+    };
+    s.p50 = percentile(0.5f);
+    s.p99 = percentile(0.99f);
+    int count = std::min(frames, history_size), measured = 0;
+    double imbalance_sum = 0.0;
+    for (int n = 0; n < count; n++) {
+        float v = imbalance[phase][(frames - count + n) % history_size];
+        if (v > 0.0f) {
+            imbalance_sum += v;
+            measured++;
+        }
+    }
+    s.imbalance = measured > 0 ? float(imbalance_sum / measured) : 0.0f;
+    return s;
+}
+
+bool profiler::start_csv(const std::string& path) {
+    stop_csv();
+    csv = std::fopen(path.c_str(), "w");
+    if (csv == nullptr) {
+        std::cout << "profiler: cannot open " << path << std::endl;
+        return false;
+    }
+    std::fprintf(csv, "frame");
+    for (const char* name : profile_phase_names) {
+        std::fprintf(csv, ",%s ms", name);
+    }
+    std::fprintf(csv, "\n");
+    return true;
+}
+
+void profiler::stop_csv() {
+    if (csv != nullptr) {
+        std::fclose(csv);
+        csv = nullptr;
+    }
+}
+
+bool profiler::write_summary_csv(const std::string& path) const {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::cout << "profiler: cannot open " << path << std::endl;
+        return false;
+    }
+    std::fprintf(file, "phase,frames,min ms,mean ms,p50 ms,p99 ms,imbalance\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        profile_stats s = stats(profile_phase(i));
+        std::fprintf(file, "%s,%d,%.4f,%.4f,%.4f,%.4f,%.3f\n", profile_phase_names[i], std::min(frames, history_size), s.min, s.mean, s.p50, s.p99, s.imbalance);
+    }
+    return std::fclose(file) == 0;
+}
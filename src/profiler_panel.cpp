@@ -0,0 +1,239 @@
+#include <filesystem>
+#include <algorithm>
+#include <cfloat>
+
+#include "imgui/imgui.h"
+#include <profiler.h>
+#include <perf_counters.h>
+#include <memory_tracker.h>
+#include <task_graph.h>
+#include <render_data.h>
+#include <voxel_mesh.h>
+#include <culling.h>
+
+
+// kept apart from profiler.cpp so targets without ImGui can still use the profiler
+void draw_profiler_panel(profiler& prof) {
+    ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(590, 330), ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("PROFILER")) {
+        ImGui::Text("last %d frames, milliseconds", std::min(prof.frame_count(), profiler::history_size));
+        if (ImGui::BeginTable("phases", 7, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("phase");
+            ImGui::TableSetupColumn("last");
+            ImGui::TableSetupColumn("min");
+            ImGui::TableSetupColumn("mean");
+            ImGui::TableSetupColumn("p50");
+            ImGui::TableSetupColumn("p99");
+            ImGui::TableSetupColumn("imbalance"); // busiest thread / mean thread
+            ImGui::TableHeadersRow();
+            for (int i = 0; i < PHASE_COUNT; i++) {
+                profile_stats s = prof.stats(profile_phase(i));
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(profile_phase_names[i]);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", s.last);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", s.min);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", s.mean);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", s.p50);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", s.p99);
+                ImGui::TableNextColumn();
+                if (s.imbalance > 0.0f) {
+                    ImGui::Text("%.2f", s.imbalance);
+                }
+            }
+            ImGui::EndTable();
+        }
+
+        static int plotted = PHASE_FRAME;
+        ImGui::Combo("history", &plotted, profile_phase_names, PHASE_COUNT);
+        std::vector<float> h = prof.history(profile_phase(plotted));
+        ImGui::PlotHistogram("##history", h.data(), int(h.size()), 0, nullptr, 0.0f, FLT_MAX, ImVec2(-1, 60));
+
+        if (!prof.recording_csv()) {
+            if (ImGui::Button("record CSV")) {
+                std::filesystem::create_directories("out");
+                prof.start_csv("out/profile.csv");
+            }
+        } else if (ImGui::Button("stop CSV")) {
+            prof.stop_csv();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("export summary")) {
+            std::filesystem::create_directories("out");
+            prof.write_summary_csv("out/profile_summary.csv");
+        }
+    }
+    ImGui::End();
+}
+
+// appended to the profiler window, the phases of the simulation step per frame and per particle
+void draw_perf_counters(perf_counters& counters, int particle_num) {
+    if (ImGui::Begin("PROFILER")) {
+        ImGui::Separator();
+        if (!counters.active()) {
+            if (ImGui::Button("enable hardware counters")) {
+                counters.enable();
+            }
+            ImGui::SameLine();
+            ImGui::TextUnformatted(counters.status().c_str());
+        }
+        else {
+            if (ImGui::Button("disable hardware counters")) {
+                counters.disable();
+            }
+            ImGui::SameLine();
+            ImGui::Text("%s, mean of %d frames, per particle", counters.status().c_str(), counters.frame_count());
+            if (ImGui::BeginTable("counters", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+                ImGui::TableSetupColumn("phase");
+                ImGui::TableSetupColumn("IPC");
+                ImGui::TableSetupColumn("cycles");
+                ImGui::TableSetupColumn("LLC misses");
+                ImGui::TableSetupColumn("branch misses");
+                ImGui::TableHeadersRow();
+                double per_particle = 1.0 / std::max(particle_num, 1);
+                for (int i = PHASE_GRID_BUILD; i <= PHASE_RECYCLE; i++) {
+                    perf_phase_stats s = counters.stats(profile_phase(i));
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    // a multiplexed phase was only counted part of the time, its counts are scaled estimates
+                    ImGui::Text("%s%s", profile_phase_names[i], s.multiplexed ? " (multiplexed)" : "");
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", s.ipc());
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.0f", s.value[PERF_CYCLES] * per_particle);
+                    ImGui::TableNextColumn();
+                    if (s.available[PERF_LLC_MISSES]) {
+                        ImGui::Text("%.2f", s.value[PERF_LLC_MISSES] * per_particle);
+                    } else {
+                        ImGui::TextUnformatted("-");
+                    }
+                    ImGui::TableNextColumn();
+                    if (s.available[PERF_BRANCH_MISSES]) {
+                        ImGui::Text("%.2f", s.value[PERF_BRANCH_MISSES] * per_particle);
+                    } else {
+                        ImGui::TextUnformatted("-");
+                    }
+                }
+                ImGui::EndTable();
+            }
+        }
+    }
+    ImGui::End();
+}
+
+// appended to the profiler window, live and peak bytes and allocations of the last frame per tag
+void draw_memory_stats(memory_tracker& tracker) {
+    if (ImGui::Begin("PROFILER")) {
+        ImGui::Separator();
+        if (!memory_tracker::enabled) {
+            ImGui::TextUnformatted("memory: configure with -DMEMORY_TRACKING=1 to count allocations");
+        }
+        else if (ImGui::BeginTable("memory", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("memory");
+            ImGui::TableSetupColumn("MB");
+            ImGui::TableSetupColumn("peak MB");
+            ImGui::TableSetupColumn("allocations / frame");
+            ImGui::TableHeadersRow();
+            auto row = [](const char* name, const memory_tag_stats& s) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(name);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", s.bytes / (1024.0 * 1024.0));
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", s.peak_bytes / (1024.0 * 1024.0));
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long)s.frame_allocations);
+            };
+            for (int i = 0; i < MEMORY_TAG_COUNT; i++) {
+                row(memory_tag_names[i], tracker.stats(i));
+            }
+            row("total", tracker.total());
+            ImGui::EndTable();
+        }
+    }
+    ImGui::End();
+}
+
+// appended to the profiler window, the tasks of a run of the step graph on a time line, the critical path in red
+void draw_task_graph(const task_graph_timings& timings) {
+    if (ImGui::Begin("PROFILER")) {
+        ImGui::Separator();
+        double ms = 1e-6;
+        ImGui::Text("step graph: wall %.3f ms, critical path %.3f ms, work %.3f ms",
+                    timings.wall * ms, timings.critical_path * ms, timings.work * ms);
+        ImGui::TextWrapped("critical path: %s", timings.critical_path_names().c_str());
+        if (timings.wall > 0 && ImGui::BeginTable("tasks", 2, ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("task");
+            ImGui::TableSetupColumn("timeline", ImGuiTableColumnFlags_WidthStretch);
+            for (int t = 0; t < timings.task_count(); t++) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(timings.names[t]);
+                ImGui::TableNextColumn();
+                ImVec2 origin = ImGui::GetCursorScreenPos();
+                float width = ImGui::GetContentRegionAvail().x;
+                float height = ImGui::GetTextLineHeight();
+                float scale = width / float(timings.wall);
+                ImVec2 a(origin.x + timings.begin[t] * scale, origin.y);
+                ImVec2 b(std::max(origin.x + timings.end[t] * scale, a.x + 1.0f), origin.y + height);
+                ImU32 color = timings.critical[t] ? IM_COL32(220, 60, 60, 255) : IM_COL32(90, 140, 220, 255);
+                ImGui::GetWindowDrawList()->AddRectFilled(a, b, color);
+                ImGui::Dummy(ImVec2(width, height));
+            }
+            ImGui::EndTable();
+        }
+    }
+    ImGui::End();
+}
+
+// appended to the profiler window, voxel instances and upload against drawing and uploading every existing voxel
+void draw_voxel_stats(const voxel_instance_data& instances, const voxel_gpu_state& gpu) {
+    if (ImGui::Begin("PROFILER")) {
+        ImGui::Separator();
+        double all_bytes = double(sizeof(GLfloat)) * 6 * instances.solid;
+        ImGui::Text("voxels: %d drawn of %d existing (%.1f%%)%s", instances.count, instances.solid,
+                    instances.solid > 0 ? 100.0 * instances.count / instances.solid : 0.0, SURFACE_VOXELS ? "" : ", SURFACE_VOXELS=0");
+        ImGui::Text("voxel upload: %.1f KB this frame, %.1f KB for every existing voxel", gpu.upload_bytes / 1024.0, all_bytes / 1024.0);
+    }
+    ImGui::End();
+}
+
+// appended to the profiler window, the chunk meshes of TERRAIN_MESH
+void draw_terrain_stats(const std::vector<std::shared_ptr<const chunk_mesh>>& meshes, int remeshed_chunks, uint64_t upload_bytes) {
+    if (ImGui::Begin("PROFILER")) {
+        ImGui::Separator();
+        long long quads = 0, faces = 0;
+        for (const auto& mesh : meshes) {
+            if (mesh) {
+                quads += mesh->quad_count();
+                faces += mesh->face_count;
+            }
+        }
+        ImGui::Text("terrain mesh: %lld quads for %lld voxel faces, %d of %d chunks meshed by the last step", quads, faces, remeshed_chunks, int(meshes.size()));
+        ImGui::Text("terrain upload: %.1f KB this frame", upload_bytes / 1024.0);
+    }
+    ImGui::End();
+}
+
+// appended to the profiler window, what the culling of this frame kept
+void draw_cull_stats(const cull_stats& stats) {
+    if (ImGui::Begin("PROFILER")) {
+        ImGui::Separator();
+        auto percent = [](int part, int all) { return all > 0 ? 100.0 * part / all : 0.0; };
+        ImGui::Text("culling: %d of %d cells in view%s", stats.visible_cells, stats.cells, CULLING ? "" : ", CULLING=0");
+        if (TERRAIN_MESH) {
+            ImGui::Text("chunks: %d of %d drawn (%.1f%%)", stats.visible_chunks, stats.chunks, percent(stats.visible_chunks, stats.chunks));
+        } else {
+            ImGui::Text("voxel instances: %d of %d drawn (%.1f%%)", stats.visible_voxels, stats.voxels, percent(stats.visible_voxels, stats.voxels));
+        }
+        ImGui::Text("particles: %d of %d drawn (%.1f%%)", stats.visible_particles, stats.particles, percent(stats.visible_particles, stats.particles));
+    }
+    ImGui::End();
+}
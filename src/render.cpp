@@ -5,12 +5,19 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
+#include <cstddef>
+#include <cstring>
 #include <vector>
 #include <unordered_map>
 #include <chrono>
 #include <glm/gtx/hash.hpp>
 
 #include <data_structures.h>
+#include <profiler.h>
+#include <render_data.h>
+#include <voxel_mesh.h>
+#include <instance_ring.h>
+#include <culling.h>
 
 
 
@@ -361,7 +368,7 @@ void render_cube(Shader& ourShader, unsigned int cube_VBO[2], unsigned int cube_
 
 
 //// render a single cube given transformation matrix 'model'
-void render_cube_instanced(Shader& ourShader, unsigned int cube_VAO[2], GLsizei intance_num, unsigned int voxel_instance_VBO, GLfloat* voxel_instance_data, glm::mat4 scale) {
+void render_cube_instanced(Shader& ourShader, unsigned int cube_VAO[2], GLsizei intance_num, unsigned int voxel_instance_VBO, const GLfloat* voxel_instances, glm::mat4 scale) {
     // activate selected shader
     ourShader.use();
     glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, z_near, z_far);
@@ -373,9 +380,12 @@ void render_cube_instanced(Shader& ourShader, unsigned int cube_VAO[2], GLsizei
     // ---render cube body
     glBindVertexArray(cube_VAO[0]);
 
-    // update particle position
-    glBindBuffer(GL_ARRAY_BUFFER, voxel_instance_VBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * 6 * intance_num, voxel_instance_data);
+    // update particle position, nullptr when the caller keeps the buffer up to date itself
+    if (voxel_instances != nullptr) {
+        profile_scope scope(PHASE_GPU_UPLOAD);
+        glBindBuffer(GL_ARRAY_BUFFER, voxel_instance_VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * 6 * intance_num, voxel_instances);
+    }
 
     // render back faces to represnet contours
     ourShader.setBool("is_black", false);
@@ -393,7 +403,7 @@ void render_cube_instanced(Shader& ourShader, unsigned int cube_VAO[2], GLsizei
 
 
 // set up particle rendering, instanced rendering
-void set_up_particle_rendering(unsigned int& sphereVBO, unsigned int& sphereVAO, unsigned int& sphereEBO, unsigned int& particle_instance_VBO) {
+void set_up_particle_rendering(unsigned int& sphereVBO, unsigned int& sphereVAO, unsigned int& sphereEBO, instance_ring& particle_instances) {
     // generate sphere vertices
     std::vector<GLfloat> sphereVertices;
     float radius = 1.0f; // sphere radius
@@ -439,7 +449,6 @@ void set_up_particle_rendering(unsigned int& sphereVBO, unsigned int& sphereVAO,
     glGenVertexArrays(1, &sphereVAO);
     glGenBuffers(1, &sphereVBO);
     glGenBuffers(1, &sphereEBO);
-    glGenBuffers(1, &particle_instance_VBO);
 
     glBindVertexArray(sphereVAO);
 
@@ -464,22 +473,44 @@ void set_up_particle_rendering(unsigned int& sphereVBO, unsigned int& sphereVAO,
     // glVertexAttribDivisor(1, 1);
 
 
-    glBindBuffer(GL_ARRAY_BUFFER, particle_instance_VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * particle_num, NULL, GL_DYNAMIC_DRAW);// dynamic draw, update every frame
+    // a ring of a frame of instances per region, the attribute pointers move to the region of the frame in render_sphere_instanced
+    particle_instances.set_up(sizeof(GLfloat) * 6 * particle_num);
 
 
     // set model matrix attribute pointer
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)0);
     glEnableVertexAttribArray(1);
     glVertexAttribDivisor(1, 1);
     // set color attribute pointer
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(2);
     glVertexAttribDivisor(2, 1);
 
 
 }
 
+// set up particle impostor rendering: one quad of 4 corners, turned to the camera at every particle by the vertex shader,
+// the instances come from the same ring as the spheres
+void set_up_particle_impostor_rendering(unsigned int& impostor_VBO, unsigned int& impostor_VAO) {
+    // a triangle strip, counter clockwise seen from the camera
+    GLfloat corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+    glGenVertexArrays(1, &impostor_VAO);
+    glGenBuffers(1, &impostor_VBO);
+
+    glBindVertexArray(impostor_VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, impostor_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    // position and color per particle, pointed at the region of the frame in render_SPH_particle_impostors
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+}
+
 // set up sphere rendering, just one sphere, not instanced
 void set_up_sphere_rendering(unsigned int& sphereVBO, unsigned int& sphereVAO, unsigned int& sphereEBO) {
     std::vector<GLfloat> sphereVertices;
@@ -553,8 +584,25 @@ void render_sphere(Shader& ourShader, unsigned int& sphere_VBO, unsigned int& sp
 
 }
 
+// update particle position, the instances of the cells in view into the next region of the ring, which the GPU is done
+// with, and point the instance attributes 1 and 2 of the bound VAO at it; returns the number of instances
+static GLsizei stream_particle_instances(instance_ring& particle_instances, const particle_instance_data& instances, const frame_culling& culling) {
+    profile_scope scope(PHASE_GPU_UPLOAD);
+    GLsizei intance_num = culling.stats.visible_particles;
+    size_t bytes = sizeof(GLfloat) * 6 * intance_num;
+    void* target = particle_instances.begin_write(bytes);
+    if (target) {
+        copy_visible_particles(instances, culling, static_cast<GLfloat*>(target));
+    }
+    size_t offset = particle_instances.end_write();
+    glBindBuffer(GL_ARRAY_BUFFER, particle_instances.buffer());
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)offset);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)(offset + 3 * sizeof(float)));
+    return intance_num;
+}
+
 // render a single sphere given transformation matrix 'model', instanced rendering, would be more efficient
-void render_sphere_instanced(Shader& ourShader, unsigned int& sphere_VAO, GLsizei intance_num, unsigned int& particle_instance_VBO, GLfloat* particle_instance_data) {
+void render_sphere_instanced(Shader& ourShader, unsigned int& sphere_VAO, const particle_instance_data& instances, const frame_culling& culling, instance_ring& particle_instances) {
     // activate selected shader
     ourShader.use();
     glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, z_near, z_far);
@@ -566,11 +614,7 @@ void render_sphere_instanced(Shader& ourShader, unsigned int& sphere_VAO, GLsize
     ourShader.setMat4("scale", scale);
 
     glBindVertexArray(sphere_VAO);
-
-    // update particle position
-    glBindBuffer(GL_ARRAY_BUFFER, particle_instance_VBO);
-    // glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * 3 * intance_num, particle_vertices);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * 6 * intance_num, particle_instance_data);
+    GLsizei intance_num = stream_particle_instances(particle_instances, instances, culling);
 
     // render back faces to represnet contours
     ourShader.setBool("is_black", false);
@@ -584,6 +628,7 @@ void render_sphere_instanced(Shader& ourShader, unsigned int& sphere_VAO, GLsize
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINES);
     glDrawElementsInstanced(GL_TRIANGLES, 768, GL_UNSIGNED_INT, 0, intance_num);
     glCullFace(GL_BACK);
+    particle_instances.fence();
 }
 
 
@@ -656,25 +701,42 @@ void render_SPH_particles_x(std::vector<particle>& particles, Shader& ourShader,
 }
 
 // render particles, use instanced rendering
-void render_SPH_particles(std::vector<particle>& particles, Shader& ourShader, unsigned int& sphere_VBO, unsigned int& sphere_VAO, unsigned int& sphere_EBO, unsigned int& particle_instance_VBO) {
-    GLfloat* particle_instance_data = new GLfloat[particles.size() * 6]; // particle_vertices = {x,y,z,r,g,b} * particle_num
-    for (int i = 0; i < particles.size(); i++) {
-        const particle p = particles[i];
-        particle_instance_data[i * 6] = p.currPos[0];
-        particle_instance_data[i * 6 + 1] = p.currPos[1];
-        particle_instance_data[i * 6 + 2] = p.currPos[2];
-        GLfloat mass_visulization = 1.0f - ((particle_maximum_mass - p.mass) / (particle_maximum_mass - particle_mass));//0(initial minimum mass) to 1(saturated mass), 
-        glm::vec3 color = glm::vec3(mass_visulization, 0.3f, 0.6f);
-        particle_instance_data[i * 6 + 3] = color.x;
-        particle_instance_data[i * 6 + 4] = color.y;
-        particle_instance_data[i * 6 + 5] = color.z;
+void render_SPH_particles(const particle_instance_data& instances, const frame_culling& culling, Shader& ourShader, unsigned int& sphere_VBO, unsigned int& sphere_VAO, unsigned int& sphere_EBO, instance_ring& particle_instances) {
+    profile_scope scope(PHASE_DRAW);
+    render_sphere_instanced(ourShader, sphere_VAO, instances, culling, particle_instances);
+}
 
-        //particle_vertices[i * 3 + 2] = p.currPos[2];
+// the uniforms of both impostor passes
+static void set_impostor_uniforms(Shader& shader, const glm::mat4& projection, const glm::mat4& view, float lod_distance, bool far_pass) {
+    shader.use();
+    shader.setMat4("projection", projection);
+    shader.setMat4("view", view);
+    shader.setFloat("radius", particle_render_scale);
+    shader.setFloat("outline", 1.05f); // as the scaled back faces of render_sphere_instanced
+    shader.setFloat("lod_distance", lod_distance);
+    shader.setBool("far_pass", far_pass);
+}
 
-    }
+// render particles as impostors, a quad per particle: the fragment shader intersects the view ray with the sphere and
+// writes the depth of the hit, so they look and intersect like the sphere meshes, with 4 vertices instead of two draws of
+// 768 indices; particles farther than 'lod_distance' (0 = none) are drawn by a second pass as flat discs without the
+// per fragment depth (which turns off the early depth test)
+void render_SPH_particle_impostors(const particle_instance_data& instances, const frame_culling& culling, Shader& impostor_shader, Shader& disc_shader, unsigned int& impostor_VAO, instance_ring& particle_instances, float lod_distance) {
+    profile_scope scope(PHASE_DRAW);
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, z_near, z_far);
+    glm::mat4 view = camera.GetViewMatrix();
+
+    glBindVertexArray(impostor_VAO);
+    GLsizei intance_num = stream_particle_instances(particle_instances, instances, culling);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-    render_sphere_instanced(ourShader, sphere_VAO, particles.size(), particle_instance_VBO, particle_instance_data);
-    delete[]particle_instance_data;
+    set_impostor_uniforms(impostor_shader, projection, view, lod_distance, false);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, intance_num);
+    if (lod_distance > 0.0f) {
+        set_impostor_uniforms(disc_shader, projection, view, lod_distance, true);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, intance_num);
+    }
+    particle_instances.fence();
 }
 
 
@@ -700,30 +762,166 @@ void render_voxel_field_x(voxel_field& V, Shader& ourShader, unsigned int cube_V
 }
 
 // render voxel field, use instanced rendering
-void render_voxel_field(voxel_field& V, Shader& ourShader, unsigned int cube_VBO[2], unsigned int cube_VAO[2], unsigned int& voxel_instance_VBO) {
-    int voxel_count = 0;
-    GLfloat* voxel_instance_data = new GLfloat[voxel_x_num * voxel_y_num * voxel_z_num * 6];
-    for (int i = 0; i < voxel_x_num; i++) {
-        for (int j = 0; j < voxel_y_num; j++) {
-            for (int k = 0; k < voxel_z_num; k++) {
-                voxel* v = &V.get_voxel(i, j, k);
-                if (v->exist && !v->debug) {
-                    glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), voxel_to_world(i, j, k)), glm::vec3(voxel_size_scale));
-                    glm::vec3 translation = voxel_to_world(i, j, k);
-                    voxel_instance_data[voxel_count * 6] = translation.x;
-                    voxel_instance_data[voxel_count * 6 + 1] = translation.y;
-                    voxel_instance_data[voxel_count * 6 + 2] = translation.z;
-                    voxel_instance_data[voxel_count * 6 + 3] = v->color.x;
-                    voxel_instance_data[voxel_count * 6 + 4] = v->color.y;
-                    voxel_instance_data[voxel_count * 6 + 5] = v->color.z;
-                    voxel_count += 1;
-                }
-
+// brings voxel_instance_VBO from the version in 'gpu' to the version of 'instances'
+static void upload_voxel_instances(const voxel_instance_data& instances, voxel_gpu_state& gpu, unsigned int& voxel_instance_VBO) {
+    gpu.upload_bytes = 0;
+    if (instances.version != gpu.version) {
+        profile_scope upload(PHASE_GPU_UPLOAD);
+        glBindBuffer(GL_ARRAY_BUFFER, voxel_instance_VBO);
+        static std::vector<slot_range> ranges;
+        if (gpu.version != 0 && instances.changes.changes_since(gpu.version, instances.count, ranges)) {
+            for (const slot_range& r : ranges) {
+                glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * r.begin, sizeof(GLfloat) * 6 * (r.end - r.begin), instances.data.data() + size_t(r.begin) * 6);
+                gpu.upload_bytes += sizeof(GLfloat) * 6 * (r.end - r.begin);
             }
+        } else {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * 6 * instances.count, instances.data.data());
+            gpu.upload_bytes = sizeof(GLfloat) * 6 * instances.count;
+        }
+        gpu.version = instances.version;
+    }
+}
+
+void render_voxel_field(const voxel_instance_data& instances, voxel_gpu_state& gpu, Shader& ourShader, unsigned int cube_VBO[2], unsigned int cube_VAO[2], unsigned int& voxel_instance_VBO) {
+    profile_scope scope(PHASE_DRAW);
+    upload_voxel_instances(instances, gpu, voxel_instance_VBO);
+    render_cube_instanced(ourShader, cube_VAO, instances.count, voxel_instance_VBO, nullptr, glm::scale(glm::mat4(1.0f), glm::vec3(voxel_size_scale)));
+}
+
+view_frustum camera_view_frustum(float max_distance) {
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, z_near, z_far);
+    return make_view_frustum(projection, camera.GetViewMatrix(), camera.Position, max_distance);
+}
+
+// set up the culled voxel rendering: VAOs of the cube body and edge of set_up_cube_base_instance_rendering whose only
+// instance attribute is the slot, the shader fetches the instance of the slot from voxel_instance_VBO through a texture buffer
+void set_up_culled_voxel_rendering(unsigned int cube_VBO[2], unsigned int& voxel_instance_VBO, culled_voxel_gl& gl) {
+    long long voxel_count = (long long)voxel_x_num * voxel_y_num * voxel_z_num;
+    GLint max_texels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    // GL 3.3 only promises 65536 texels, an instance is 6 of them
+    gl.supported = max_texels >= 6 * voxel_count;
+    if (!gl.supported) {
+        std::cout << "voxel culling: texture buffers of " << max_texels << " texels are too small, every voxel is drawn" << std::endl;
+        return;
+    }
+
+    glGenTextures(1, &gl.instance_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, gl.instance_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, voxel_instance_VBO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    // grows when more slots are in view
+    gl.slots.set_up(sizeof(GLint) * 65536);
+
+    glGenVertexArrays(2, gl.VAO);
+    for (int part = 0; part < 2; part++) {
+        glBindVertexArray(gl.VAO[part]);
+        glBindBuffer(GL_ARRAY_BUFFER, cube_VBO[part]);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        // the slot, pointed at the region of the frame in render_culled_voxel_field
+        glEnableVertexAttribArray(1);
+        glVertexAttribDivisor(1, 1);
+    }
+}
+
+// render voxel field, only the slots in view: the instance buffer is kept up to date as in render_voxel_field, and the
+// slots stream through a ring, 4 bytes per drawn voxel
+void render_culled_voxel_field(const voxel_instance_data& instances, const std::vector<GLint>& slots, voxel_gpu_state& gpu, Shader& culled_shader, culled_voxel_gl& gl, unsigned int& voxel_instance_VBO) {
+    profile_scope scope(PHASE_DRAW);
+    upload_voxel_instances(instances, gpu, voxel_instance_VBO);
+
+    culled_shader.use();
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, z_near, z_far);
+    culled_shader.setMat4("projection", projection);
+    glm::mat4 view = camera.GetViewMatrix();
+    culled_shader.setMat4("view", view);
+    culled_shader.setMat4("scale", glm::scale(glm::mat4(1.0f), glm::vec3(voxel_size_scale)));
+    culled_shader.setInt("instances", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, gl.instance_texture);
+
+    size_t offset;
+    {
+        profile_scope upload(PHASE_GPU_UPLOAD);
+        size_t bytes = sizeof(GLint) * slots.size();
+        void* target = gl.slots.begin_write(bytes);
+        if (target) {
+            std::memcpy(target, slots.data(), bytes);
+        }
+        offset = gl.slots.end_write();
+        gpu.upload_bytes += bytes;
+    }
+    GLsizei count = GLsizei(slots.size());
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    // ---render cube body, then the edges
+    for (int part = 0; part < 2; part++) {
+        glBindVertexArray(gl.VAO[part]);
+        glBindBuffer(GL_ARRAY_BUFFER, gl.slots.buffer());
+        glVertexAttribIPointer(1, 1, GL_INT, sizeof(GLint), (void*)offset);
+        culled_shader.setBool("is_black", part == 1);
+        if (part == 0) {
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 36, count);
+        } else {
+            glDrawArraysInstanced(GL_LINES, 0, 24, count);
+        }
+    }
+    gl.slots.fence();
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// render the terrain as chunk meshes, the thin GL layer over voxel_mesh.h
+void render_terrain_mesh(const std::vector<std::shared_ptr<const chunk_mesh>>& meshes, const std::vector<char>& visible_chunks, Shader& terrain_shader, std::vector<terrain_chunk_gl>& chunks, uint64_t& upload_bytes) {
+    profile_scope scope(PHASE_DRAW);
+    terrain_shader.use();
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, z_near, z_far);
+    terrain_shader.setMat4("projection", projection);
+    glm::mat4 view = camera.GetViewMatrix();
+    terrain_shader.setMat4("view", view);
+    terrain_shader.setVec3("low_density_color", glm::vec3(dark_red));
+    terrain_shader.setVec3("high_density_color", glm::vec3(soil_color));
+    terrain_shader.setVec3("light_direction", glm::normalize(glm::vec3(-0.3f, -1.0f, -0.5f)));
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    upload_bytes = 0;
+    chunks.resize(meshes.size());
+    for (size_t c = 0; c < meshes.size(); c++) {
+        const std::shared_ptr<const chunk_mesh>& mesh = meshes[c];
+        terrain_chunk_gl& gl = chunks[c];
+        // a chunk out of view is neither drawn nor uploaded, until it comes into view
+        if (!mesh || mesh->indices.empty() || c >= visible_chunks.size() || !visible_chunks[c]) {
+            continue;
+        }
+        if (gl.VAO == 0) {
+            glGenVertexArrays(1, &gl.VAO);
+            glGenBuffers(1, &gl.VBO);
+            glGenBuffers(1, &gl.EBO);
+            glBindVertexArray(gl.VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, gl.VBO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl.EBO);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void*)offsetof(mesh_vertex, position));
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void*)offsetof(mesh_vertex, normal));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void*)offsetof(mesh_vertex, density));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void*)offsetof(mesh_vertex, deposited));
+            glEnableVertexAttribArray(3);
+        }
+        glBindVertexArray(gl.VAO);
+        // a remeshed chunk is a new mesh, the buffers are replaced as a whole (the size changes with the mesh)
+        if (gl.uploaded != mesh) {
+            profile_scope upload(PHASE_GPU_UPLOAD);
+            glBindBuffer(GL_ARRAY_BUFFER, gl.VBO);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(mesh_vertex) * mesh->vertices.size(), mesh->vertices.data(), GL_DYNAMIC_DRAW);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh->indices.size(), mesh->indices.data(), GL_DYNAMIC_DRAW);
+            upload_bytes += sizeof(mesh_vertex) * mesh->vertices.size() + sizeof(GLuint) * mesh->indices.size();
+            gl.uploaded = mesh;
         }
+        glDrawElements(GL_TRIANGLES, GLsizei(mesh->indices.size()), GL_UNSIGNED_INT, 0);
     }
-    render_cube_instanced(ourShader, cube_VAO, voxel_count, voxel_instance_VBO, voxel_instance_data, glm::scale(glm::mat4(1.0f), glm::vec3(voxel_size_scale)));
-    delete[]voxel_instance_data;
+    glBindVertexArray(0);
 }
 
 //void render_debug
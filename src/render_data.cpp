@@ -0,0 +1,285 @@
+#include <algorithm>
+
+#include <render_data.h>
+#include <parallel.h>
+
+
+void build_particle_instance_data(const std::vector<particle>& particles, int count, const cull_grid& cells, particle_instance_data& instances) {
+    instances.count = count;
+    instances.cells = cells;
+    instances.data.resize(size_t(count) * 6); // particle_vertices = {x,y,z,r,g,b} * particle_num
+    int cell_count = std::max(cells.cell_count(), 1);
+    instances.cell_begin.assign(cell_count + 1, 0);
+
+    // a counting sort by cell: the particles are split into blocks, each block counts its cells, then writes its
+    // particles to its part of each cell; the blocks keep their order within a cell, so the result does not depend on
+    // the thread count (only the simulation thread builds particle instances, the scratch vectors are kept between calls)
+    static std::vector<int> cell_of, position;
+    cell_of.resize(count);
+    int blocks = std::min(parallel_default_threads(), std::max(count / 4096, 1));
+    position.assign(size_t(blocks) * cell_count, 0);
+    parallel_region(blocks, [&](int thread, int team) {
+        for (int block = thread; block < blocks; block += team) {
+            int begin, end;
+            static_range(count, block, blocks, begin, end);
+            int* histogram = &position[size_t(block) * cell_count];
+            for (int i = begin; i < end; i++) {
+                cell_of[i] = cells.cell_count() > 0 ? cells.cell_of(particles[i].currPos) : 0;
+                histogram[cell_of[i]]++;
+            }
+        }
+    });
+    // the first place of every (cell, block)
+    int next = 0;
+    for (int c = 0; c < cell_count; c++) {
+        instances.cell_begin[c] = next;
+        for (int b = 0; b < blocks; b++) {
+            int n = position[size_t(b) * cell_count + c];
+            position[size_t(b) * cell_count + c] = next;
+            next += n;
+        }
+    }
+    instances.cell_begin[cell_count] = next;
+
+    parallel_region(blocks, [&](int thread, int team) {
+        for (int block = thread; block < blocks; block += team) {
+            int begin, end;
+            static_range(count, block, blocks, begin, end);
+            int* place = &position[size_t(block) * cell_count];
+            for (int i = begin; i < end; i++) {
+                const particle& p = particles[i];
+                GLfloat* data = &instances.data[size_t(place[cell_of[i]]++) * 6];
+                data[0] = p.currPos[0];
+                data[1] = p.currPos[1];
+                data[2] = p.currPos[2];
+                GLfloat mass_visulization = 1.0f - ((particle_maximum_mass - p.mass) / (particle_maximum_mass - particle_mass));//0(initial minimum mass) to 1(saturated mass), 
+                glm::vec3 color = glm::vec3(mass_visulization, 0.3f, 0.6f);
+                data[3] = color.x;
+                data[4] = color.y;
+                data[5] = color.z;
+            }
+        }
+    });
+}
+
+int build_voxel_instance_data(voxel_field& V, std::vector<GLfloat>& data) {
+    int voxel_count = 0;
+    data.resize(size_t(V.x_size) * V.y_size * V.z_size * 6);
+    for (int i = 0; i < V.x_size; i++) {
+        for (int j = 0; j < V.y_size; j++) {
+            for (int k = 0; k < V.z_size; k++) {
+                voxel* v = &V.get_voxel(i, j, k);
+                if (v->exist && !v->debug) {
+                    glm::vec3 translation = voxel_to_world(i, j, k);
+                    data[voxel_count * 6] = translation.x;
+                    data[voxel_count * 6 + 1] = translation.y;
+                    data[voxel_count * 6 + 2] = translation.z;
+                    data[voxel_count * 6 + 3] = v->color.x;
+                    data[voxel_count * 6 + 4] = v->color.y;
+                    data[voxel_count * 6 + 5] = v->color.z;
+                    voxel_count += 1;
+                }
+
+            }
+        }
+    }
+    return voxel_count;
+}
+
+
+void voxel_change_log::restart(uint64_t version) {
+    entries.clear();
+    base = version;
+}
+
+void voxel_change_log::add(uint64_t version, const std::vector<slot_range>& ranges) {
+    for (const slot_range& r : ranges) {
+        entries.push_back({ version, r });
+    }
+    while (!entries.empty() && entries.front().version + history <= version) {
+        base = std::max(base, entries.front().version);
+        entries.pop_front();
+    }
+}
+
+bool voxel_change_log::changes_since(uint64_t since, int count, std::vector<slot_range>& ranges) const {
+    ranges.clear();
+    if (since < base) {
+        return false;
+    }
+    for (const entry& e : entries) {
+        if (e.version > since && e.range.begin < count) {
+            ranges.push_back({ e.range.begin, std::min(e.range.end, count) });
+        }
+    }
+    std::sort(ranges.begin(), ranges.end(), [](const slot_range& a, const slot_range& b) { return a.begin < b.begin; });
+    int merged = 0;
+    for (const slot_range& r : ranges) {
+        if (merged > 0 && r.begin <= ranges[merged - 1].end) {
+            ranges[merged - 1].end = std::max(ranges[merged - 1].end, r.end);
+        } else {
+            ranges[merged++] = r;
+        }
+    }
+    ranges.resize(merged);
+    return true;
+}
+
+
+void voxel_instance_table::write_slot(int slot, int x, int y, int z, const voxel& v) {
+    glm::vec3 translation = voxel_to_world(x, y, z);
+    GLfloat* d = &instances[size_t(slot) * 6];
+    d[0] = translation.x;
+    d[1] = translation.y;
+    d[2] = translation.z;
+    d[3] = v.color.x;
+    d[4] = v.color.y;
+    d[5] = v.color.z;
+}
+
+void voxel_instance_table::rebuild(voxel_field& V) {
+    x_size = V.x_size;
+    y_size = V.y_size;
+    z_size = V.z_size;
+    slot_of.assign(size_t(x_size) * y_size * z_size, no_voxel);
+    voxel_of.clear();
+    instances.clear();
+    solid_count = 0;
+    // the scan sees every change stamped so far
+    dirty_cursor = 0;
+    V.collect_dirty_bricks(dirty_cursor);
+    for (int i = 0; i < x_size; i++) {
+        for (int j = 0; j < y_size; j++) {
+            for (int k = 0; k < z_size; k++) {
+                const voxel& v = V.get_voxel(i, j, k);
+                if (!v.exist || v.debug) {
+                    continue;
+                }
+                int index = (i * y_size + j) * z_size + k;
+                solid_count++;
+                if (!exposed(V, i, j, k)) {
+                    slot_of[index] = buried;
+                } else {
+                    slot_of[index] = int(voxel_of.size());
+                    voxel_of.push_back(index);
+                    instances.resize(instances.size() + 6);
+                    write_slot(slot_of[index], i, j, k, v);
+                }
+            }
+        }
+    }
+    current++;
+    log.restart(current);
+}
+
+bool voxel_instance_table::exposed(voxel_field& V, int x, int y, int z) const {
+    if (!SURFACE_VOXELS) {
+        return true;
+    }
+    static const int neighbours[6][3] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+    for (const int* n : neighbours) {
+        // out of the field is NULL_VOXEL, which does not exist
+        const voxel& neighbour = V.get_voxel(x + n[0], y + n[1], z + n[2]);
+        if (!neighbour.exist || neighbour.debug) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void voxel_instance_table::refresh(voxel_field& V, int x, int y, int z) {
+    const voxel& v = V.get_voxel(x, y, z);
+    int index = (x * y_size + y) * z_size + z;
+    int slot = slot_of[index];
+    bool drawn = v.exist && !v.debug;
+    solid_count += int(drawn) - int(slot != no_voxel);
+    if (drawn && !exposed(V, x, y, z)) {
+        slot_of[index] = buried;
+        drawn = false;
+    } else if (!drawn) {
+        slot_of[index] = no_voxel;
+    }
+    if (drawn) {
+        if (slot < 0) {
+            slot = slot_of[index] = int(voxel_of.size());
+            voxel_of.push_back(index);
+            instances.resize(instances.size() + 6);
+        } else {
+            // stamped bricks are mostly unchanged voxels next to the changed ones, only count real changes
+            glm::vec3 translation = voxel_to_world(x, y, z);
+            const GLfloat* d = &instances[size_t(slot) * 6];
+            if (d[0] == translation.x && d[1] == translation.y && d[2] == translation.z && d[3] == v.color.x && d[4] == v.color.y && d[5] == v.color.z) {
+                return;
+            }
+        }
+        write_slot(slot, x, y, z, v);
+        changed.push_back(slot);
+    } else if (slot >= 0) {
+        // the last instance moves into the freed slot
+        int last = int(voxel_of.size()) - 1;
+        if (slot != last) {
+            voxel_of[slot] = voxel_of[last];
+            slot_of[voxel_of[slot]] = slot;
+            std::copy(instances.begin() + size_t(last) * 6, instances.begin() + size_t(last) * 6 + 6, instances.begin() + size_t(slot) * 6);
+            changed.push_back(slot);
+        }
+        voxel_of.pop_back();
+        instances.resize(instances.size() - 6);
+    }
+}
+
+void voxel_instance_table::update(voxel_field& V) {
+    if (current == 0 || V.x_size != x_size || V.y_size != y_size || V.z_size != z_size) {
+        rebuild(V);
+        return;
+    }
+    changed.clear();
+    // the brick and the layer of voxels around it, whose faces toward the brick may have opened or closed
+    const int b = voxel_field::brick_size;
+    for (int brick : V.collect_dirty_bricks(dirty_cursor)) {
+        int bz = brick % V.brick_z_num;
+        int by = (brick / V.brick_z_num) % V.brick_y_num;
+        int bx = brick / (V.brick_z_num * V.brick_y_num);
+        for (int i = std::max(bx * b - 1, 0); i < std::min((bx + 1) * b + 1, x_size); i++) {
+            for (int j = std::max(by * b - 1, 0); j < std::min((by + 1) * b + 1, y_size); j++) {
+                for (int k = std::max(bz * b - 1, 0); k < std::min((bz + 1) * b + 1, z_size); k++) {
+                    refresh(V, i, j, k);
+                }
+            }
+        }
+    }
+    if (changed.empty()) {
+        return;
+    }
+    // one range per run of changed slots, short gaps are uploaded along with them instead of costing another call
+    std::sort(changed.begin(), changed.end());
+    std::vector<slot_range> ranges;
+    for (int slot : changed) {
+        if (!ranges.empty() && slot <= ranges.back().end + 8) {
+            ranges.back().end = slot + 1;
+        } else {
+            ranges.push_back({ slot, slot + 1 });
+        }
+    }
+    current++;
+    log.add(current, ranges);
+}
+
+void voxel_instance_table::copy_to(voxel_instance_data& target) const {
+    if (target.version == current) {
+        return;
+    }
+    std::vector<slot_range> ranges;
+    target.data.resize(instances.size());
+    if (target.version != 0 && log.changes_since(target.version, count(), ranges)) {
+        for (const slot_range& r : ranges) {
+            std::copy(instances.begin() + size_t(r.begin) * 6, instances.begin() + size_t(r.end) * 6, target.data.begin() + size_t(r.begin) * 6);
+        }
+    } else {
+        std::copy(instances.begin(), instances.end(), target.data.begin());
+    }
+    target.count = count();
+    target.solid = solid_count;
+    target.version = current;
+    target.changes = log;
+}
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+
+#include <replay.h>
+
+
+// ----------------------------------------------------------------------replay source------------------------------------------------------
+
+bool replay_source::open(const std::string& dir) {
+    if (!trajectory.open(dir + "/" + replay_trajectory_file)) {
+        return false;
+    }
+    std::string voxel_path = dir + "/" + replay_voxel_file;
+    has_voxels = std::filesystem::exists(voxel_path) && voxels.open(voxel_path);
+    if (!has_voxels) {
+        std::cout << "replay: no voxel stream in " << dir << ", the voxel field stays as generated" << std::endl;
+    }
+    else if (voxels.frame_count() < trajectory.frame_count()) {
+        std::cout << "replay: voxel stream is shorter than the trajectory (" << voxels.frame_count() << " vs "
+                  << trajectory.frame_count() << " frames)" << std::endl;
+    }
+    return true;
+}
+
+double replay_source::duration() const {
+    return frame_count() > 0 ? trajectory.frame_time(frame_count() - 1) : 0.0;
+}
+
+int replay_source::frame_at(double t) const {
+    // frame times are increasing, binary search for the last one <= t
+    int lo = 0, hi = frame_count() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (trajectory.frame_time(mid) <= t) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+bool replay_source::load_frame(int frame, std::vector<particle>& p, voxel_field& V) {
+    if (!trajectory.read_frame(frame, positions, &masses)) {
+        return false;
+    }
+    p.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        p[i].currPos = positions[i];
+        p[i].prevPos = positions[i];
+        p[i].mass = trajectory.has_mass() ? masses[i] : particle_mass;
+    }
+    current_particle_num = int(positions.size());
+    simulation_elapsed_time = trajectory.frame_time(frame);
+    if (has_voxels && frame < voxels.frame_count()) {
+        return voxels.apply_frame(frame, V);
+    }
+    return true;
+}
+
+
+// ----------------------------------------------------------------------camera script------------------------------------------------------
+
+bool camera_script::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cout << "camera script: cannot open " << path << std::endl;
+        return false;
+    }
+    keys.clear();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        camera_key key;
+        if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.look_at.x >> key.look_at.y >> key.look_at.z)) {
+            std::cout << "camera script: cannot parse line " << line_number << " of " << path << std::endl;
+            return false;
+        }
+        if (!(fields >> key.particle_scale)) {
+            key.particle_scale = -1.0f;
+        }
+        keys.push_back(key);
+    }
+    std::stable_sort(keys.begin(), keys.end(), [](const camera_key& a, const camera_key& b) { return a.time < b.time; });
+    return !keys.empty();
+}
+
+static glm::vec3 catmull_rom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) {
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+void camera_script::apply(double t, Camera& camera, float& particle_scale) const {
+    if (keys.empty()) {
+        return;
+    }
+    const int n = int(keys.size());
+    int i = 0; // segment [i, i + 1]
+    while (i + 1 < n && keys[i + 1].time <= t) {
+        i++;
+    }
+    glm::vec3 position = keys[i].position;
+    glm::vec3 look_at = keys[i].look_at;
+    if (i + 1 < n && t > keys[i].time) {
+        float s = float((t - keys[i].time) / (keys[i + 1].time - keys[i].time));
+        // the ends are extended by mirroring, like OffscreenProcessCamera does for its first point
+        const camera_key& k1 = keys[i];
+        const camera_key& k2 = keys[i + 1];
+        glm::vec3 p0 = i > 0 ? keys[i - 1].position : 2.0f * k1.position - k2.position;
+        glm::vec3 p3 = i + 2 < n ? keys[i + 2].position : 2.0f * k2.position - k1.position;
+        glm::vec3 l0 = i > 0 ? keys[i - 1].look_at : 2.0f * k1.look_at - k2.look_at;
+        glm::vec3 l3 = i + 2 < n ? keys[i + 2].look_at : 2.0f * k2.look_at - k1.look_at;
+        position = catmull_rom(p0, k1.position, k2.position, p3, s);
+        look_at = catmull_rom(l0, k1.look_at, k2.look_at, l3, s);
+    }
+    camera.Position = position;
+    camera.Front = glm::normalize(look_at - position);
+
+    for (int k = i; k >= 0; k--) {
+        if (keys[k].particle_scale >= 0.0f) {
+            particle_scale = keys[k].particle_scale;
+            break;
+        }
+    }
+}
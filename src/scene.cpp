@@ -0,0 +1,94 @@
+#include <cmath>
+
+#include <scene.h>
+#include <memory_tracker.h>
+#include <thread_config.h>
+#include <numa_placement.h>
+
+
+const std::vector<scene_desc> golden_scenes = {
+    { "default", 800, 16, 600, SCENE_RAIN },
+    { "demo", 35000, 64, 120, SCENE_RAIN },
+    { "dam_break", 8000, 16, 300, SCENE_DAM_BREAK },
+    { "stress", 200000, 128, 20, SCENE_RAIN },
+};
+
+const scene_desc* find_scene(const std::string& name) {
+    for (const scene_desc& scene : golden_scenes) {
+        if (name == scene.name) {
+            return &scene;
+        }
+    }
+    return nullptr;
+}
+
+void set_scene_size(const scene_desc& scene) {
+    set_field_size(GLfloat(scene.field_size));
+}
+
+// a flat floor of 'floor_height' world units of common destroyable voxels
+static void set_up_flat_floor(voxel_field& V, float floor_height) {
+    voxel v1;
+    v1.density = voxel_density;
+    v1.exist = true;
+    v1.is_new = false;
+    v1.not_destroyable = false;
+    v1.update_color();
+
+    int floor_layers = int(floor_height / voxel_size_scale);
+    for (int i = 0; i < V.x_size; i++) {
+        for (int j = 0; j < floor_layers && j < V.y_size; j++) {
+            for (int k = 0; k < V.z_size; k++) {
+                V.set_voxel(i, j, k, v1);
+            }
+        }
+    }
+}
+
+// particles on a lattice against the x_min wall, a quarter of the domain wide and as high as it needs to be
+static void set_up_water_block(std::vector<particle>& P, float floor_height) {
+    particle p1;
+    p1.prevPos = glm::vec3(0.0f, 0.0f, 0.0f);
+    p1.velocity = glm::vec3(0.0f, 0.0f, 0.0f);
+    p1.acceleration = glm::vec3(0.0f, 0.0f, 0.0f);
+    p1.pamameters = glm::vec3(0.0f, 0.0f, 0.0f);
+    p1.deltaCs = glm::vec3(0.0f, 0.0f, 0.0f);
+    p1.mass = particle_mass;
+    p1.stuck_count = 0;
+
+    const float spacing = smoothing_length * 0.5f;
+    const float margin = spacing;
+    int nx = std::max(int((x_max - x_min) / 4 / spacing), 1);
+    int nz = std::max(int((z_max - z_min - 2 * margin) / spacing), 1);
+    for (int i = 0; i < int(P.size()); i++) {
+        int layer = i / (nx * nz);
+        int x = i % nx;
+        int z = (i / nx) % nz;
+        // a little jitter, a perfect lattice is a degenerate case for the pressure
+        glm::vec3 jitter = generateRandomVec3(0.01f, -0.01f, 0.01f, -0.01f, 0.01f, -0.01f);
+        p1.currPos = glm::vec3(x_min + margin + x * spacing, floor_height + margin + layer * spacing, z_min + margin + z * spacing) + jitter;
+        p1.currPos.y = std::min(p1.currPos.y, y_max);
+        P[i] = p1;
+    }
+}
+
+void set_up_scene(const scene_desc& scene, unsigned int seed, voxel_field& V, std::vector<particle>& p) {
+    {
+        memory_scope memory(MEMORY_PARTICLES);
+        first_touch_resize(p, scene.particles, global_thread_config.threads(PHASE_DENSITY));
+    }
+    current_particle_num = scene.particles;
+    simulation_rng.seed(seed);
+    switch (scene.layout) {
+    case SCENE_RAIN:
+        set_up_voxel_field(V, voxel_density);
+        set_up_SPH_particles(p);
+        break;
+    case SCENE_DAM_BREAK: {
+        const float floor_height = 1.0f;
+        set_up_flat_floor(V, floor_height);
+        set_up_water_block(p, floor_height);
+        break;
+    }
+    }
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+
+#include <task_graph.h>
+#include <tracer.h>
+#include <thread_config.h>
+
+
+task_graph::~task_graph() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    for (std::thread& t : helpers) {
+        t.join();
+    }
+}
+
+int task_graph::add(const char* name, std::function<void()> work, uint32_t reads, uint32_t writes, task_thread thread) {
+    int index = int(tasks.size());
+    task t;
+    t.name = name;
+    t.work = std::move(work);
+    t.reads = reads;
+    t.writes = writes;
+    t.thread = thread;
+    for (int e = 0; e < index; e++) {
+        task& earlier = tasks[e];
+        // read after write, write after write, write after read
+        if ((earlier.writes & (reads | writes)) || (earlier.reads & writes)) {
+            t.after.push_back(e);
+            earlier.successors.push_back(index);
+        }
+    }
+    tasks.push_back(std::move(t));
+    last.names.push_back(name);
+    last.begin.push_back(0);
+    last.end.push_back(0);
+    last.critical.push_back(0);
+    return index;
+}
+
+void task_graph::run() {
+    if (tasks.empty()) {
+        return;
+    }
+    start = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        caller_ready.clear();
+        any_ready.clear();
+        finished = 0;
+        bool any_thread_tasks = false;
+        for (int t = 0; t < int(tasks.size()); t++) {
+            tasks[t].waiting = int(tasks[t].after.size());
+            if (tasks[t].waiting == 0) {
+                (tasks[t].thread == TASK_CALLER_THREAD ? caller_ready : any_ready).push_back(t);
+            }
+            any_thread_tasks |= tasks[t].thread == TASK_ANY_THREAD;
+        }
+        // the helpers are started by the first run that can use them and then sleep between the runs
+        while (any_thread_tasks && int(helpers.size()) < helper_count) {
+            helpers.emplace_back([this] { helper(); });
+        }
+        running = true;
+    }
+    changed.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (finished < int(tasks.size())) {
+        int t;
+        if (take(true, t)) {
+            lock.unlock();
+            execute(t);
+            lock.lock();
+            finish(t);
+            continue;
+        }
+        changed.wait(lock);
+    }
+    running = false;
+    lock.unlock();
+
+    last.wall = *std::max_element(last.end.begin(), last.end.end());
+    measure_critical_path();
+}
+
+void task_graph::execute(int t) {
+    auto begin = std::chrono::steady_clock::now();
+    tasks[t].work();
+    auto end = std::chrono::steady_clock::now();
+    last.begin[t] = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - start).count();
+    last.end[t] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    if (global_tracer.active()) {
+        global_tracer.record(tasks[t].name, global_tracer.to_trace_time(begin), global_tracer.to_trace_time(end));
+    }
+}
+
+void task_graph::finish(int t) {
+    finished++;
+    for (int s : tasks[t].successors) {
+        if (--tasks[s].waiting == 0) {
+            std::vector<int>& ready = tasks[s].thread == TASK_CALLER_THREAD ? caller_ready : any_ready;
+            ready.insert(std::upper_bound(ready.begin(), ready.end(), s), s);
+        }
+    }
+    changed.notify_all();
+}
+
+bool task_graph::take(bool caller, int& t) {
+    // the calling thread does its own tasks first, they are the ones nobody else can do
+    std::vector<int>* ready = caller && !caller_ready.empty() ? &caller_ready : &any_ready;
+    if (ready->empty()) {
+        return false;
+    }
+    t = ready->front();
+    ready->erase(ready->begin());
+    return true;
+}
+
+void task_graph::helper() {
+    global_tracer.set_thread_name("task graph helper");
+    // started by the thread that runs the passes, which is pinned to the core of team thread 0
+    unpin_current_thread();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return stopping || (running && !any_ready.empty()); });
+        if (stopping) {
+            return;
+        }
+        int t;
+        take(false, t);
+        lock.unlock();
+        execute(t);
+        lock.lock();
+        finish(t);
+    }
+}
+
+void task_graph::measure_critical_path() {
+    // the tasks only wait for earlier tasks, so the index order is a topological order
+    std::vector<int64_t> path(tasks.size());
+    std::vector<int> previous(tasks.size(), -1);
+    int longest_end = 0;
+    last.work = 0;
+    for (int t = 0; t < int(tasks.size()); t++) {
+        int64_t longest = 0;
+        for (int a : tasks[t].after) {
+            if (path[a] > longest) {
+                longest = path[a];
+                previous[t] = a;
+            }
+        }
+        int64_t duration = last.end[t] - last.begin[t];
+        path[t] = longest + duration;
+        last.work += duration;
+        last.critical[t] = 0;
+        if (path[t] > path[longest_end]) {
+            longest_end = t;
+        }
+    }
+    last.critical_path = path[longest_end];
+    for (int t = longest_end; t >= 0; t = previous[t]) {
+        last.critical[t] = 1;
+    }
+}
+
+std::string task_graph_timings::critical_path_names() const {
+    std::string result;
+    for (int t = 0; t < task_count(); t++) {
+        if (critical[t]) {
+            result += result.empty() ? names[t] : std::string(" > ") + names[t];
+        }
+    }
+    return result;
+}
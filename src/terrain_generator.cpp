@@ -0,0 +1,87 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+#include <FastNoise/FastNoise.h>
+
+#include <terrain_generator.h>
+#include <parallel.h>
+#include <memory_tracker.h>
+
+
+bool terrain_config::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || key[0] == '#') {
+            continue;
+        }
+        bool read = true;
+        if (key == "node_tree") {
+            read = bool(fields >> node_tree);
+        } else if (key == "seed") {
+            read = bool(fields >> seed);
+        } else if (key == "frequency") {
+            read = bool(fields >> frequency);
+        } else if (key == "x_start") {
+            read = bool(fields >> x_start);
+        } else if (key == "y_start") {
+            read = bool(fields >> y_start);
+        } else if (key == "x_size") {
+            read = bool(fields >> x_size);
+        } else if (key == "z_size") {
+            read = bool(fields >> z_size);
+        } else if (key == "max_height") {
+            read = bool(fields >> max_height);
+        } else if (key == "tile_size") {
+            read = bool(fields >> tile_size);
+        } else {
+            std::cout << path << ": unknown key " << key << std::endl;
+        }
+        if (!read) {
+            std::cout << path << ": no value for " << key << std::endl;
+        }
+    }
+    return true;
+}
+
+bool generate_terrain(voxel_field& V, const terrain_config& config, const voxel& solid) {
+    FastNoise::SmartNode<> generator = FastNoise::NewFromEncodedNodeTree(config.node_tree.c_str());
+    if (!generator) {
+        std::cout << "terrain: cannot decode the node tree " << config.node_tree << std::endl;
+        return false;
+    }
+
+    int x_size = config.x_size > 0 ? std::min(config.x_size, V.x_size) : V.x_size;
+    int z_size = config.z_size > 0 ? std::min(config.z_size, V.z_size) : V.z_size;
+    const int b = voxel_field::brick_size;
+    int tile = std::max((config.tile_size + b - 1) / b, 1) * b;
+    int tiles_x = (x_size + tile - 1) / tile, tiles_z = (z_size + tile - 1) / tile;
+
+    parallel_for(0, tiles_x * tiles_z, [&](int t) {
+        memory_scope memory(MEMORY_VOXELS);
+        int x0 = (t / tiles_z) * tile, z0 = (t % tiles_z) * tile;
+        int x_num = std::min(tile, x_size - x0), z_num = std::min(tile, z_size - z0);
+        // the noise x runs fastest, it is the voxel z
+        std::vector<float> heights(size_t(x_num) * z_num);
+        generator->GenUniformGrid2D(heights.data(), config.x_start + z0, config.y_start + x0, z_num, x_num, config.frequency, config.seed);
+        for (int i = 0; i < x_num; i++) {
+            for (int k = 0; k < z_num; k++) {
+                // the noise from [-1, 1] to [0, 1], then to a height in voxels
+                float scaled_height = (heights[size_t(i) * z_num + k] + 1.0f) / 2.0f;
+                int height = std::min(static_cast<int>(scaled_height * config.max_height), V.y_size);
+                for (int j = 0; j < height; j++) {
+                    V.set_voxel(x0 + i, j, z0 + k, solid);
+                }
+            }
+        }
+    }, 1);
+    return true;
+}
@@ -0,0 +1,223 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <thread>
+#include <set>
+#include <map>
+#include <algorithm>
+
+#include <thread_config.h>
+#include <parallel.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
+thread_config global_thread_config;
+
+const std::vector<profile_phase> threaded_phases = { PHASE_DENSITY, PHASE_FORCE, PHASE_INTEGRATE };
+
+
+#ifdef __linux__
+
+static bool read_int(const std::filesystem::path& path, int& value) {
+    std::ifstream in(path);
+    return bool(in >> value);
+}
+
+cpu_topology detect_cpu_topology() {
+    cpu_topology t;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    // (package, core) -> lowest logical cpu of that core that we are allowed to run on
+    std::map<std::pair<int, int>, int> cores;
+    std::set<int> packages;
+    int logical = 0;
+    std::error_code error;
+    for (auto& entry : std::filesystem::directory_iterator("/sys/devices/system/cpu", error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() < 4 || name.compare(0, 3, "cpu") != 0 || !std::all_of(name.begin() + 3, name.end(), ::isdigit)) {
+            continue;
+        }
+        int cpu = std::stoi(name.substr(3));
+        int online = 1;
+        read_int(entry.path() / "online", online); // cpu0 usually has no 'online' file
+        if (!online || (have_mask && !CPU_ISSET(cpu, &allowed))) {
+            continue;
+        }
+        int package = 0, core = cpu;
+        read_int(entry.path() / "topology" / "physical_package_id", package);
+        read_int(entry.path() / "topology" / "core_id", core);
+        auto key = std::make_pair(package, core);
+        auto it = cores.find(key);
+        if (it == cores.end() || cpu < it->second) {
+            cores[key] = cpu;
+        }
+        packages.insert(package);
+        logical++;
+    }
+
+    if (logical == 0) {
+        t.logical_cpus = t.physical_cores = std::max(1, int(std::thread::hardware_concurrency()));
+        return t;
+    }
+    t.logical_cpus = logical;
+    t.physical_cores = int(cores.size());
+    t.packages = int(packages.size());
+    for (auto& core : cores) {
+        t.core_cpus.push_back(core.second);
+    }
+    return t;
+}
+
+#else
+
+cpu_topology detect_cpu_topology() {
+    cpu_topology t;
+    // no portable way to tell SMT siblings apart, assume two per core when there is an even number of logical cpus
+    t.logical_cpus = std::max(1, int(std::thread::hardware_concurrency()));
+    t.physical_cores = t.logical_cpus >= 4 && t.logical_cpus % 2 == 0 ? t.logical_cpus / 2 : t.logical_cpus;
+    return t;
+}
+
+#endif
+
+
+int thread_config::threads(profile_phase phase) const {
+    if (phase_threads[phase] > 0) {
+        return phase_threads[phase];
+    }
+    return default_threads > 0 ? default_threads : parallel_default_threads();
+}
+
+int thread_config::max_threads() const {
+    int n = default_threads > 0 ? default_threads : parallel_default_threads();
+    for (int p : phase_threads) {
+        n = std::max(n, p);
+    }
+    return n;
+}
+
+bool thread_config::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        int value;
+        if (!(fields >> key) || key[0] == '#' || !(fields >> value)) {
+            continue;
+        }
+        if (key == "default") {
+            default_threads = std::max(value, 0);
+            continue;
+        }
+        if (key == "pin") {
+            pin = value != 0;
+            continue;
+        }
+        bool known = false;
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            if (key == profile_phase_key(profile_phase(p))) {
+                phase_threads[p] = std::max(value, 0);
+                known = true;
+            }
+        }
+        if (!known) {
+            std::cout << path << ": unknown key " << key << std::endl;
+        }
+    }
+    return true;
+}
+
+bool thread_config::save(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    out << "# threads per phase, 0 = default\n";
+    out << "default " << default_threads << "\n";
+    out << "pin " << (pin ? 1 : 0) << "\n";
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        if (phase_threads[p] > 0) {
+            out << profile_phase_key(profile_phase(p)) << " " << phase_threads[p] << "\n";
+        }
+    }
+    return bool(out);
+}
+
+thread_config auto_thread_config(const cpu_topology& topology, const std::string& path) {
+    thread_config config;
+    config.default_threads = std::max(topology.physical_cores, 1);
+    config.pin = !topology.core_cpus.empty();
+    if (std::filesystem::exists(path) && config.load(path)) {
+        std::cout << "thread config loaded from " << path << std::endl;
+    }
+    return config;
+}
+
+thread_config fixed_thread_config(int threads) {
+    thread_config config;
+    config.default_threads = std::max(threads, 1);
+    return config;
+}
+
+#ifdef __linux__
+// the mask of the first thread that asks, before apply_thread_config pins it
+static const cpu_set_t& original_affinity() {
+    static cpu_set_t original = [] {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, &mask);
+            }
+        }
+        return mask;
+    }();
+    return original;
+}
+#endif
+
+void apply_thread_config(const thread_config& config, const cpu_topology& topology) {
+    global_thread_config = config;
+    int threads = config.max_threads();
+    parallel_set_default_threads(threads);
+
+#ifdef __linux__
+    // the OpenMP runtime (and the pool of parallel.h) keeps its threads, so pinning them once in a team of the largest
+    // size holds for every later region (smaller teams use the first threads of the pool); unpinning restores the mask the process started with
+    static bool pinned = false;
+    const cpu_set_t& original = original_affinity();
+    bool pin = config.pin && !topology.core_cpus.empty();
+    if (!pin && !pinned) {
+        return;
+    }
+    parallel_region(threads, [&](int thread, int /*team*/) {
+        cpu_set_t mask;
+        if (pin) {
+            CPU_ZERO(&mask);
+            CPU_SET(topology.core_cpus[thread % topology.core_cpus.size()], &mask);
+        }
+        else {
+            mask = original;
+        }
+        sched_setaffinity(0, sizeof(mask), &mask);
+    });
+    pinned = pin;
+#endif
+}
+
+void unpin_current_thread() {
+#ifdef __linux__
+    cpu_set_t mask = original_affinity();
+    sched_setaffinity(0, sizeof(mask), &mask);
+#endif
+}
@@ -0,0 +1,154 @@
+#include <iostream>
+#include <cstdio>
+#include <filesystem>
+#include <algorithm>
+
+#include <tracer.h>
+
+
+tracer global_tracer;
+
+tracer::tracer() : epoch(std::chrono::steady_clock::now()) {
+}
+
+tracer::thread_ring& tracer::local_ring() {
+    // shared with the tracer, so the events of a thread that already exited can still be written
+    thread_local std::shared_ptr<thread_ring> ring;
+    if (!ring) {
+        ring = std::make_shared<thread_ring>();
+        ring->events.resize(ring_size);
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        ring->tid = int(rings.size());
+        ring->name = "thread " + std::to_string(ring->tid);
+        rings.push_back(ring);
+    }
+    return *ring;
+}
+
+void tracer::record(const char* name, int64_t begin, int64_t end) {
+    thread_ring& ring = local_ring();
+    uint64_t n = ring.written.load(std::memory_order_relaxed);
+    ring.events[n % ring_size] = { name, begin, end };
+    ring.written.store(n + 1, std::memory_order_release);
+}
+
+void tracer::set_thread_name(const std::string& name) {
+    thread_ring& ring = local_ring();
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    ring.name = name;
+}
+
+void tracer::capture_frames(int frames) {
+    if (capture_remaining > 0) {
+        return;
+    }
+    capture_remaining = std::max(frames, 1);
+    capture_start = now();
+    update_recording();
+    std::cout << "tracer: capturing " << capture_remaining << " frames" << std::endl;
+}
+
+void tracer::set_slow_frame_trigger(float milliseconds, int frames) {
+    slow_frame_ms = milliseconds;
+    slow_frame_window = std::max(frames, 1);
+    recent_frame_starts.clear();
+    update_recording();
+}
+
+void tracer::update_recording() {
+    recording.store(capture_remaining > 0 || slow_frame_ms > 0.0f, std::memory_order_relaxed);
+}
+
+void tracer::end_frame(float frame_milliseconds) {
+    int64_t t = now();
+
+    if (capture_remaining > 0 && --capture_remaining == 0) {
+        dump(capture_start, t, "capture");
+        update_recording();
+    }
+
+    if (slow_frame_ms > 0.0f) {
+        recent_frame_starts.push_back(frame_start);
+        while (int(recent_frame_starts.size()) > slow_frame_window) {
+            recent_frame_starts.pop_front();
+        }
+        // the frames around a slow one are usually slow as well (and dumping is slow), one dump per window
+        if (cooldown > 0) {
+            cooldown--;
+        }
+        else if (frame_milliseconds > slow_frame_ms && frame_index > 0) {
+            std::cout << "tracer: frame " << frame_index << " took " << frame_milliseconds << "ms" << std::endl;
+            dump(recent_frame_starts.front(), t, "slow_frame");
+            cooldown = slow_frame_window;
+        }
+    }
+
+    frame_start = now();
+    frame_index++;
+}
+
+static void write_json_string(FILE* file, const std::string& s) {
+    std::fputc('"', file);
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            std::fputc('\\', file);
+        }
+        std::fputc(c, file);
+    }
+    std::fputc('"', file);
+}
+
+void tracer::dump(int64_t begin, int64_t end, const char* reason) {
+    std::filesystem::create_directories(output_dir);
+    char filename[64];
+    std::snprintf(filename, sizeof(filename), "/trace_%03d_%s.json", dump_count++, reason);
+    std::string path = output_dir + filename;
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::cout << "tracer: cannot open " << path << std::endl;
+        return;
+    }
+
+    std::vector<std::shared_ptr<thread_ring>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        snapshot = rings;
+    }
+
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    size_t count = 0;
+    for (auto& ring : snapshot) {
+        std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", ring->tid);
+        write_json_string(file, ring->name);
+        std::fprintf(file, "}}");
+        first = false;
+
+        // the owner may still be writing: only read what was published, and not more than a ring; the oldest slots are
+        // the next ones it overwrites, so the events are copied first and then checked against the count written since,
+        // an event whose slot the owner reached (or nearly reached, the margin) during the copy may be torn and is dropped
+        const uint64_t margin = 64;
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t oldest = written > uint64_t(ring_size) ? written - ring_size : 0;
+        std::vector<trace_event> copied(written - oldest);
+        for (uint64_t n = oldest; n < written; n++) {
+            copied[n - oldest] = ring->events[n % ring_size];
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t written_after = ring->written.load(std::memory_order_relaxed);
+        uint64_t intact = written_after + margin > uint64_t(ring_size) ? written_after + margin - ring_size : 0;
+        for (uint64_t n = std::max(oldest, intact); n < written; n++) {
+            const trace_event& e = copied[n - oldest];
+            if (e.end < begin || e.begin > end) {
+                continue;
+            }
+            std::fprintf(file, ",\n{\"name\":");
+            write_json_string(file, e.name);
+            std::fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", ring->tid, e.begin * 1e-3, (e.end - e.begin) * 1e-3);
+            count++;
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    std::fclose(file);
+    std::cout << "tracer: " << count << " events written to " << path << std::endl;
+}
@@ -0,0 +1,436 @@
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include <trajectory.h>
+#include <parallel.h>
+
+
+static_assert(sizeof(trajectory_header) == 56, "trajectory_header layout changed, bump trajectory_version");
+static_assert(sizeof(trajectory_frame_header) == 32, "trajectory_frame_header layout changed, bump trajectory_version");
+static_assert(sizeof(trajectory_index_entry) == 24, "trajectory_index_entry layout changed, bump trajectory_version");
+static_assert(sizeof(trajectory_footer) == 16, "trajectory_footer layout changed, bump trajectory_version");
+
+
+// ----------------------------------------------------------------------coding helpers------------------------------------------------------
+
+static uint16_t quantize(float v, float min, float max) {
+    float t = (v - min) / (max - min);
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    return static_cast<uint16_t>(t * 65535.0f + 0.5f);
+}
+
+static float dequantize(uint16_t q, float min, float max) {
+    return min + (max - min) * (float(q) / 65535.0f);
+}
+
+// prediction of particle 'i' channel 'c' from the previous frames, must be identical in the writer and the reader
+static uint16_t predict(int i, int c, int channels, bool is_keyframe, int frames_since_keyframe,
+                        const std::vector<uint16_t>& previous, int previous_count, const std::vector<uint16_t>& previous2, int previous2_count) {
+    if (is_keyframe || i >= previous_count) {
+        return 0;
+    }
+    int n = i * channels + c;
+    if (frames_since_keyframe < 2 || i >= previous2_count) {
+        return previous[n];
+    }
+    return static_cast<uint16_t>(2 * int(previous[n]) - int(previous2[n]));
+}
+
+static uint16_t zigzag(int16_t v) {
+    return static_cast<uint16_t>((uint16_t(v) << 1) ^ uint16_t(v >> 15));
+}
+
+static int16_t unzigzag(uint16_t v) {
+    return static_cast<int16_t>((v >> 1) ^ (0 - (v & 1)));
+}
+
+static void put_varint(std::vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+static bool get_varint(const uint8_t*& in, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (in >= end) {
+            return false;
+        }
+        uint8_t b = *in++;
+        v |= uint32_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// one block: for each channel, the zigzag residuals of the block's particles as varints,
+// a zero residual is only ever the single byte 0x00, so runs of them are stored as 0x00 + run length
+static void encode_block(std::vector<uint8_t>& out, const std::vector<uint16_t>& residual, int begin, int end, int channels) {
+    out.clear();
+    for (int c = 0; c < channels; c++) {
+        uint32_t zero_run = 0;
+        for (int i = begin; i < end; i++) {
+            uint16_t r = residual[size_t(i) * channels + c];
+            if (r == 0) {
+                zero_run++;
+                continue;
+            }
+            if (zero_run > 0) {
+                out.push_back(0);
+                put_varint(out, zero_run);
+                zero_run = 0;
+            }
+            put_varint(out, r);
+        }
+        if (zero_run > 0) {
+            out.push_back(0);
+            put_varint(out, zero_run);
+        }
+    }
+}
+
+static bool decode_block(const uint8_t* in, const uint8_t* end, std::vector<uint16_t>& residual, int begin, int stop, int channels) {
+    for (int c = 0; c < channels; c++) {
+        int i = begin;
+        while (i < stop) {
+            if (in >= end) {
+                return false;
+            }
+            if (*in == 0) {
+                in++;
+                uint32_t run;
+                if (!get_varint(in, end, run) || run > uint32_t(stop - i)) {
+                    return false;
+                }
+                for (uint32_t n = 0; n < run; n++) {
+                    residual[size_t(i++) * channels + c] = 0;
+                }
+            }
+            else {
+                uint32_t v;
+                if (!get_varint(in, end, v) || v > 0xFFFF) {
+                    return false;
+                }
+                residual[size_t(i++) * channels + c] = uint16_t(v);
+            }
+        }
+    }
+    return in == end;
+}
+
+
+// ----------------------------------------------------------------------writer------------------------------------------------------
+
+trajectory_writer::~trajectory_writer() {
+    close();
+}
+
+bool trajectory_writer::open(const std::string& path, const bounding_box& box, bool with_mass, int keyframe_interval, int block_size) {
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cout << "trajectory: cannot open " << path << std::endl;
+        return false;
+    }
+    std::memset(&header, 0, sizeof(header));
+    header.magic = trajectory_magic;
+    header.version = trajectory_version;
+    header.header_size = sizeof(trajectory_header);
+    header.has_mass = with_mass ? 1 : 0;
+    header.keyframe_interval = std::max(keyframe_interval, 1);
+    header.block_size = std::max(block_size, 1);
+    header.box_min[0] = box.x_min;
+    header.box_min[1] = box.y_min;
+    header.box_min[2] = box.z_min;
+    header.box_max[0] = box.x_max;
+    header.box_max[1] = box.y_max;
+    header.box_max[2] = box.z_max;
+    // mass drops below particle_mass a little during diffusion and rises above the maximum during deposition
+    header.mass_min = 0.5f * particle_mass;
+    header.mass_max = 1.5f * particle_maximum_mass;
+    std::fwrite(&header, sizeof(header), 1, file);
+    offset = sizeof(header);
+    index.clear();
+    frames_since_keyframe = 0;
+    previous_count = 0;
+    previous2_count = 0;
+    return true;
+}
+
+bool trajectory_writer::write_frame(const std::vector<particle>& p, int count, double time, int threads) {
+    if (file == nullptr) {
+        return false;
+    }
+    const int n = std::min(count, int(p.size()));
+    const int channels = header.has_mass ? 4 : 3;
+    const bool is_keyframe = index.empty() || frames_since_keyframe >= int(header.keyframe_interval);
+    const int block_size = int(header.block_size);
+    const int block_count = (n + block_size - 1) / block_size;
+
+    quantized.resize(size_t(n) * channels);
+    std::vector<uint16_t> residual(size_t(n) * channels);
+    block_data.resize(block_count);
+    int since = is_keyframe ? 0 : frames_since_keyframe;
+
+    parallel_for(0, block_count, [&](int b) {
+        int begin = b * block_size;
+        int end = std::min(begin + block_size, n);
+        for (int i = begin; i < end; i++) {
+            uint16_t* q = &quantized[size_t(i) * channels];
+            q[0] = quantize(p[i].currPos.x, header.box_min[0], header.box_max[0]);
+            q[1] = quantize(p[i].currPos.y, header.box_min[1], header.box_max[1]);
+            q[2] = quantize(p[i].currPos.z, header.box_min[2], header.box_max[2]);
+            if (channels == 4) {
+                q[3] = quantize(p[i].mass, header.mass_min, header.mass_max);
+            }
+            for (int c = 0; c < channels; c++) {
+                uint16_t pred = predict(i, c, channels, is_keyframe, since, previous, previous_count, previous2, previous2_count);
+                residual[size_t(i) * channels + c] = zigzag(static_cast<int16_t>(uint16_t(q[c] - pred)));
+            }
+        }
+        encode_block(block_data[b], residual, begin, end, channels);
+    }, 1, threads);
+
+    trajectory_frame_header frame;
+    std::memset(&frame, 0, sizeof(frame));
+    frame.magic = trajectory_frame_magic;
+    frame.particle_count = uint32_t(n);
+    frame.is_keyframe = is_keyframe ? 1 : 0;
+    frame.block_count = uint32_t(block_count);
+    frame.time = time;
+    for (const std::vector<uint8_t>& data : block_data) {
+        frame.payload_size += sizeof(uint32_t) + data.size();
+    }
+    std::fwrite(&frame, sizeof(frame), 1, file);
+    for (const std::vector<uint8_t>& data : block_data) {
+        uint32_t size = uint32_t(data.size());
+        std::fwrite(&size, sizeof(size), 1, file);
+        std::fwrite(data.data(), 1, data.size(), file);
+    }
+    if (std::ferror(file)) {
+        std::cout << "trajectory: write failed" << std::endl;
+        return false;
+    }
+
+    index.push_back({ offset, frame.particle_count, frame.is_keyframe, time });
+    offset += sizeof(frame) + frame.payload_size;
+
+    std::swap(previous2, previous);
+    std::swap(previous, quantized);
+    previous2_count = previous_count;
+    previous_count = n;
+    frames_since_keyframe = is_keyframe ? 1 : frames_since_keyframe + 1;
+    return true;
+}
+
+bool trajectory_writer::close() {
+    if (file == nullptr) {
+        return false;
+    }
+    trajectory_footer footer;
+    footer.index_offset = offset;
+    footer.frame_count = uint32_t(index.size());
+    footer.magic = trajectory_footer_magic;
+    std::fwrite(index.data(), sizeof(trajectory_index_entry), index.size(), file);
+    std::fwrite(&footer, sizeof(footer), 1, file);
+    bool ok = !std::ferror(file);
+    std::fclose(file);
+    file = nullptr;
+    return ok;
+}
+
+
+// ----------------------------------------------------------------------reader------------------------------------------------------
+
+bool trajectory_reader::open(const std::string& path) {
+    close();
+    if (!file.open(path)) {
+        std::cout << "trajectory: cannot open " << path << std::endl;
+        return false;
+    }
+    if (file.size() < sizeof(trajectory_header)) {
+        std::cout << "trajectory: file too small " << path << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != trajectory_magic || header.version != trajectory_version || header.header_size != sizeof(trajectory_header)) {
+        std::cout << "trajectory: unknown format or version in " << path << std::endl;
+        return false;
+    }
+    if (header.block_size == 0 || header.block_size > uint32_t(INT32_MAX)) {
+        std::cout << "trajectory: corrupt header in " << path << std::endl;
+        return false;
+    }
+
+    // use the index written by close(), or rebuild it if the recording was interrupted
+    trajectory_footer footer;
+    bool has_footer = false;
+    if (file.size() >= sizeof(trajectory_header) + sizeof(trajectory_footer)) {
+        std::memcpy(&footer, file.data() + file.size() - sizeof(footer), sizeof(footer));
+        // the index sits between the frames and the footer, compared without a sum that could wrap around
+        uint64_t index_end = file.size() - sizeof(footer);
+        has_footer = footer.magic == trajectory_footer_magic && footer.index_offset >= sizeof(trajectory_header) &&
+                     footer.index_offset <= index_end &&
+                     uint64_t(footer.frame_count) * sizeof(trajectory_index_entry) == index_end - footer.index_offset;
+    }
+    if (has_footer) {
+        index.resize(footer.frame_count);
+        std::memcpy(index.data(), file.data() + footer.index_offset, sizeof(trajectory_index_entry) * footer.frame_count);
+        for (size_t f = 0; f < index.size(); f++) {
+            // every frame header lies between the file header and the index
+            if (index[f].offset < sizeof(trajectory_header) || index[f].offset > footer.index_offset - sizeof(trajectory_frame_header)) {
+                std::cout << "trajectory: corrupt index entry " << f << " in " << path << std::endl;
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+    std::cout << "trajectory: no index in " << path << ", scanning frames" << std::endl;
+    return rebuild_index();
+}
+
+bool trajectory_reader::rebuild_index() {
+    index.clear();
+    uint64_t offset = sizeof(trajectory_header);
+    while (offset + sizeof(trajectory_frame_header) <= file.size()) {
+        trajectory_frame_header frame;
+        std::memcpy(&frame, file.data() + offset, sizeof(frame));
+        if (frame.magic != trajectory_frame_magic || frame.payload_size > file.size() - offset - sizeof(frame)) {
+            break;
+        }
+        index.push_back({ offset, frame.particle_count, frame.is_keyframe, frame.time });
+        offset += sizeof(frame) + frame.payload_size;
+    }
+    return !index.empty();
+}
+
+void trajectory_reader::close() {
+    file.close();
+    index.clear();
+    decoded_frame = -1;
+}
+
+// decode 'frame' on top of the current state, which must be the state of frame - 1 unless 'frame' is a keyframe
+bool trajectory_reader::decode_next(int frame) {
+    const trajectory_index_entry& entry = index[frame];
+    trajectory_frame_header fh;
+    std::memcpy(&fh, file.data() + entry.offset, sizeof(fh));
+    // open() checked that the frame header is in the file, the payload and the blocks are checked here
+    if (fh.magic != trajectory_frame_magic || fh.payload_size > file.size() - entry.offset - sizeof(fh) || fh.particle_count > uint32_t(INT32_MAX) ||
+        fh.block_count != (uint64_t(fh.particle_count) + header.block_size - 1) / header.block_size) {
+        std::cout << "trajectory: corrupt frame " << frame << std::endl;
+        decoded_frame = -1;
+        return false;
+    }
+    const int n = int(fh.particle_count);
+    const int channels = header.has_mass ? 4 : 3;
+    const bool is_keyframe = fh.is_keyframe != 0;
+    const int block_size = int(header.block_size);
+    const int since = is_keyframe ? 0 : frames_since_keyframe;
+
+    // locate the blocks first, then decode them in parallel
+    std::vector<const uint8_t*> block_begin(fh.block_count), block_end(fh.block_count);
+    const uint8_t* cursor = file.data() + entry.offset + sizeof(fh);
+    const uint8_t* payload_end = cursor + fh.payload_size;
+    for (uint32_t b = 0; b < fh.block_count; b++) {
+        uint32_t size;
+        if (payload_end - cursor < ptrdiff_t(sizeof(size))) {
+            std::cout << "trajectory: corrupt frame " << frame << std::endl;
+            decoded_frame = -1;
+            return false;
+        }
+        std::memcpy(&size, cursor, sizeof(size));
+        cursor += sizeof(size);
+        if (payload_end - cursor < ptrdiff_t(size)) {
+            std::cout << "trajectory: corrupt frame " << frame << std::endl;
+            decoded_frame = -1;
+            return false;
+        }
+        block_begin[b] = cursor;
+        block_end[b] = cursor + size;
+        cursor += size;
+    }
+
+    quantized.resize(size_t(n) * channels);
+    std::vector<uint16_t> residual(size_t(n) * channels);
+    bool ok = parallel_reduce(0, int(fh.block_count), true, [&](int b) {
+        int begin = b * block_size;
+        int end = std::min(begin + block_size, n);
+        if (!decode_block(block_begin[b], block_end[b], residual, begin, end, channels)) {
+            return false;
+        }
+        for (int i = begin; i < end; i++) {
+            for (int c = 0; c < channels; c++) {
+                uint16_t pred = predict(i, c, channels, is_keyframe, since, previous, previous_count, previous2, previous2_count);
+                quantized[size_t(i) * channels + c] = uint16_t(pred + uint16_t(unzigzag(residual[size_t(i) * channels + c])));
+            }
+        }
+        return true;
+    }, [](bool a, bool b) { return a && b; }, 1);
+    if (!ok) {
+        std::cout << "trajectory: corrupt block in frame " << frame << std::endl;
+        decoded_frame = -1;
+        return false;
+    }
+
+    std::swap(previous2, previous);
+    std::swap(previous, quantized);
+    previous2_count = previous_count;
+    previous_count = n;
+    frames_since_keyframe = is_keyframe ? 1 : frames_since_keyframe + 1;
+    decoded_frame = frame;
+    return true;
+}
+
+bool trajectory_reader::read_frame(int frame, std::vector<glm::vec3>& positions, std::vector<float>* masses) {
+    if (frame < 0 || frame >= frame_count()) {
+        return false;
+    }
+    if (decoded_frame != frame) {
+        int start = decoded_frame + 1;
+        if (decoded_frame < 0 || frame < decoded_frame + 1) {
+            // jump back to the nearest keyframe
+            start = frame;
+            while (start > 0 && !index[start].is_keyframe) {
+                start--;
+            }
+        }
+        else {
+            // going forward, a keyframe on the way is a shorter path
+            for (int k = frame; k > start; k--) {
+                if (index[k].is_keyframe) {
+                    start = k;
+                    break;
+                }
+            }
+        }
+        for (int f = start; f <= frame; f++) {
+            if (!decode_next(f)) {
+                return false;
+            }
+        }
+    }
+
+    const int n = previous_count;
+    const int channels = header.has_mass ? 4 : 3;
+    positions.resize(n);
+    for (int i = 0; i < n; i++) {
+        const uint16_t* q = &previous[size_t(i) * channels];
+        positions[i] = glm::vec3(dequantize(q[0], header.box_min[0], header.box_max[0]),
+                                 dequantize(q[1], header.box_min[1], header.box_max[1]),
+                                 dequantize(q[2], header.box_min[2], header.box_max[2]));
+    }
+    if (masses != nullptr && header.has_mass) {
+        masses->resize(n);
+        for (int i = 0; i < n; i++) {
+            (*masses)[i] = dequantize(previous[size_t(i) * channels + 3], header.mass_min, header.mass_max);
+        }
+    }
+    return true;
+}
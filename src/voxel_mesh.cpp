@@ -0,0 +1,191 @@
+#include <algorithm>
+
+#include <voxel_mesh.h>
+#include <parallel.h>
+#include <memory_tracker.h>
+
+
+// 0 = no face, otherwise 1 + the density level, plus density_levels for deposited voxels
+static int face_key(const voxel& v) {
+    float ratio = v.density / voxel_maximum_density;
+    int level = std::min(std::max(int(ratio * terrain_mesh::density_levels), 0), terrain_mesh::density_levels - 1);
+    return 1 + level + (v.is_new ? terrain_mesh::density_levels : 0);
+}
+
+// world position of the voxel corner (x, y, z), the voxel (x, y, z) spans the corners (x, y, z) to (x + 1, y + 1, z + 1)
+static glm::vec3 corner_to_world(const int c[3]) {
+    return voxel_to_world(c[0], c[1], c[2]) - glm::vec3(voxel_size_scale / 2);
+}
+
+// the quad of w x h faces with its corner at c, the corners go counter clockwise seen from the side 'sign' of axis d
+static void add_quad(chunk_mesh& mesh, int d, int u, int v, int sign, const int c[3], int w, int h, int key) {
+    int corners[4][3];
+    for (int i = 0; i < 4; i++) {
+        std::copy(c, c + 3, corners[i]);
+    }
+    corners[1][u] += w;
+    corners[2][u] += w;
+    corners[2][v] += h;
+    corners[3][v] += h;
+    if (sign < 0) {
+        std::swap(corners[1], corners[3]);
+    }
+
+    mesh_vertex vertex;
+    vertex.normal[0] = vertex.normal[1] = vertex.normal[2] = 0.0f;
+    vertex.normal[d] = GLfloat(sign);
+    vertex.density = ((key - 1) % terrain_mesh::density_levels + 0.5f) / terrain_mesh::density_levels;
+    vertex.deposited = key > terrain_mesh::density_levels ? 1.0f : 0.0f;
+    GLuint first = GLuint(mesh.vertices.size());
+    for (int i = 0; i < 4; i++) {
+        glm::vec3 position = corner_to_world(corners[i]);
+        vertex.position[0] = position.x;
+        vertex.position[1] = position.y;
+        vertex.position[2] = position.z;
+        mesh.vertices.push_back(vertex);
+    }
+    for (GLuint i : { 0u, 1u, 2u, 0u, 2u, 3u }) {
+        mesh.indices.push_back(first + i);
+    }
+}
+
+void build_chunk_mesh(voxel_field& V, const int begin[3], const int size[3], chunk_mesh& mesh) {
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    mesh.face_count = 0;
+    int end[3] = { begin[0] + size[0], begin[1] + size[1], begin[2] + size[2] };
+    mesh.lo = corner_to_world(begin);
+    mesh.hi = corner_to_world(end);
+    // the face key of every voxel of the chunk and of the layer around it (0 = not drawn), read from the field once
+    // instead of seven times in the slices below (out of the field is NULL_VOXEL, which does not exist)
+    int padded[3] = { size[0] + 2, size[1] + 2, size[2] + 2 };
+    std::vector<int> keys(size_t(padded[0]) * padded[1] * padded[2]);
+    for (int i = 0; i < padded[0]; i++) {
+        for (int j = 0; j < padded[1]; j++) {
+            for (int k = 0; k < padded[2]; k++) {
+                const voxel& v = V.get_voxel(begin[0] + i - 1, begin[1] + j - 1, begin[2] + k - 1);
+                keys[(i * padded[1] + j) * padded[2] + k] = v.exist && !v.debug ? face_key(v) : 0;
+            }
+        }
+    }
+    // the distance between neighbours along each axis in 'keys', and the key of chunk voxel (0, 0, 0)
+    int stride[3] = { padded[1] * padded[2], padded[2], 1 };
+    const int* origin = &keys[stride[0] + stride[1] + stride[2]];
+
+    std::vector<int> mask;
+    // every face direction: the axis d it faces along, and the two axes u, v of its plane, (d, u, v) cyclic so that
+    // u x v points along +d
+    for (int d = 0; d < 3; d++) {
+        int u = (d + 1) % 3, v = (d + 2) % 3;
+        mask.resize(size[u] * size[v]);
+        for (int sign = -1; sign <= 1; sign += 2) {
+            int facing = sign * stride[d];
+            for (int n = 0; n < size[d]; n++) {
+                // the faces of the slice that look at a voxel which is not drawn
+                for (int b = 0; b < size[v]; b++) {
+                    const int* voxel_key = origin + n * stride[d] + b * stride[v];
+                    int* row = &mask[b * size[u]];
+                    for (int a = 0; a < size[u]; a++, voxel_key += stride[u]) {
+                        row[a] = voxel_key[facing] == 0 ? *voxel_key : 0;
+                    }
+                }
+                // greedy: grow each face along u while the key matches, then along v while the whole row matches
+                for (int b = 0; b < size[v]; b++) {
+                    for (int a = 0; a < size[u];) {
+                        int* row = &mask[b * size[u]];
+                        int key = row[a];
+                        if (key == 0) {
+                            a++;
+                            continue;
+                        }
+                        int w = 1;
+                        while (a + w < size[u] && row[a + w] == key) {
+                            w++;
+                        }
+                        int h = 1;
+                        while (b + h < size[v]) {
+                            int* next = &mask[(b + h) * size[u]];
+                            if (!std::all_of(next + a, next + a + w, [key](int k) { return k == key; })) {
+                                break;
+                            }
+                            h++;
+                        }
+                        for (int r = b; r < b + h; r++) {
+                            std::fill(&mask[r * size[u] + a], &mask[r * size[u] + a] + w, 0);
+                        }
+
+                        int c[3];
+                        c[d] = begin[d] + n + (sign > 0 ? 1 : 0);
+                        c[u] = begin[u] + a;
+                        c[v] = begin[v] + b;
+                        add_quad(mesh, d, u, v, sign, c, w, h, key);
+                        mesh.face_count += w * h;
+                        a += w;
+                    }
+                }
+            }
+        }
+    }
+}
+
+int terrain_mesh::update(voxel_field& V) {
+    if (chunks.empty() || V.x_size != x_size || V.y_size != y_size || V.z_size != z_size) {
+        x_size = V.x_size;
+        y_size = V.y_size;
+        z_size = V.z_size;
+        chunk_x_num = (x_size + chunk_size - 1) / chunk_size;
+        chunk_y_num = (y_size + chunk_size - 1) / chunk_size;
+        chunk_z_num = (z_size + chunk_size - 1) / chunk_size;
+        chunks.assign(size_t(chunk_x_num) * chunk_y_num * chunk_z_num, nullptr);
+        dirty.assign(chunks.size(), 1);
+        // the full mesh sees every change stamped so far
+        dirty_cursor = 0;
+        V.collect_dirty_bricks(dirty_cursor);
+    } else {
+        // the chunks of the brick and of the layer of voxels around it, whose faces toward the brick may have changed
+        const int b = voxel_field::brick_size;
+        for (int brick : V.collect_dirty_bricks(dirty_cursor)) {
+            int bz = brick % V.brick_z_num;
+            int by = (brick / V.brick_z_num) % V.brick_y_num;
+            int bx = brick / (V.brick_z_num * V.brick_y_num);
+            int lo[3] = { bx * b - 1, by * b - 1, bz * b - 1 }, hi[3] = { (bx + 1) * b, (by + 1) * b, (bz + 1) * b };
+            int num[3] = { chunk_x_num, chunk_y_num, chunk_z_num };
+            int c_lo[3], c_hi[3];
+            for (int axis = 0; axis < 3; axis++) {
+                c_lo[axis] = std::max(lo[axis], 0) / chunk_size;
+                c_hi[axis] = std::min(hi[axis] / chunk_size, num[axis] - 1);
+            }
+            for (int i = c_lo[0]; i <= c_hi[0]; i++) {
+                for (int j = c_lo[1]; j <= c_hi[1]; j++) {
+                    for (int k = c_lo[2]; k <= c_hi[2]; k++) {
+                        dirty[(i * chunk_y_num + j) * chunk_z_num + k] = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<int> work;
+    for (int c = 0; c < chunk_count(); c++) {
+        if (dirty[c]) {
+            work.push_back(c);
+            dirty[c] = 0;
+        }
+    }
+    // chunks differ a lot in work (empty air, flat floor, eroded slopes), so they are taken one at a time
+    parallel_for(0, int(work.size()), [&](int w) {
+        memory_scope memory(MEMORY_RENDER);
+        int c = work[w];
+        int chunk[3] = { c / (chunk_y_num * chunk_z_num), (c / chunk_z_num) % chunk_y_num, c % chunk_z_num };
+        int begin[3], size[3];
+        int field[3] = { x_size, y_size, z_size };
+        for (int axis = 0; axis < 3; axis++) {
+            begin[axis] = chunk[axis] * chunk_size;
+            size[axis] = std::min(chunk_size, field[axis] - begin[axis]);
+        }
+        auto mesh = std::make_shared<chunk_mesh>();
+        build_chunk_mesh(V, begin, size, *mesh);
+        chunks[c] = std::move(mesh);
+    }, 1);
+    return int(work.size());
+}
@@ -0,0 +1,182 @@
+#include <iostream>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+
+#include <voxel_stream.h>
+#include <checkpoint.h>
+
+
+static_assert(sizeof(voxel_stream_header) == 32, "voxel_stream_header layout changed, bump voxel_stream_version");
+static_assert(sizeof(voxel_stream_frame_header) == 40, "voxel_stream_frame_header layout changed, bump voxel_stream_version");
+
+
+// ----------------------------------------------------------------------writer------------------------------------------------------
+
+voxel_stream_writer::~voxel_stream_writer() {
+    close();
+}
+
+bool voxel_stream_writer::open(const std::string& path, voxel_field& V, int keyframe_interval) {
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cout << "voxel stream: cannot open " << path << std::endl;
+        return false;
+    }
+    std::memset(&header, 0, sizeof(header));
+    header.magic = voxel_stream_magic;
+    header.version = voxel_stream_version;
+    header.header_size = sizeof(voxel_stream_header);
+    header.voxel_x_size = V.x_size;
+    header.voxel_y_size = V.y_size;
+    header.voxel_z_size = V.z_size;
+    header.brick_size = voxel_field::brick_size;
+    header.keyframe_interval = std::max(keyframe_interval, 1);
+    std::fwrite(&header, sizeof(header), 1, file);
+    frame_count = 0;
+    // start the cursor at the current epoch, the first frame is a keyframe anyway
+    V.collect_dirty_bricks(dirty_cursor);
+    return true;
+}
+
+bool voxel_stream_writer::write_frame(voxel_field& V, uint64_t step, double time) {
+    if (file == nullptr) {
+        return false;
+    }
+    bool is_keyframe = frame_count % header.keyframe_interval == 0;
+    bricks = V.collect_dirty_bricks(dirty_cursor);
+    if (is_keyframe) {
+        bricks.resize(V.brick_count());
+        std::iota(bricks.begin(), bricks.end(), 0);
+    }
+    copy_voxel_bricks(V, bricks, density, flags);
+
+    voxel_stream_frame_header frame;
+    std::memset(&frame, 0, sizeof(frame));
+    frame.magic = voxel_stream_frame_magic;
+    frame.brick_count = uint32_t(bricks.size());
+    frame.is_keyframe = is_keyframe ? 1 : 0;
+    frame.step = step;
+    frame.time = time;
+    frame.payload_size = sizeof(uint32_t) * bricks.size() + sizeof(float) * density.size() + flags.size();
+    std::fwrite(&frame, sizeof(frame), 1, file);
+    for (int b : bricks) {
+        uint32_t index = uint32_t(b);
+        std::fwrite(&index, sizeof(index), 1, file);
+    }
+    std::fwrite(density.data(), sizeof(float), density.size(), file);
+    std::fwrite(flags.data(), 1, flags.size(), file);
+    frame_count++;
+    if (std::ferror(file)) {
+        std::cout << "voxel stream: write failed" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool voxel_stream_writer::close() {
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = !std::ferror(file);
+    std::fclose(file);
+    file = nullptr;
+    return ok;
+}
+
+
+// ----------------------------------------------------------------------reader------------------------------------------------------
+
+bool voxel_stream_reader::open(const std::string& path) {
+    close();
+    if (!file.open(path)) {
+        std::cout << "voxel stream: cannot open " << path << std::endl;
+        return false;
+    }
+    if (file.size() < sizeof(voxel_stream_header)) {
+        std::cout << "voxel stream: file too small " << path << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != voxel_stream_magic || header.version != voxel_stream_version || header.header_size != sizeof(voxel_stream_header)) {
+        std::cout << "voxel stream: unknown format or version in " << path << std::endl;
+        return false;
+    }
+    if (header.brick_size == 0 || header.brick_size > 1024) {
+        std::cout << "voxel stream: corrupt header in " << path << std::endl;
+        return false;
+    }
+    // every brick is its index, brick_size^3 densities and brick_size^3 flags
+    const uint64_t brick_bytes = sizeof(uint32_t) + (sizeof(float) + 1) * uint64_t(header.brick_size) * header.brick_size * header.brick_size;
+    uint64_t offset = sizeof(voxel_stream_header);
+    while (offset + sizeof(voxel_stream_frame_header) <= file.size()) {
+        voxel_stream_frame_header frame;
+        std::memcpy(&frame, file.data() + offset, sizeof(frame));
+        if (frame.magic != voxel_stream_frame_magic) {
+            break;
+        }
+        // a recording that was cut short ends in a partial frame, the frames before it are still good
+        if (frame.payload_size > file.size() - offset - sizeof(frame)) {
+            std::cout << "voxel stream: frame " << frames.size() << " runs past the end of " << path << ", ignored" << std::endl;
+            break;
+        }
+        if (frame.payload_size % brick_bytes != 0 || frame.payload_size / brick_bytes != frame.brick_count) {
+            std::cout << "voxel stream: frame " << frames.size() << " of " << path << " has " << frame.brick_count << " bricks but "
+                      << frame.payload_size << " bytes, ignored from there" << std::endl;
+            break;
+        }
+        frames.push_back({ offset, frame.step, frame.time, frame.is_keyframe != 0 });
+        offset += sizeof(frame) + frame.payload_size;
+    }
+    return !frames.empty();
+}
+
+void voxel_stream_reader::close() {
+    file.close();
+    frames.clear();
+    applied_frame = -1;
+}
+
+bool voxel_stream_reader::apply_one(int frame, voxel_field& V) {
+    voxel_stream_frame_header fh;
+    std::memcpy(&fh, file.data() + frames[frame].offset, sizeof(fh));
+    const size_t brick_voxels = size_t(header.brick_size) * header.brick_size * header.brick_size;
+    const uint8_t* bricks = file.data() + frames[frame].offset + sizeof(fh);
+    const uint8_t* density = bricks + sizeof(uint32_t) * fh.brick_count;
+    const uint8_t* flags = density + sizeof(float) * brick_voxels * fh.brick_count;
+    if (!paste_voxel_bricks(V, bricks, density, flags, fh.brick_count)) {
+        std::cout << "voxel stream: brick index out of range in frame " << frame << std::endl;
+        applied_frame = -1;
+        return false;
+    }
+    applied_frame = frame;
+    return true;
+}
+
+bool voxel_stream_reader::apply_frame(int frame, voxel_field& V) {
+    if (frame < 0 || frame >= frame_count()) {
+        return false;
+    }
+    if (header.voxel_x_size != V.x_size || header.voxel_y_size != V.y_size || header.voxel_z_size != V.z_size || header.brick_size != voxel_field::brick_size) {
+        std::cout << "voxel stream: voxel field size mismatch" << std::endl;
+        return false;
+    }
+    if (frame == applied_frame) {
+        return true;
+    }
+    // start at the last keyframe <= frame, unless we can simply continue forward from the applied frame
+    int start = frame;
+    while (start > 0 && !frames[start].is_keyframe) {
+        start--;
+    }
+    if (applied_frame >= 0 && applied_frame < frame && applied_frame >= start) {
+        start = applied_frame + 1;
+    }
+    for (int f = start; f <= frame; f++) {
+        if (!apply_one(f, V)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+#include <algorithm>
+
+#include <work_partition.h>
+
+
+void work_partition::uniform(int count, int blocks) {
+    blocks = std::max(blocks, 1);
+    bounds.resize(blocks + 1);
+    // the split of schedule(static): the first count % blocks blocks get one item more
+    int chunk = count / blocks, extra = count % blocks;
+    for (int b = 0; b <= blocks; b++) {
+        bounds[b] = b * chunk + std::min(b, extra);
+    }
+}
+
+void work_partition::range(int thread, int team, int& begin, int& end) const {
+    int blocks = block_count();
+    if (blocks <= 0) {
+        begin = end = 0;
+        return;
+    }
+    int first = int(static_cast<long long>(thread) * blocks / team);
+    int last = int(static_cast<long long>(thread + 1) * blocks / team);
+    begin = bounds[first];
+    end = bounds[last];
+}